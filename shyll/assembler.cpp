@@ -0,0 +1,54 @@
+#include "assembler.h"
+
+#ifdef JIT_SUPPORTED
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+uint8_t* Assembler::Finish(size_t& size)
+{
+	for (const std::pair<size_t, size_t>& fixup : fixups)
+	{
+		int32_t rel = static_cast<int32_t>(labels[fixup.second] - (fixup.first + 4));
+		std::memcpy(&bytes[fixup.first], &rel, sizeof(int32_t));
+	}
+
+	size = bytes.size();
+#ifdef _WIN32
+	uint8_t* code = static_cast<uint8_t*>(VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+	if (!code) { return nullptr; }
+	std::memcpy(code, bytes.data(), size);
+	DWORD old;
+	if (!VirtualProtect(code, size, PAGE_EXECUTE_READ, &old))
+	{
+		Free(code, size);
+		return nullptr;
+	}
+#else
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) { return nullptr; }
+	uint8_t* code = static_cast<uint8_t*>(memory);
+	std::memcpy(code, bytes.data(), size);
+	if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0)
+	{
+		Free(code, size);
+		return nullptr;
+	}
+#endif
+	return code;
+}
+
+void Assembler::Free(uint8_t* code, size_t size)
+{
+	if (!code) { return; }
+#ifdef _WIN32
+	VirtualFree(code, 0, MEM_RELEASE);
+#else
+	munmap(code, size);
+#endif
+}
+#endif
\ No newline at end of file
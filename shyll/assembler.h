@@ -0,0 +1,372 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "jit.h"
+
+#ifdef JIT_SUPPORTED
+enum Reg
+{
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+enum Condition : uint8_t
+{
+	BELOW = 0x2,
+	ABOVE_EQUAL = 0x3,
+	EQUAL = 0x4,
+	NOT_EQUAL = 0x5,
+	BELOW_EQUAL = 0x6,
+	ABOVE = 0x7,
+	PARITY = 0xA,
+	NOT_PARITY = 0xB,
+	LESS = 0xC,
+	GREATER_EQUAL = 0xD,
+	LESS_EQUAL = 0xE,
+	GREATER = 0xF
+};
+
+// opcode bytes of the two-register ALU forms
+enum Alu : uint8_t
+{
+	ADD = 0x01,
+	OR = 0x09,
+	AND = 0x21,
+	SUB = 0x29,
+	XOR = 0x31,
+	CMP = 0x39,
+	TEST = 0x85
+};
+
+enum Shift : uint8_t
+{
+	SHL = 4,
+	SHR = 5,
+	SAR = 7
+};
+
+// scalar double opcodes, used with Sse
+enum SseOp : uint8_t
+{
+	MOVSD = 0x10,
+	UCOMISD = 0x2E,
+	XORPD = 0x57,
+	ADDSD = 0x58,
+	MULSD = 0x59,
+	SUBSD = 0x5C,
+	DIVSD = 0x5E
+};
+
+#ifdef _WIN32
+constexpr Reg ARG0 = RCX;
+constexpr Reg ARG1 = RDX;
+#else
+constexpr Reg ARG0 = RDI;
+constexpr Reg ARG1 = RSI;
+#endif
+
+// just enough of an x86-64 encoder for the jit and the tracer
+class Assembler
+{
+public:
+	std::vector<uint8_t> bytes;
+
+	static constexpr size_t UNBOUND = SIZE_MAX;
+
+	size_t NewLabel()
+	{
+		labels.push_back(UNBOUND);
+		return labels.size() - 1;
+	}
+
+	void Bind(size_t label)
+	{
+		labels[label] = bytes.size();
+	}
+
+	bool Bound(size_t label) const
+	{
+		return labels[label] != UNBOUND;
+	}
+
+	size_t Position(size_t label) const
+	{
+		return labels[label];
+	}
+
+	// the label of the instruction at this chunk offset
+	size_t OffsetLabel(size_t offset)
+	{
+		auto it = offsetLabels.find(offset);
+		if (it == offsetLabels.end())
+		{
+			it = offsetLabels.emplace(offset, NewLabel()).first;
+		}
+		return it->second;
+	}
+
+	const std::map<size_t, size_t>& OffsetLabels() const
+	{
+		return offsetLabels;
+	}
+
+	// patches every jump and copies the code into executable memory, nullptr if that fails.
+	uint8_t* Finish(size_t& size);
+	static void Free(uint8_t* code, size_t size);
+
+	void MovImm(Reg dst, uint64_t imm)
+	{
+		Rex(true, 0, dst);
+		Byte(0xB8 + (dst & 7));
+		Raw(&imm, sizeof(uint64_t));
+	}
+
+	void MovImm32(Reg dst, uint32_t imm)
+	{
+		if (dst >= R8) { Byte(0x41); }
+		Byte(0xB8 + (dst & 7));
+		Raw(&imm, sizeof(uint32_t));
+	}
+
+	void Mov(Reg dst, Reg src)
+	{
+		Alu(0x89, dst, src);
+	}
+
+	void Load(Reg dst, Reg base, int32_t disp)
+	{
+		Rex(true, dst, base);
+		Byte(0x8B);
+		Memory(dst, base, disp);
+	}
+
+	void Store(Reg base, int32_t disp, Reg src)
+	{
+		Rex(true, src, base);
+		Byte(0x89);
+		Memory(src, base, disp);
+	}
+
+	void Alu(uint8_t op, Reg dst, Reg src)
+	{
+		Rex(true, src, dst);
+		Byte(op);
+		Byte(ModRM(3, src, dst));
+	}
+
+	void AddImm(Reg dst, int32_t imm)
+	{
+		AluImm(0, dst, imm);
+	}
+
+	void SubImm(Reg dst, int32_t imm)
+	{
+		AluImm(5, dst, imm);
+	}
+
+	void XorImm(Reg dst, int32_t imm)
+	{
+		AluImm(6, dst, imm);
+	}
+
+	void CmpImm(Reg dst, int32_t imm)
+	{
+		AluImm(7, dst, imm);
+	}
+
+	void Cmp32Imm(Reg reg, uint32_t imm)
+	{
+		if (reg >= R8) { Byte(0x41); }
+		Byte(0x81);
+		Byte(ModRM(3, 7, reg));
+		Raw(&imm, sizeof(uint32_t));
+	}
+
+	void Imul(Reg dst, Reg src)
+	{
+		Rex(true, dst, src);
+		Byte(0x0F);
+		Byte(0xAF);
+		Byte(ModRM(3, dst, src));
+	}
+
+	// sign extends rax into rdx, then divides rdx:rax by reg
+	void Idiv(Reg reg)
+	{
+		Byte(0x48);
+		Byte(0x99);
+		Rex(true, 0, reg);
+		Byte(0xF7);
+		Byte(ModRM(3, 7, reg));
+	}
+
+	void Neg(Reg reg)
+	{
+		Rex(true, 0, reg);
+		Byte(0xF7);
+		Byte(ModRM(3, 3, reg));
+	}
+
+	// sign extends the low 32 bits of reg into all of it
+	void Movsxd(Reg reg)
+	{
+		Rex(true, reg, reg);
+		Byte(0x63);
+		Byte(ModRM(3, reg, reg));
+	}
+
+	void ShiftImm(Shift shift, Reg reg, uint8_t count)
+	{
+		Rex(true, 0, reg);
+		Byte(0xC1);
+		Byte(ModRM(3, shift, reg));
+		Byte(count);
+	}
+
+	// setcc into the low byte of rax, rcx, rdx or rbx, then zero extend it
+	void Set(Condition condition, Reg reg)
+	{
+		Byte(0x0F);
+		Byte(0x90 + condition);
+		Byte(ModRM(3, 0, reg));
+		Byte(0x0F);
+		Byte(0xB6);
+		Byte(ModRM(3, reg, reg));
+	}
+
+	void SetAl(Condition condition)
+	{
+		Set(condition, RAX);
+	}
+
+	void TestAl1()
+	{
+		Byte(0xA8);
+		Byte(0x01);
+	}
+
+	void MovToXmm(uint8_t xmm, Reg src)
+	{
+		Byte(0x66);
+		Rex(true, xmm, src);
+		Byte(0x0F);
+		Byte(0x6E);
+		Byte(ModRM(3, xmm, src));
+	}
+
+	void MovFromXmm(Reg dst, uint8_t xmm)
+	{
+		Byte(0x66);
+		Rex(true, xmm, dst);
+		Byte(0x0F);
+		Byte(0x7E);
+		Byte(ModRM(3, xmm, dst));
+	}
+
+	// prefix is 0xF2 for the sd forms and 0x66 for ucomisd and xorpd
+	void Sse(uint8_t prefix, SseOp op, uint8_t dst, uint8_t src)
+	{
+		Byte(prefix);
+		Rex(false, dst, src);
+		Byte(0x0F);
+		Byte(op);
+		Byte(ModRM(3, dst, src));
+	}
+
+	void Jump(size_t label)
+	{
+		Byte(0xE9);
+		Fixup(label);
+	}
+
+	void JumpIf(Condition condition, size_t label)
+	{
+		Byte(0x0F);
+		Byte(0x80 + condition);
+		Fixup(label);
+	}
+
+	void JumpTo(Reg reg)
+	{
+		if (reg >= R8) { Byte(0x41); }
+		Byte(0xFF);
+		Byte(ModRM(3, 4, reg));
+	}
+
+	void Call(Reg reg)
+	{
+		if (reg >= R8) { Byte(0x41); }
+		Byte(0xFF);
+		Byte(ModRM(3, 2, reg));
+	}
+
+	void Push(Reg reg)
+	{
+		if (reg >= R8) { Byte(0x41); }
+		Byte(0x50 + (reg & 7));
+	}
+
+	void Pop(Reg reg)
+	{
+		if (reg >= R8) { Byte(0x41); }
+		Byte(0x58 + (reg & 7));
+	}
+
+	void Ret()
+	{
+		Byte(0xC3);
+	}
+
+private:
+	std::vector<size_t> labels;
+	std::vector<std::pair<size_t, size_t>> fixups;
+	std::map<size_t, size_t> offsetLabels;
+
+	void Byte(uint8_t byte)
+	{
+		bytes.push_back(byte);
+	}
+
+	void Raw(const void* data, size_t size)
+	{
+		const uint8_t* raw = static_cast<const uint8_t*>(data);
+		bytes.insert(bytes.end(), raw, raw + size);
+	}
+
+	void Rex(bool wide, int reg, int rm)
+	{
+		uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+		if (rex != 0x40) { Byte(rex); }
+	}
+
+	static uint8_t ModRM(int mod, int reg, int rm)
+	{
+		return static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+	}
+
+	void Memory(int reg, Reg base, int32_t disp)
+	{
+		Byte(ModRM(2, reg, base));
+		if ((base & 7) == RSP) { Byte(0x24); }
+		Raw(&disp, sizeof(int32_t));
+	}
+
+	void AluImm(int digit, Reg dst, int32_t imm)
+	{
+		Rex(true, 0, dst);
+		Byte(0x81);
+		Byte(ModRM(3, digit, dst));
+		Raw(&imm, sizeof(int32_t));
+	}
+
+	void Fixup(size_t label)
+	{
+		fixups.emplace_back(bytes.size(), label);
+		Raw("\0\0\0\0", 4);
+	}
+};
+#endif
\ No newline at end of file
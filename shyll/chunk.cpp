@@ -1,12 +1,236 @@
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 
 #include "chunk.h"
 
+const char* OperationName(OpCode op)
+{
+	switch (GenericOperation(op))
+	{
+	case OpCode::Add: return "add";
+	case OpCode::Subtract: return "sub";
+	case OpCode::Multiply: return "mul";
+	case OpCode::Divide: return "div";
+	case OpCode::Exponent: return "exponent";
+	case OpCode::LessThan: return "lt";
+	case OpCode::LessThanEqual: return "lte";
+	case OpCode::GreaterThan: return "gt";
+	case OpCode::GreaterThanEqual: return "gte";
+	case OpCode::Equal: return "eq";
+	case OpCode::NotEqual: return "neq";
+	case OpCode::LogicalAnd: return "and";
+	case OpCode::LogicalOr: return "or";
+	default: return "unknown";
+	}
+}
+
+OpCode GenericOperation(OpCode op)
+{
+	switch (op)
+	{
+	case OpCode::AddLong:
+	case OpCode::AddDouble:
+	case OpCode::AddLongLong:
+	case OpCode::AddDoubleDouble:
+		return OpCode::Add;
+
+	case OpCode::SubtractLong:
+	case OpCode::SubtractDouble:
+	case OpCode::SubtractLongLong:
+	case OpCode::SubtractDoubleDouble:
+		return OpCode::Subtract;
+
+	case OpCode::MultiplyLong:
+	case OpCode::MultiplyDouble:
+	case OpCode::MultiplyLongLong:
+	case OpCode::MultiplyDoubleDouble:
+		return OpCode::Multiply;
+
+	case OpCode::DivideLong:
+	case OpCode::DivideDouble:
+	case OpCode::DivideLongLong:
+	case OpCode::DivideDoubleDouble:
+		return OpCode::Divide;
+
+	case OpCode::LessThanLong:
+	case OpCode::LessThanDouble:
+	case OpCode::LessThanLongLong:
+	case OpCode::LessThanDoubleDouble:
+		return OpCode::LessThan;
+
+	case OpCode::LessThanEqualLong:
+	case OpCode::LessThanEqualDouble:
+	case OpCode::LessThanEqualLongLong:
+	case OpCode::LessThanEqualDoubleDouble:
+		return OpCode::LessThanEqual;
+
+	case OpCode::GreaterThanLong:
+	case OpCode::GreaterThanDouble:
+	case OpCode::GreaterThanLongLong:
+	case OpCode::GreaterThanDoubleDouble:
+		return OpCode::GreaterThan;
+
+	case OpCode::GreaterThanEqualLong:
+	case OpCode::GreaterThanEqualDouble:
+	case OpCode::GreaterThanEqualLongLong:
+	case OpCode::GreaterThanEqualDoubleDouble:
+		return OpCode::GreaterThanEqual;
+
+	case OpCode::EqualLong:
+	case OpCode::EqualDouble:
+	case OpCode::EqualLongLong:
+	case OpCode::EqualDoubleDouble:
+		return OpCode::Equal;
+
+	case OpCode::NotEqualLong:
+	case OpCode::NotEqualDouble:
+	case OpCode::NotEqualLongLong:
+	case OpCode::NotEqualDoubleDouble:
+		return OpCode::NotEqual;
+
+	default:
+		return op;
+	}
+}
+
+Value BinaryOperation(OpCode op, const Value& a, const Value& b)
+{
+	switch (op)
+	{
+	case OpCode::Add: return a + b;
+	case OpCode::Subtract: return a - b;
+	case OpCode::Multiply: return a * b;
+	case OpCode::Divide: return a / b;
+	case OpCode::Exponent: return (a.Get<double>() && b.Get<double>()) ? Value(std::pow(*a.Get<double>(), *b.Get<double>())) : Value();
+	case OpCode::LessThan: return a < b;
+	case OpCode::LessThanEqual: return a <= b;
+	case OpCode::GreaterThan: return a > b;
+	case OpCode::GreaterThanEqual: return a >= b;
+	case OpCode::Equal: return a == b;
+	case OpCode::NotEqual: return a != b;
+	case OpCode::LogicalAnd: return a && b;
+	case OpCode::LogicalOr: return a || b;
+	default: return Value();
+	}
+}
+
+Value UnaryOperation(OpCode op, const Value& val)
+{
+	using namespace std::string_literals;
+
+	switch (op)
+	{
+	case OpCode::AsDouble:
+		if (val.Get<double>()) { return val; }
+		return val.Get<long>() ? Value(static_cast<double>(*val.Get<long>())) : Value();
+
+	case OpCode::AsLong:
+		if (val.Get<long>()) { return val; }
+		return val.Get<double>() ? Value(static_cast<long>(*val.Get<double>())) : Value();
+
+	case OpCode::AsString:
+		return val.Get<std::string>() ? val : val + Value(""s);
+
+	case OpCode::Negate:
+		return (val.Get<long>() || val.Get<double>()) ? -val : Value();
+
+	case OpCode::LogicalNot:
+		return val.Get<bool>() ? !val : Value();
+
+	default:
+		return Value();
+	}
+}
+
+bool StackEffect(OpCode op, int32_t& pops, int32_t& pushes)
+{
+	switch (GenericOperation(op))
+	{
+	case OpCode::None:
+	case OpCode::ShowTraceLog:
+	case OpCode::ClearTraceLog:
+	case OpCode::DelGlobal:
+	case OpCode::CreateGlobal:
+	case OpCode::Jump:
+	case OpCode::GlobalArithConstant:
+	case OpCode::GlobalsArithStore:
+	case OpCode::CompareGlobalsJumpIfFalse:
+	case OpCode::CompareGlobalConstantJumpIfFalse:
+	case OpCode::ForLoop:
+		pops = 0;
+		pushes = 0;
+		return true;
+
+	case OpCode::Constant:
+	case OpCode::ConstantLong:
+	case OpCode::LoadGlobal:
+		pops = 0;
+		pushes = 1;
+		return true;
+
+	case OpCode::AsDouble:
+	case OpCode::AsLong:
+	case OpCode::AsString:
+	case OpCode::Negate:
+	case OpCode::LogicalNot:
+	case OpCode::Trace:
+		pops = 1;
+		pushes = 1;
+		return true;
+
+	case OpCode::Duplicate:
+		pops = 1;
+		pushes = 2;
+		return true;
+
+	case OpCode::Pop:
+	case OpCode::Print:
+	case OpCode::PrintLn:
+	case OpCode::StoreGlobal:
+	case OpCode::JumpIfFalse:
+		pops = 1;
+		pushes = 0;
+		return true;
+
+	case OpCode::Add:
+	case OpCode::Subtract:
+	case OpCode::Multiply:
+	case OpCode::Divide:
+	case OpCode::Exponent:
+	case OpCode::LessThan:
+	case OpCode::LessThanEqual:
+	case OpCode::GreaterThan:
+	case OpCode::GreaterThanEqual:
+	case OpCode::Equal:
+	case OpCode::NotEqual:
+	case OpCode::LogicalAnd:
+	case OpCode::LogicalOr:
+		pops = 2;
+		pushes = 1;
+		return true;
+
+	case OpCode::ForPrep:
+		pops = 2;
+		pushes = 0;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+Chunk::Chunk() : mapped(nullptr), mappedSize(0)
+{
+}
+
 size_t Chunk::Write(uint8_t instruction, int line)
 {
 	instructions.push_back(instruction);
 	WriteLine(line);
+	WriteInlined(instructions.size() - 1, InlinedCall::NONE);
 	return instructions.size() - 1;
 }
 
@@ -14,56 +238,59 @@ size_t Chunk::Write(OpCode instruction, int line)
 {
 	instructions.push_back(static_cast<uint8_t>(instruction));
 	WriteLine(line);
+	WriteInlined(instructions.size() - 1, InlinedCall::NONE);
 	return instructions.size() - 1;
 }
 
 size_t Chunk::WriteLong(uint16_t instruction, int line)
 {
 	instructions.push_back(static_cast<uint8_t>(UINT8_MAX & (instruction >> 8)));
-	instructions.push_back(static_cast<uint8_t>(UINT8_MAX & instruction));
 	WriteLine(line);
+	instructions.push_back(static_cast<uint8_t>(UINT8_MAX & instruction));
 	WriteLine(line);
+	WriteInlined(instructions.size() - 2, InlinedCall::NONE);
 	return instructions.size() - 2;
 }
 
+// the bytes are copied whole and the lines run by run, so this is linear in the size of the code.
+// a one-byte constant operand can only be remapped in place while its constant is one of the first UINT8_MAX + 1 here,
+// so code that has one past that is copied instruction by instruction instead, widening it to a ConstantLong.
+size_t Chunk::Append(const Chunk& from, size_t start, size_t end)
+{
+	return Append(from, start, end, InlinedCall::NONE);
+}
+
+// the calls inlined into from's code become calls made in the body of this one
+size_t Chunk::AppendInlined(const Chunk& from, size_t start, size_t end, int line, const std::string& name)
+{
+	return Append(from, start, end, InternInlined(InlinedCall{ line, InternSymbol(name), InlinedCall::NONE }));
+}
+
 size_t Chunk::AddConstant(const Value& value, int line, OpCode ifShort, OpCode ifLong, bool& success)
 {
 	size_t ret = instructions.size();
-	for (size_t i = 0; i < values.size(); i++)
+	size_t i;
+	if (!FindConstant(value, i))
 	{
-		if ((value == values[i]).Get<bool>() && *(value == values[i]).Get<bool>())
+		if (values.size() > UINT16_MAX)
 		{
-			success = true;
-			if (i > UINT8_MAX)
-			{
-				Write(ifLong, line);
-				WriteLong(i, line);
-			}
-			else
-			{
-				Write(ifShort, line);
-				Write(i, line);
-			}
+			success = false;
 			return ret;
 		}
+		i = values.size();
+		PushConstant(value);
 	}
-	if (values.size() + 1 >= UINT16_MAX)
-	{
-		success = false;
-		return ret;
-	}
-	else if (values.size() + 1 >= UINT8_MAX)
+	success = true;
+	if (i > UINT8_MAX)
 	{
 		Write(ifLong, line);
-		WriteLong(values.size(), line);
+		WriteLong(i, line);
 	}
 	else
 	{
 		Write(ifShort, line);
-		Write(values.size(), line);
+		Write(i, line);
 	}
-	success = true;
-	values.push_back(value);
 	return ret;
 }
 
@@ -73,123 +300,179 @@ size_t Chunk::AddConstant(const Value& value, int line, OpCode ifShort, OpCode i
 	return AddConstant(value, line, ifShort, ifLong, throwaway);
 }
 
-void Chunk::AddMeta(size_t offset, const Value& metadata)
+void Chunk::AddRelocation(size_t offset, Relocation::Type type, uint32_t symbol)
+{
+	Relocation relocation{ offset, type, symbol };
+	if (relocations.empty() || relocations.back().offset < offset)
+	{
+		relocations.push_back(relocation);
+		return;
+	}
+	auto it = relocations.begin() + (FindRelocation(offset) - relocations.cbegin());
+	if (it != relocations.end() && it->offset == offset)
+	{
+		*it = relocation;
+	}
+	else
+	{
+		relocations.insert(it, relocation);
+	}
+}
+
+void Chunk::AddRelocation(size_t offset, Relocation::Type type, const std::string& name)
 {
-	meta[offset] = metadata;
+	AddRelocation(offset, type, InternSymbol(name));
 }
 
-const Value* Chunk::GetMeta(size_t offset) const
+// constants are moved into this chunk's constants straight away, so the operand is valid here from then on
+void Chunk::CopyRelocations(const Chunk& from, size_t start, size_t end, size_t offset)
 {
-	if (meta.find(offset) != meta.end())
+	for (auto it = from.FindRelocation(start); it != from.relocations.end() && it->offset < end; it++)
 	{
-		return &meta.at(offset);
+		size_t at = offset + it->offset - start;
+		if (it->type == Relocation::Type::Constant)
+		{
+			const Value& value = from.ReadConstant(it->symbol);
+			ModifyConstant(at, value);
+			size_t index;
+			FindConstant(value, index);
+			AddRelocation(at, it->type, static_cast<uint32_t>(index));
+		}
+		else
+		{
+			AddRelocation(at, it->type, from.symbols[it->symbol]);
+		}
 	}
-	else
+}
+
+const std::vector<Relocation>& Chunk::Relocations() const
+{
+	return relocations;
+}
+
+const std::string& Chunk::Symbol(uint32_t symbol) const
+{
+	return symbols[symbol];
+}
+
+const std::string* Chunk::SymbolAt(size_t offset) const
+{
+	auto it = FindRelocation(offset);
+	if (it == relocations.end() || it->offset != offset || it->type == Relocation::Type::Constant)
 	{
 		return nullptr;
 	}
+	return &symbols[it->symbol];
+}
+
+// the first relocation at or after offset
+std::vector<Relocation>::const_iterator Chunk::FindRelocation(size_t offset) const
+{
+	return std::lower_bound(relocations.begin(), relocations.end(), offset, [](const Relocation& relocation, size_t at) { return relocation.offset < at; });
 }
 
 void Chunk::Modify(size_t offset, uint8_t nval)
 {
-	instructions[offset] = nval;
+	Bytes()[offset] = nval;
 }
 
 void Chunk::ModifyLong(size_t offset, uint16_t nval)
 {
-	instructions[offset] = static_cast<uint8_t>(UINT8_MAX & (nval >> 8));
-	instructions[offset + 1] = static_cast<uint8_t>(UINT8_MAX & nval);
+	Bytes()[offset] = static_cast<uint8_t>(UINT8_MAX & (nval >> 8));
+	Bytes()[offset + 1] = static_cast<uint8_t>(UINT8_MAX & nval);
 }
 
+// the operand keeps its width, so a one-byte operand has to get one of the first UINT8_MAX + 1 constants
 void Chunk::ModifyConstant(size_t offset, const Value& value)
 {
-	for (size_t i = 0; i < values.size(); i++)
+	size_t index = Intern(value);
+	if (ShortConstant(offset))
 	{
-		if ((value == values[i]).Get<bool>() && *(value == values[i]).Get<bool>())
-		{
-			if (i > UINT8_MAX)
-			{
-				ModifyLong(offset, i);
-			}
-			else
-			{
-				Modify(offset, i);
-			}
-			return;
-		}
-	}
-	if (values.size() + 1 >= UINT8_MAX)
-	{
-		ModifyLong(offset, values.size());
+		Modify(offset, static_cast<uint8_t>(index));
 	}
 	else
 	{
-		Modify(offset, values.size());
+		ModifyLong(offset, static_cast<uint16_t>(index));
 	}
-	values.push_back(value);
 }
 
 uint8_t Chunk::Read(size_t offset) const
 {
-	return instructions[offset];
+	return Code()[offset];
 }
 
 uint16_t Chunk::ReadLong(size_t offset) const
 {
-	return static_cast<uint16_t>(((instructions[offset] << 8) & 0xFF00) + (instructions[offset + 1] & 0x00FF));
+	return static_cast<uint16_t>(((Code()[offset] << 8) & 0xFF00) + (Code()[offset + 1] & 0x00FF));
 }
 
-Value Chunk::ReadConstant(uint16_t index) const
+const Value& Chunk::ReadConstant(uint16_t index) const
 {
 	return values[index];
 }
 
 int Chunk::ReadLine(size_t offset) const
 {
-	size_t curlen = 0;
-	size_t total = 0;
-	for (size_t i = 0; i < lines.size(); i++)
+	if (offset >= Size()) { return -1; }
+	// the last run that starts at or before offset
+	auto run = std::upper_bound(lines.begin(), lines.end(), offset, [](size_t offset, const LineInfo& info) { return offset < info.start; });
+	return std::prev(run)->line;
+}
+
+std::vector<InlinedCall> Chunk::ReadInlined(size_t offset) const
+{
+	std::vector<InlinedCall> calls;
+	auto run = std::upper_bound(inlinedRuns.begin(), inlinedRuns.end(), offset, [](size_t offset, const InlinedRun& info) { return offset < info.start; });
+	if (offset >= Size() || run == inlinedRuns.begin()) { return calls; }
+
+	for (uint32_t call = std::prev(run)->call; call != InlinedCall::NONE; call = inlinedCalls[call].caller)
 	{
-		while (curlen < lines[i].len)
-		{
-			if (total == offset) { return lines[i].line; }
-			total++;
-			curlen++;
-		}
-		curlen = 0;
+		calls.push_back(inlinedCalls[call]);
 	}
-	return -1;
+	std::reverse(calls.begin(), calls.end());
+	return calls;
+}
+
+const uint8_t* Chunk::Code() const
+{
+	return mapped ? mapped : instructions.data();
 }
 
 void Chunk::Disassemble(const std::string& name) const
 {
 	std::cerr << "== " << name << " ==\n";
 
-	size_t oldOffset = 0;
-	size_t newOffset = 0;
-	size_t dif = 0;
-	for (size_t offset = 0; offset < instructions.size();)
+	// the line runs are walked alongside the instructions instead of being searched for each one
+	size_t run = 0;
+	int previous = -1;
+	for (size_t offset = 0; offset < Size();)
 	{
-		dif = newOffset - oldOffset;
-		oldOffset = offset;
-		offset = DisassembleInstruction(offset, dif);
-		newOffset = offset;
+		while (run + 1 < lines.size() && lines[run + 1].start <= offset) { run++; }
+		int line = lines[run].line;
+		offset = PrintInstruction(offset, line, offset > 0 && line == previous);
+		previous = line;
 	}
 }
 
 size_t Chunk::DisassembleInstruction(size_t offset, size_t dif) const
+{
+	int line = ReadLine(offset);
+	return PrintInstruction(offset, line, dif > 0 && offset > 0 && ReadLine(offset - dif) == line);
+}
+
+size_t Chunk::PrintInstruction(size_t offset, int line, bool sameLine) const
 {
 	std::cerr << std::setfill('0') << std::setw(4) << std::right << offset << ' ';
-	if (dif > 0 && offset > 0 && ReadLine(offset - dif) == ReadLine(offset))
+	if (sameLine)
 	{
 		std::cerr << ("   | ");
 	}
 	else
 	{
-		std::cerr << std::setfill(' ') << std::setw(4) << std::right << ReadLine(offset) << ' ';
+		std::cerr << std::setfill(' ') << std::setw(4) << std::right << line << ' ';
 	}
 
-	uint8_t instruction = instructions[offset];
+	uint8_t instruction = Read(offset);
 	switch (static_cast<OpCode>(instruction))
 	{
 	case OpCode::Return:
@@ -213,29 +496,17 @@ size_t Chunk::DisassembleInstruction(size_t offset, size_t dif) const
 	case OpCode::ConstantLong:
 		return ConstantInstructionLong("OP_CONSTANT_LONG", offset);
 
-	case OpCode::Store:
-		return ConstantInstruction("OP_STORE", offset);
-
-	case OpCode::StoreLong:
-		return ConstantInstructionLong("OP_STORE_LONG", offset);
-
-	case OpCode::Load:
-		return ConstantInstruction("OP_LOAD", offset);
-
-	case OpCode::LoadLong:
-		return ConstantInstructionLong("OP_LOAD_LONG", offset);
+	case OpCode::StoreGlobal:
+		return GlobalInstruction("OP_STORE_GLOBAL", offset);
 
-	case OpCode::Del:
-		return ConstantInstruction("OP_DEL", offset);
+	case OpCode::LoadGlobal:
+		return GlobalInstruction("OP_LOAD_GLOBAL", offset);
 
-	case OpCode::DelLong:
-		return ConstantInstructionLong("OP_DEL_LONG", offset);
+	case OpCode::DelGlobal:
+		return GlobalInstruction("OP_DEL_GLOBAL", offset);
 
-	case OpCode::Create:
-		return ConstantInstruction("OP_CREATE", offset);
-
-	case OpCode::CreateLong:
-		return ConstantInstructionLong("OP_CREATE_LONG", offset);
+	case OpCode::CreateGlobal:
+		return GlobalInstruction("OP_CREATE_GLOBAL", offset);
 
 	case OpCode::Add:
 		return SimpleInstruction("OP_ADD", offset);
@@ -273,6 +544,126 @@ size_t Chunk::DisassembleInstruction(size_t offset, size_t dif) const
 	case OpCode::NotEqual:
 		return SimpleInstruction("OP_NOT_EQUAL", offset);
 
+	case OpCode::AddLong:
+		return SimpleInstruction("OP_ADD_LONG", offset);
+
+	case OpCode::AddDouble:
+		return SimpleInstruction("OP_ADD_DOUBLE", offset);
+
+	case OpCode::SubtractLong:
+		return SimpleInstruction("OP_SUBTRACT_LONG", offset);
+
+	case OpCode::SubtractDouble:
+		return SimpleInstruction("OP_SUBTRACT_DOUBLE", offset);
+
+	case OpCode::MultiplyLong:
+		return SimpleInstruction("OP_MULTIPLY_LONG", offset);
+
+	case OpCode::MultiplyDouble:
+		return SimpleInstruction("OP_MULTIPLY_DOUBLE", offset);
+
+	case OpCode::DivideLong:
+		return SimpleInstruction("OP_DIVIDE_LONG", offset);
+
+	case OpCode::DivideDouble:
+		return SimpleInstruction("OP_DIVIDE_DOUBLE", offset);
+
+	case OpCode::LessThanLong:
+		return SimpleInstruction("OP_LESS_LONG", offset);
+
+	case OpCode::LessThanDouble:
+		return SimpleInstruction("OP_LESS_DOUBLE", offset);
+
+	case OpCode::LessThanEqualLong:
+		return SimpleInstruction("OP_LESS_EQUAL_LONG", offset);
+
+	case OpCode::LessThanEqualDouble:
+		return SimpleInstruction("OP_LESS_EQUAL_DOUBLE", offset);
+
+	case OpCode::GreaterThanLong:
+		return SimpleInstruction("OP_GREATER_LONG", offset);
+
+	case OpCode::GreaterThanDouble:
+		return SimpleInstruction("OP_GREATER_DOUBLE", offset);
+
+	case OpCode::GreaterThanEqualLong:
+		return SimpleInstruction("OP_GREATER_EQUAL_LONG", offset);
+
+	case OpCode::GreaterThanEqualDouble:
+		return SimpleInstruction("OP_GREATER_EQUAL_DOUBLE", offset);
+
+	case OpCode::EqualLong:
+		return SimpleInstruction("OP_EQUAL_LONG", offset);
+
+	case OpCode::EqualDouble:
+		return SimpleInstruction("OP_EQUAL_DOUBLE", offset);
+
+	case OpCode::NotEqualLong:
+		return SimpleInstruction("OP_NOT_EQUAL_LONG", offset);
+
+	case OpCode::NotEqualDouble:
+		return SimpleInstruction("OP_NOT_EQUAL_DOUBLE", offset);
+
+	case OpCode::AddLongLong:
+		return SimpleInstruction("OP_ADD_LONG_LONG", offset);
+
+	case OpCode::AddDoubleDouble:
+		return SimpleInstruction("OP_ADD_DOUBLE_DOUBLE", offset);
+
+	case OpCode::SubtractLongLong:
+		return SimpleInstruction("OP_SUBTRACT_LONG_LONG", offset);
+
+	case OpCode::SubtractDoubleDouble:
+		return SimpleInstruction("OP_SUBTRACT_DOUBLE_DOUBLE", offset);
+
+	case OpCode::MultiplyLongLong:
+		return SimpleInstruction("OP_MULTIPLY_LONG_LONG", offset);
+
+	case OpCode::MultiplyDoubleDouble:
+		return SimpleInstruction("OP_MULTIPLY_DOUBLE_DOUBLE", offset);
+
+	case OpCode::DivideLongLong:
+		return SimpleInstruction("OP_DIVIDE_LONG_LONG", offset);
+
+	case OpCode::DivideDoubleDouble:
+		return SimpleInstruction("OP_DIVIDE_DOUBLE_DOUBLE", offset);
+
+	case OpCode::LessThanLongLong:
+		return SimpleInstruction("OP_LESS_LONG_LONG", offset);
+
+	case OpCode::LessThanDoubleDouble:
+		return SimpleInstruction("OP_LESS_DOUBLE_DOUBLE", offset);
+
+	case OpCode::LessThanEqualLongLong:
+		return SimpleInstruction("OP_LESS_EQUAL_LONG_LONG", offset);
+
+	case OpCode::LessThanEqualDoubleDouble:
+		return SimpleInstruction("OP_LESS_EQUAL_DOUBLE_DOUBLE", offset);
+
+	case OpCode::GreaterThanLongLong:
+		return SimpleInstruction("OP_GREATER_LONG_LONG", offset);
+
+	case OpCode::GreaterThanDoubleDouble:
+		return SimpleInstruction("OP_GREATER_DOUBLE_DOUBLE", offset);
+
+	case OpCode::GreaterThanEqualLongLong:
+		return SimpleInstruction("OP_GREATER_EQUAL_LONG_LONG", offset);
+
+	case OpCode::GreaterThanEqualDoubleDouble:
+		return SimpleInstruction("OP_GREATER_EQUAL_DOUBLE_DOUBLE", offset);
+
+	case OpCode::EqualLongLong:
+		return SimpleInstruction("OP_EQUAL_LONG_LONG", offset);
+
+	case OpCode::EqualDoubleDouble:
+		return SimpleInstruction("OP_EQUAL_DOUBLE_DOUBLE", offset);
+
+	case OpCode::NotEqualLongLong:
+		return SimpleInstruction("OP_NOT_EQUAL_LONG_LONG", offset);
+
+	case OpCode::NotEqualDoubleDouble:
+		return SimpleInstruction("OP_NOT_EQUAL_DOUBLE_DOUBLE", offset);
+
 	case OpCode::LogicalAnd:
 		return SimpleInstruction("OP_LOGICAL_AND", offset);
 
@@ -315,221 +706,273 @@ size_t Chunk::DisassembleInstruction(size_t offset, size_t dif) const
 	case OpCode::PushJumpAddress:
 		return SimpleInstruction("OP_PUSH_JUMP_ADDRESS", offset);
 
-#pragma region RAYLIB OPCODES
-#pragma region CORE MODULE
-	case OpCode::InitWindow:
-		return SimpleInstruction("OP_INIT_WINDOW", offset);
-
-	case OpCode::WindowShouldClose:
-		return SimpleInstruction("OP_WINDOW_SHOULD_CLOSE", offset);
-
-	case OpCode::CloseWindow:
-		return SimpleInstruction("OP_CLOSE_WINDOW", offset);
-
-	case OpCode::ShowCursor:
-		return SimpleInstruction("OP_SHOW_CURSOR", offset);
-
-	case OpCode::HideCursor:
-		return SimpleInstruction("OP_HIDE_CURSOR", offset);
-
-	case OpCode::ClearBackground:
-		return SimpleInstruction("OP_CLEAR_BACKGROUND", offset);
-
-	case OpCode::BeginDrawing:
-		return SimpleInstruction("OP_BEGIN_DRAWING", offset);
-
-	case OpCode::EndDrawing:
-		return SimpleInstruction("OP_END_DRAWING", offset);
-
-	case OpCode::SetTargetFPS:
-		return SimpleInstruction("OP_SET_TARGET_FPS", offset);
-
-	case OpCode::GetTime:
-		return SimpleInstruction("OP_GET_TIME", offset);
-
-	case OpCode::GetRandomValue:
-		return SimpleInstruction("OP_GET_RANDOM_VALUE", offset);
-
-	case OpCode::LoadStorageValue:
-		return SimpleInstruction("OP_LOAD_STORAGE_VALUE", offset);
-
-	case OpCode::SaveStorageValue:
-		return SimpleInstruction("OP_SAVE_STORAGE_VALUE", offset);
-
-	case OpCode::IsKeyPressed:
-		return SimpleInstruction("OP_IS_KEY_PRESSED", offset);
-
-	case OpCode::IsKeyDown:
-		return SimpleInstruction("OP_IS_KEY_DOWN", offset);
-
-	case OpCode::IsKeyReleased:
-		return SimpleInstruction("OP_IS_KEY_RELEASED", offset);
-
-	case OpCode::IsKeyUp:
-		return SimpleInstruction("OP_IS_KEY_UP", offset);
-
-	case OpCode::GetKeyPressed:
-		return SimpleInstruction("OP_GET_KEY_PRESSED", offset);
-
-	case OpCode::SetExitKey:
-		return SimpleInstruction("OP_SET_EXIT_KEY", offset);
-
-	case OpCode::IsMouseButtonPressed:
-		return SimpleInstruction("OP_IS_MOUSE_BUTTON_PRESSED", offset);
+	case OpCode::ForPrep:
+		return LoopInstruction("OP_FOR_PREP", offset);
 
-	case OpCode::IsMouseButtonDown:
-		return SimpleInstruction("OP_IS_MOUSE_BUTTON_DOWN", offset);
+	case OpCode::ForLoop:
+		return LoopInstruction("OP_FOR_LOOP", offset);
 
-	case OpCode::IsMouseButtonReleased:
-		return SimpleInstruction("OP_IS_MOUSE_BUTTON_RELEASED", offset);
+	case OpCode::CallNative:
+		return NativeInstruction("OP_CALL_NATIVE", offset);
 
-	case OpCode::IsMouseButtonUp:
-		return SimpleInstruction("OP_IS_MOUSE_BUTTON_UP", offset);
+#pragma region SUPERINSTRUCTIONS
+	case OpCode::GlobalArithConstant:
+		return SuperInstruction("OP_GLOBAL_ARITH_CONSTANT", offset);
 
-	case OpCode::GetMouseX:
-		return SimpleInstruction("OP_GET_MOUSE_X", offset);
+	case OpCode::GlobalsArithStore:
+		return SuperInstruction("OP_GLOBALS_ARITH_STORE", offset);
 
-	case OpCode::GetMouseY:
-		return SimpleInstruction("OP_GET_MOUSE_Y", offset);
+	case OpCode::CompareGlobalsJumpIfFalse:
+		return SuperInstruction("OP_COMPARE_GLOBALS_JUMP_IF_FALSE", offset);
 
-	case OpCode::GetMousePosition:
-		return SimpleInstruction("OP_GET_MOUSE_POSITION", offset);
-
-	case OpCode::SetMousePosition:
-		return SimpleInstruction("OP_SET_MOUSE_POSITION", offset);
-
-	case OpCode::SetMouseOffset:
-		return SimpleInstruction("OP_SET_MOUSE_OFFSET", offset);
-
-	case OpCode::SetMouseScale:
-		return SimpleInstruction("OP_SET_MOUSE_SCALE", offset);
-
-	case OpCode::GetMouseWheelMove:
-		return SimpleInstruction("OP_GET_MOUSE_WHEEL_MOVE", offset);
+	case OpCode::CompareGlobalConstantJumpIfFalse:
+		return SuperInstruction("OP_COMPARE_GLOBAL_CONSTANT_JUMP_IF_FALSE", offset);
 #pragma endregion
 
-#pragma region SHAPES MODULE
-	case OpCode::DrawPixel:
-		return SimpleInstruction("OP_DRAW_PIXEL", offset);
-
-	case OpCode::DrawLine:
-		return SimpleInstruction("OP_DRAW_LINE", offset);
-
-	case OpCode::DrawLineStrip:
-		return SimpleInstruction("OP_DRAW_LINE_STRIP", offset);
-
-	case OpCode::DrawCircle:
-		return SimpleInstruction("OP_DRAW_CIRCLE", offset);
-
-	case OpCode::DrawCircleSector:
-		return SimpleInstruction("OP_DRAW_CIRCLE_SECTOR", offset);
+	default:
+		std::cerr << "Unknown opcode " << instruction << '\n';
+		return offset + 1;
+	}
+}
 
-	case OpCode::DrawCircleSectorLines:
-		return SimpleInstruction("OP_DRAW_CIRCLE_SECTOR_LINES", offset);
+size_t Chunk::InstructionSize(size_t offset) const
+{
+	switch (static_cast<OpCode>(Read(offset)))
+	{
+	case OpCode::Constant:
+		return 2;
 
-	case OpCode::DrawCircleGradient:
-		return SimpleInstruction("OP_DRAW_CIRCLE_GRADIENT", offset);
+	case OpCode::ConstantLong:
+	case OpCode::StoreGlobal:
+	case OpCode::LoadGlobal:
+	case OpCode::DelGlobal:
+	case OpCode::CreateGlobal:
+	case OpCode::Jump:
+	case OpCode::JumpIfFalse:
+		return 3;
 
-	case OpCode::DrawCircleLines:
-		return SimpleInstruction("OP_DRAW_CIRCLE_LINES", offset);
+	case OpCode::CallNative:
+		return 5;
 
-	case OpCode::DrawEllipse:
-		return SimpleInstruction("OP_DRAW_ELLIPSE", offset);
+	case OpCode::ForPrep:
+	case OpCode::ForLoop:
+		return 7;
 
-	case OpCode::DrawEllipseLines:
-		return SimpleInstruction("OP_DRAW_ELLIPSE_LINES", offset);
+	case OpCode::GlobalArithConstant:
+	case OpCode::GlobalsArithStore:
+	case OpCode::CompareGlobalsJumpIfFalse:
+	case OpCode::CompareGlobalConstantJumpIfFalse:
+		return Read(offset + 1);
 
-	case OpCode::DrawRing:
-		return SimpleInstruction("OP_DRAW_RING", offset);
+	default:
+		return 1;
+	}
+}
 
-	case OpCode::DrawRectangle:
-		return SimpleInstruction("OP_DRAW_RECTANGLE", offset);
+size_t Chunk::JumpOperand(size_t offset) const
+{
+	switch (static_cast<OpCode>(Read(offset)))
+	{
+	case OpCode::Jump:
+	case OpCode::JumpIfFalse:
+		return offset + 1;
 
-	case OpCode::DrawRectangleGradient:
-		return SimpleInstruction("OP_DRAW_RECTANGLE_GRADIENT", offset);
+	case OpCode::ForPrep:
+	case OpCode::ForLoop:
+		return offset + 5;
 
-	case OpCode::DrawRectangleLines:
-		return SimpleInstruction("OP_DRAW_RECTANGLE_LINES", offset);
+	case OpCode::CompareGlobalsJumpIfFalse:
+	case OpCode::CompareGlobalConstantJumpIfFalse:
+		return offset + 7;
 
-	case OpCode::DrawRectangleRounded:
-		return SimpleInstruction("OP_DRAW_RECTANGLE_ROUNDED", offset);
+	default:
+		return 0;
+	}
+}
 
-	case OpCode::DrawRectangleRoundedLines:
-		return SimpleInstruction("OP_DRAW_RECTANGLE_ROUNDED_LINES", offset);
+size_t Chunk::Size() const
+{
+	return mapped ? mappedSize : instructions.size();
+}
 
-	case OpCode::DrawTriangle:
-		return SimpleInstruction("OP_DRAW_TRIANGLE", offset);
+uint8_t* Chunk::Bytes()
+{
+	return mapped ? mapped : instructions.data();
+}
 
-	case OpCode::DrawTriangleLines:
-		return SimpleInstruction("OP_DRAW_TRIANGLE_LINES", offset);
+bool Chunk::FindConstant(const Value& value, size_t& index) const
+{
+	auto found = constants.find(value);
+	if (found == constants.end()) { return false; }
+	index = found->second;
+	return true;
+}
 
-	case OpCode::DrawTriangleFan:
-		return SimpleInstruction("OP_DRAW_TRIANGLE_FAN", offset);
+void Chunk::PushConstant(const Value& value)
+{
+	constants.emplace(value, static_cast<uint16_t>(values.size()));
+	values.push_back(value);
+}
 
-	case OpCode::DrawTriangleStrip:
-		return SimpleInstruction("OP_DRAW_TRIANGLE_STRIP", offset);
+size_t Chunk::Intern(const Value& value)
+{
+	size_t index;
+	if (FindConstant(value, index)) { return index; }
+	PushConstant(value);
+	return values.size() - 1;
+}
 
-	case OpCode::DrawPolygon:
-		return SimpleInstruction("OP_DRAW_REGULAR_POLYGON", offset);
+bool Chunk::ShortConstant(size_t offset) const
+{
+	return offset > 0 && static_cast<OpCode>(Read(offset - 1)) == OpCode::Constant;
+}
 
-	case OpCode::DrawPolygonLines:
-		return SimpleInstruction("OP_DRAW_REGULAR_POLYGON_LINES", offset);
+// moves the constants of from's code between start and end into this chunk, and tells whether any of them is too
+// far into it for the one-byte operand that refers to it
+bool Chunk::Widens(const Chunk& from, size_t start, size_t end)
+{
+	bool widens = false;
+	for (auto it = from.FindRelocation(start); it != from.relocations.end() && it->offset < end; it++)
+	{
+		if (it->type != Relocation::Type::Constant) { continue; }
+		widens |= Intern(from.ReadConstant(it->symbol)) > UINT8_MAX && from.ShortConstant(it->offset);
+	}
+	return widens;
+}
 
-	case OpCode::CheckCollisionRectangle:
-		return SimpleInstruction("OP_CHECK_COLLISION_RECTANGLE", offset);
+size_t Chunk::Append(const Chunk& from, size_t start, size_t end, uint32_t caller)
+{
+	size_t offset = instructions.size();
+	if (start >= end) { return offset; }
 
-	case OpCode::CheckCollisionCircle:
-		return SimpleInstruction("OP_CHECK_COLLISION_CIRCLE", offset);
+	if (Widens(from, start, end))
+	{
+		AppendWidened(from, start, end, caller);
+	}
+	else
+	{
+		AppendCode(from, start, end, caller);
+	}
+	return offset;
+}
 
-	case OpCode::CheckCollisionCircleRectangle:
-		return SimpleInstruction("OP_CHECK_COLLISION_CIRCLE_RECTANGLE", offset);
+void Chunk::AppendCode(const Chunk& from, size_t start, size_t end, uint32_t caller)
+{
+	size_t offset = instructions.size();
+	instructions.insert(instructions.end(), from.Code() + start, from.Code() + end);
+	auto run = std::prev(std::upper_bound(from.lines.begin(), from.lines.end(), start, [](size_t at, const LineInfo& info) { return at < info.start; }));
+	WriteLine(offset, run->line);
+	for (run++; run != from.lines.end() && run->start < end; run++)
+	{
+		WriteLine(offset + run->start - start, run->line);
+	}
+	CopyRelocations(from, start, end, offset);
+	CopyInlined(from, start, end, offset, caller);
+}
 
-	case OpCode::GetCollisionRectangle:
-		return SimpleInstruction("OP_GET_COLLISION_RECTANGLE", offset);
+// copies the inlined calls of from's code between start and end, which has been written to this chunk at offset.
+// code that is in no call in from is in caller here.
+void Chunk::CopyInlined(const Chunk& from, size_t start, size_t end, size_t offset, uint32_t caller)
+{
+	// the first run that starts after start
+	auto run = std::upper_bound(from.inlinedRuns.begin(), from.inlinedRuns.end(), start, [](size_t at, const InlinedRun& info) { return at < info.start; });
+	WriteInlined(offset, run == from.inlinedRuns.begin() ? caller : CopyInlinedCall(from, std::prev(run)->call, caller));
+	for (; run != from.inlinedRuns.end() && run->start < end; run++)
+	{
+		WriteInlined(offset + run->start - start, CopyInlinedCall(from, run->call, caller));
+	}
+}
 
-	case OpCode::CheckCollisionPointRectangle:
-		return SimpleInstruction("OP_CHECK_COLLISION_POINT_RECTANGLE", offset);
+uint32_t Chunk::CopyInlinedCall(const Chunk& from, uint32_t call, uint32_t caller)
+{
+	if (call == InlinedCall::NONE) { return caller; }
+	const InlinedCall& copied = from.inlinedCalls[call];
+	return InternInlined(InlinedCall{ copied.line, InternSymbol(from.symbols[copied.symbol]), CopyInlinedCall(from, copied.caller, caller) });
+}
 
-	case OpCode::CheckCollisionPointCircle:
-		return SimpleInstruction("OP_CHECK_COLLISION_POINT_CIRCLE", offset);
+// widening moves the code after it, so the jumps inside the copied code are measured again afterwards.
+// calls are left alone, the linker fills them in by name.
+void Chunk::AppendWidened(const Chunk& from, size_t start, size_t end, uint32_t caller)
+{
+	// where each instruction of from ended up here
+	std::vector<size_t> moved(end - start + 1, 0);
+	// jumps copied from from, as (offset in from, offset here)
+	std::vector<std::pair<size_t, size_t>> jumps;
 
-	case OpCode::CheckCollisionPointTriangle:
-		return SimpleInstruction("OP_CHECK_COLLISION_POINT_Triangle", offset);
-#pragma endregion
+	for (size_t at = start; at < end;)
+	{
+		size_t next = at + from.InstructionSize(at);
+		moved[at - start] = instructions.size();
 
-#pragma region TEXT MODULE
-	case OpCode::DrawFPS:
-		return SimpleInstruction("OP_DRAW_FPS", offset);
+		size_t index;
+		if (static_cast<OpCode>(from.Read(at)) == OpCode::Constant && FindConstant(from.ReadConstant(from.Read(at + 1)), index) && index > UINT8_MAX)
+		{
+			int line = from.ReadLine(at);
+			Write(OpCode::ConstantLong, line);
+			AddRelocation(WriteLong(static_cast<uint16_t>(index), line), Relocation::Type::Constant, static_cast<uint32_t>(index));
+		}
+		else
+		{
+			size_t operand = from.JumpOperand(at);
+			if (operand && !from.SymbolAt(operand)) { jumps.emplace_back(at, instructions.size()); }
+			AppendCode(from, at, next, caller);
+		}
+		at = next;
+	}
+	moved[end - start] = instructions.size();
 
-	case OpCode::DrawText:
-		return SimpleInstruction("OP_DRAW_TEXT", offset);
+	for (const std::pair<size_t, size_t>& jump : jumps)
+	{
+		size_t target = jump.first + from.InstructionSize(jump.first) + static_cast<int16_t>(from.ReadLong(from.JumpOperand(jump.first)));
+		if (target < start || target > end) { continue; }
+		ModifyLong(JumpOperand(jump.second), static_cast<uint16_t>(moved[target - start] - (jump.second + InstructionSize(jump.second))));
+	}
+}
 
-	case OpCode::MeasureText:
-		return SimpleInstruction("OP_MEASURE_TEXT", offset);
-#pragma endregion
-#pragma endregion
+void Chunk::WriteLine(int line)
+{
+	WriteLine(instructions.size() - 1, line);
+}
 
-	default:
-		std::cerr << "Unknown opcode " << instruction << '\n';
-		return offset + 1;
+// starts a new run at offset if the line changes there
+void Chunk::WriteLine(size_t offset, int line)
+{
+	if (lines.empty() || line != lines.back().line)
+	{
+		lines.push_back(LineInfo{ offset, line });
 	}
 }
 
-size_t Chunk::Size() const
+// starts a new run at offset if the inlined call changes there
+void Chunk::WriteInlined(size_t offset, uint32_t call)
 {
-	return instructions.size();
+	if (inlinedRuns.empty() ? call != InlinedCall::NONE : call != inlinedRuns.back().call)
+	{
+		inlinedRuns.push_back(InlinedRun{ offset, call });
+	}
 }
 
-void Chunk::WriteLine(int line)
+uint32_t Chunk::InternSymbol(const std::string& name)
 {
-	if (lines.size() > 0 && line == lines.back().line)
+	auto it = symbolIndices.find(name);
+	if (it == symbolIndices.end())
 	{
-		lines.back().len++;
+		it = symbolIndices.emplace(name, static_cast<uint32_t>(symbols.size())).first;
+		symbols.push_back(name);
 	}
-	else
+	return it->second;
+}
+
+uint32_t Chunk::InternInlined(const InlinedCall& call)
+{
+	auto key = std::make_tuple(call.line, call.symbol, call.caller);
+	auto it = inlinedIndices.find(key);
+	if (it == inlinedIndices.end())
 	{
-		lines.push_back(LineInfo{ 1, line });
+		it = inlinedIndices.emplace(key, static_cast<uint32_t>(inlinedCalls.size())).first;
+		inlinedCalls.push_back(call);
 	}
+	return it->second;
 }
 
 size_t Chunk::SimpleInstruction(const std::string& name, size_t offset) const
@@ -540,7 +983,7 @@ size_t Chunk::SimpleInstruction(const std::string& name, size_t offset) const
 
 size_t Chunk::ConstantInstruction(const std::string& name, size_t offset) const
 {
-	uint8_t constant = instructions[offset + 1];
+	uint8_t constant = Read(offset + 1);
 	std::cerr << std::setfill(' ') << std::left << std::setw(16) << name << std::right << std::setw(6) << static_cast<uint16_t>(constant) << " '" << values[constant] << "'\n";
 	return offset + 2;
 }
@@ -552,14 +995,75 @@ size_t Chunk::ConstantInstructionLong(const std::string& name, size_t offset) co
 	return offset + 3;
 }
 
+size_t Chunk::GlobalInstruction(const std::string& name, size_t offset) const
+{
+	uint16_t slot = ReadLong(offset + 1);
+	std::cerr << std::setfill(' ') << std::left << std::setw(16) << name << std::right << std::setw(6) << slot;
+	if (SymbolAt(offset + 1))
+	{
+		std::cerr << " '" << *SymbolAt(offset + 1) << '\'';
+	}
+	std::cerr << '\n';
+	return offset + 3;
+}
+
 size_t Chunk::JumpInstruction(const std::string& name, size_t offset) const
 {
 	uint16_t ip = offset + 3 + static_cast<int16_t>(ReadLong(offset + 1));
 	std::cerr << std::setfill(' ') << std::left << std::setw(16) << name << "  " << std::right << std::setfill('0') << std::setw(4) << ip;
-	if (GetMeta(offset + 1) && GetMeta(offset + 1)->Get<std::string>())
+	if (SymbolAt(offset + 1))
 	{
-		std::cerr << std::setfill(' ') << "    @" << *GetMeta(offset + 1)->Get<std::string>();
+		std::cerr << std::setfill(' ') << "    @" << *SymbolAt(offset + 1);
 	}
 	std::cerr << '\n';
 	return offset + 3;
+}
+
+size_t Chunk::LoopInstruction(const std::string& name, size_t offset) const
+{
+	uint16_t ip = offset + 7 + static_cast<int16_t>(ReadLong(offset + 5));
+	std::cerr << std::setfill(' ') << std::left << std::setw(16) << name << "  slots " << ReadLong(offset + 1) << ", " << ReadLong(offset + 3);
+	if (SymbolAt(offset + 1))
+	{
+		std::cerr << " '" << *SymbolAt(offset + 1) << '\'';
+	}
+	std::cerr << " -> " << std::right << std::setfill('0') << std::setw(4) << ip << '\n';
+	return offset + 7;
+}
+
+size_t Chunk::NativeInstruction(const std::string& name, size_t offset) const
+{
+	std::cerr << std::setfill(' ') << std::left << std::setw(16) << name << std::right << std::setw(6) << ReadLong(offset + 1);
+	std::cerr << " takes " << static_cast<int>(Read(offset + 3)) << ", gives " << static_cast<int>(Read(offset + 4)) << '\n';
+	return offset + 5;
+}
+
+size_t Chunk::SuperInstruction(const std::string& name, size_t offset) const
+{
+	std::cerr << std::setfill(' ') << std::left << std::setw(16) << name;
+	switch (static_cast<OpCode>(Read(offset)))
+	{
+	case OpCode::GlobalArithConstant:
+		std::cerr << "  " << OperationName(static_cast<OpCode>(Read(offset + 2))) << " slot " << ReadLong(offset + 3) << " '" << values[ReadLong(offset + 5)] << '\'';
+		break;
+
+	case OpCode::GlobalsArithStore:
+		std::cerr << "  " << OperationName(static_cast<OpCode>(Read(offset + 2))) << " slots " << ReadLong(offset + 3) << ", " << ReadLong(offset + 5) << " -> " << ReadLong(offset + 7);
+		break;
+
+	case OpCode::CompareGlobalsJumpIfFalse:
+		std::cerr << "  " << OperationName(static_cast<OpCode>(Read(offset + 2))) << " slots " << ReadLong(offset + 3) << ", " << ReadLong(offset + 5)
+			<< " else " << std::right << std::setfill('0') << std::setw(4) << offset + Read(offset + 1) + static_cast<int16_t>(ReadLong(offset + 7));
+		break;
+
+	case OpCode::CompareGlobalConstantJumpIfFalse:
+		std::cerr << "  " << OperationName(static_cast<OpCode>(Read(offset + 2))) << " slot " << ReadLong(offset + 3) << " '" << values[ReadLong(offset + 5)] << '\''
+			<< " else " << std::right << std::setfill('0') << std::setw(4) << offset + Read(offset + 1) + static_cast<int16_t>(ReadLong(offset + 7));
+		break;
+
+	default:
+		break;
+	}
+	std::cerr << '\n';
+	return offset + Read(offset + 1);
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include <map>
 #include <string>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include "value.h"
@@ -36,103 +38,147 @@ enum class OpCode : uint8_t
 	Trace,
 	ShowTraceLog,
 	ClearTraceLog,
-	Store,
-	StoreLong,
-	Load,
-	LoadLong,
-	Del,
-	DelLong,
-	Create,
-	CreateLong,
+	StoreGlobal,
+	LoadGlobal,
+	DelGlobal,
+	CreateGlobal,
 	Jump,
 	JumpIfFalse,
 	JumpToCallStackAddress,
 	PushJumpAddress,
 	Return,
-#pragma region RAYLIB OPCODES
-#pragma region CORE MODULE
-	InitWindow,
-	WindowShouldClose,
-	CloseWindow,
-	ShowCursor,
-	HideCursor,
-	ClearBackground,
-	BeginDrawing,
-	EndDrawing,
-	SetTargetFPS,
-	GetTime,
-	GetRandomValue, // TODO: Implement
-	LoadStorageValue, // TODO: Implement
-	SaveStorageValue,
-	IsKeyPressed,
-	IsKeyDown,
-	IsKeyReleased,
-	IsKeyUp,
-	GetKeyPressed,
-	SetExitKey,
-	IsMouseButtonPressed,
-	IsMouseButtonDown,
-	IsMouseButtonReleased,
-	IsMouseButtonUp,
-	GetMouseX,
-	GetMouseY,
-	GetMousePosition,
-	SetMousePosition,
-	SetMouseOffset,
-	SetMouseScale,
-	GetMouseWheelMove,
+	// counted do loops, followed by the slot of the loop variable, the slot of its limit and a jump.
+	// ForPrep stores the start and limit and skips the loop if it would not run, ForLoop counts up and repeats.
+	ForPrep,
+	ForLoop,
+	// a call to a native function, followed by its index and the number of values it takes and gives back.
+	// the counts are copies of what it was bound with, so the code can be checked without the registry.
+	CallNative,
+#pragma region SUPERINSTRUCTIONS
+	// fused sequences written over the original bytes by the optimizer.
+	// the byte after the opcode is the length of the sequence they replace.
+	GlobalArithConstant,
+	GlobalsArithStore,
+	CompareGlobalsJumpIfFalse,
+	CompareGlobalConstantJumpIfFalse,
 #pragma endregion
-#pragma region SHAPES MODULE
-	DrawPixel,
-	DrawLine,
-	DrawLineStrip, // TODO: Implement
-	DrawCircle,
-	DrawCircleSector, // TODO: Implement
-	DrawCircleSectorLines, // TODO: Implement
-	DrawCircleGradient, // TODO: Implement
-	DrawCircleLines,
-	DrawEllipse,
-	DrawEllipseLines,
-	DrawRing, // TODO: Implement
-	DrawRingLines, // TODO: Implement
-	DrawRectangle,
-	DrawRectangleGradient, // TODO: Implement
-	DrawRectangleLines,
-	DrawRectangleRounded, // TODO: Implement
-	DrawRectangleRoundedLines, // TODO: Implement
-	DrawTriangle,
-	DrawTriangleLines,
-	DrawTriangleFan, // TODO: Implement
-	DrawTriangleStrip, // TODO: Implement
-	DrawPolygon, // TODO: Implement
-	DrawPolygonLines, // TODO: Implement
-	CheckCollisionRectangle, // TODO: Implement
-	CheckCollisionCircle, // TODO: Implement
-	CheckCollisionCircleRectangle, // TODO: Implement
-	GetCollisionRectangle, // TODO: Implement
-	CheckCollisionPointRectangle, // TODO: Implement
-	CheckCollisionPointCircle, // TODO: Implement
-	CheckCollisionPointTriangle, // TODO: Implement
-#pragma endregion
-#pragma region TEXT MODULE
-	DrawFPS, // TODO: Implement
-	DrawText, // TODO: Implement
-	MeasureText // TODO: Implement
+#pragma region QUICKENED
+	// type-specialized forms the vm rewrites arithmetic and comparisons into once it has seen their operands.
+	// each one checks its operand types and falls back to the generic operation if they do not match.
+	AddLong,
+	AddDouble,
+	SubtractLong,
+	SubtractDouble,
+	MultiplyLong,
+	MultiplyDouble,
+	DivideLong,
+	DivideDouble,
+	LessThanLong,
+	LessThanDouble,
+	LessThanEqualLong,
+	LessThanEqualDouble,
+	GreaterThanLong,
+	GreaterThanDouble,
+	GreaterThanEqualLong,
+	GreaterThanEqualDouble,
+	EqualLong,
+	EqualDouble,
+	NotEqualLong,
+	NotEqualDouble,
 #pragma endregion
+#pragma region SPECIALIZED
+	// forms the type inference pass writes at link time for operands whose types it proved.
+	// they neither check their operand types nor the stack depth, and are never quickened back.
+	AddLongLong,
+	AddDoubleDouble,
+	SubtractLongLong,
+	SubtractDoubleDouble,
+	MultiplyLongLong,
+	MultiplyDoubleDouble,
+	DivideLongLong,
+	DivideDoubleDouble,
+	LessThanLongLong,
+	LessThanDoubleDouble,
+	LessThanEqualLongLong,
+	LessThanEqualDoubleDouble,
+	GreaterThanLongLong,
+	GreaterThanDoubleDouble,
+	GreaterThanEqualLongLong,
+	GreaterThanEqualDoubleDouble,
+	EqualLongLong,
+	EqualDoubleDouble,
+	NotEqualLongLong,
+	NotEqualDoubleDouble,
 #pragma endregion
 };
 
+// the name of an arithmetic, logical or comparison opcode, used in error messages and disassembly.
+const char* OperationName(OpCode op);
+// the generic opcode a quickened or specialized opcode was made from. any other opcode is returned as is.
+OpCode GenericOperation(OpCode op);
+// evaluates an arithmetic, logical or comparison opcode the way the vm does. the result is invalid where the vm fails.
+Value BinaryOperation(OpCode op, const Value& a, const Value& b);
+// the same for the conversions and negations that take a single value.
+Value UnaryOperation(OpCode op, const Value& val);
+// how many values an opcode takes off the stack and puts back, false for calls, returns and unknown opcodes.
+// values it only reads count as both.
+bool StackEffect(OpCode op, int32_t& pops, int32_t& pushes);
+
+// an operand the linker fills in once the code has been put together.
+// a constant is already an index into the chunk's own constants, which is remapped whenever the code is copied into
+// another chunk. a global is given its slot and a call the distance to the function, both found by name.
+struct Relocation
+{
+	enum class Type : uint8_t
+	{
+		Constant,
+		Global,
+		Call
+	};
+
+	size_t offset;
+	Type type;
+	// the constant index for a constant, otherwise the name's index in the chunk's symbols
+	uint32_t symbol;
+};
+
+// a call the linker replaced with the body of the function it called, kept so backtraces still show it
+struct InlinedCall
+{
+	static constexpr uint32_t NONE = UINT32_MAX;
+
+	// the line the call was made on
+	int line;
+	// the function's index in the chunk's symbols
+	uint32_t symbol;
+	// the inlined call whose body this call was made in, or NONE
+	uint32_t caller;
+};
+
 class Chunk
 {
 public:
+	Chunk();
+
 	size_t Write(uint8_t instruction, int line);
 	size_t Write(OpCode instruction, int line);
 	size_t WriteLong(uint16_t instruction, int line);
+	// copies from's code between start and end to the end of this chunk, along with its lines and relocations.
+	// returns where the code starts in this chunk.
+	size_t Append(const Chunk& from, size_t start, size_t end);
+	// the same, for code that is the body of a call to name made on line, which the code then stands in for
+	size_t AppendInlined(const Chunk& from, size_t start, size_t end, int line, const std::string& name);
 	size_t AddConstant(const Value& value, int line, OpCode ifShort, OpCode ifLong, bool& success);
 	size_t AddConstant(const Value& value, int line, OpCode ifShort, OpCode ifLong);
 
-	void AddMeta(size_t offset, const Value& metadata);
-	const Value* GetMeta(size_t offset) const;
+	void AddRelocation(size_t offset, Relocation::Type type, uint32_t symbol);
+	void AddRelocation(size_t offset, Relocation::Type type, const std::string& name);
+	// copies the relocations of from's code between start and end, which has been written to this chunk at offset
+	void CopyRelocations(const Chunk& from, size_t start, size_t end, size_t offset);
+	const std::vector<Relocation>& Relocations() const;
+	const std::string& Symbol(uint32_t symbol) const;
+	// the name of the global or function the operand at offset refers to, if it has one
+	const std::string* SymbolAt(size_t offset) const;
 
 	void Modify(size_t offset, uint8_t nval);
 	void ModifyLong(size_t offset, uint16_t nval);
@@ -140,30 +186,84 @@ public:
 
 	uint8_t Read(size_t offset) const;
 	uint16_t ReadLong(size_t offset) const;
-	Value ReadConstant(uint16_t index) const;
+	const Value& ReadConstant(uint16_t index) const;
 	int ReadLine(size_t offset) const;
+	// the inlined calls the code at offset is the body of, outermost first
+	std::vector<InlinedCall> ReadInlined(size_t offset) const;
+	const uint8_t* Code() const;
 
 	void Disassemble(const std::string& name) const;
 	size_t DisassembleInstruction(size_t offset, size_t dif) const;
+	size_t InstructionSize(size_t offset) const;
+	// where the relative jump of the instruction at offset is stored, 0 if it has none.
+	// the jump is relative to the end of the instruction.
+	size_t JumpOperand(size_t offset) const;
 
 	size_t Size() const;
 
+	// fills in a chunk loaded from an image, whose code runs straight from the mapped file.
+	friend class Image;
+
 private:
+	// a run of instructions on one line, from start up to the start of the next run
 	struct LineInfo
 	{
-		size_t len;
+		size_t start;
 		int line;
 	};
 
+	// a run of instructions in the body of the same inlined call, or outside any
+	struct InlinedRun
+	{
+		size_t start;
+		uint32_t call;
+	};
+
+	uint8_t* Bytes();
 	void WriteLine(int line);
+	void WriteLine(size_t offset, int line);
+	void WriteInlined(size_t offset, uint32_t call);
+	uint32_t InternSymbol(const std::string& name);
+	uint32_t InternInlined(const InlinedCall& call);
+	uint32_t CopyInlinedCall(const Chunk& from, uint32_t call, uint32_t caller);
+	bool FindConstant(const Value& value, size_t& index) const;
+	void PushConstant(const Value& value);
+	size_t Intern(const Value& value);
+	// whether the constant operand at offset is a single byte
+	bool ShortConstant(size_t offset) const;
+	bool Widens(const Chunk& from, size_t start, size_t end);
+	size_t Append(const Chunk& from, size_t start, size_t end, uint32_t caller);
+	void AppendCode(const Chunk& from, size_t start, size_t end, uint32_t caller);
+	void AppendWidened(const Chunk& from, size_t start, size_t end, uint32_t caller);
+	void CopyInlined(const Chunk& from, size_t start, size_t end, size_t offset, uint32_t caller);
+	std::vector<Relocation>::const_iterator FindRelocation(size_t offset) const;
 
+	size_t PrintInstruction(size_t offset, int line, bool sameLine) const;
 	size_t SimpleInstruction(const std::string& name, size_t offset) const;
 	size_t ConstantInstruction(const std::string& name, size_t offset) const;
 	size_t ConstantInstructionLong(const std::string& name, size_t offset) const;
+	size_t GlobalInstruction(const std::string& name, size_t offset) const;
 	size_t JumpInstruction(const std::string& name, size_t offset) const;
+	size_t LoopInstruction(const std::string& name, size_t offset) const;
+	size_t NativeInstruction(const std::string& name, size_t offset) const;
+	size_t SuperInstruction(const std::string& name, size_t offset) const;
 
 	std::vector<uint8_t> instructions;
+	// the code of a chunk loaded from an image, used instead of instructions. such a chunk is never written to again,
+	// only quickened in place.
+	uint8_t* mapped;
+	size_t mappedSize;
 	std::vector<Value> values;
+	// where each constant is in values, so adding one that is already there is a lookup
+	std::unordered_map<Value, uint16_t, Value::Hash, Value::Identical> constants;
 	std::vector<LineInfo> lines;
-	std::map<size_t, Value> meta;
+	// only code appended from inlined bodies is in a call, so most chunks have no runs at all
+	std::vector<InlinedCall> inlinedCalls;
+	std::vector<InlinedRun> inlinedRuns;
+	// where each inlined call is in inlinedCalls, by line, symbol and caller, so the same call is only kept once
+	std::map<std::tuple<int, uint32_t, uint32_t>, uint32_t> inlinedIndices;
+	// sorted by offset
+	std::vector<Relocation> relocations;
+	std::vector<std::string> symbols;
+	std::unordered_map<std::string, uint32_t> symbolIndices;
 };
\ No newline at end of file
@@ -6,7 +6,7 @@ Compiler::Compiler(const std::string& source) : Compiler(std::map<std::string, s
 {
 }
 
-Compiler::Compiler(const std::map<std::string, std::string>& sources) : currentToken(0), currentSymbol("!main"), hadError(false), panicMode(false), compiled(false)
+Compiler::Compiler(const std::map<std::string, std::string>& sources) : currentToken(0), currentSymbol("!main"), hadError(false), panicMode(false), compiled(false), tailCalls(true)
 {
 	for (auto& [file, source] : sources)
 	{
@@ -17,7 +17,7 @@ Compiler::Compiler(const std::map<std::string, std::string>& sources) : currentT
 	}
 }
 
-std::map<std::string, std::map<std::string, Chunk>>* Compiler::Compile(bool& success)
+std::map<std::string, std::map<std::string, Chunk>>* Compiler::Compile(bool& success, bool tailCalls)
 {
 	if (compiled)
 	{
@@ -26,6 +26,7 @@ std::map<std::string, std::map<std::string, Chunk>>* Compiler::Compile(bool& suc
 	}
 
 	compiled = true;
+	this->tailCalls = tailCalls;
 
 	for (size_t i = 0; i < files.size(); i++)
 	{
@@ -41,6 +42,11 @@ std::map<std::string, std::map<std::string, Chunk>>* Compiler::Compile(bool& suc
 	return &symbols;
 }
 
+const std::set<std::string>& Compiler::NotInlined() const
+{
+	return notInlined;
+}
+
 Chunk* Compiler::CurrentChunk()
 {
 	return &symbols[currentFile][currentSymbol];
@@ -229,7 +235,7 @@ bool Compiler::Instruction()
 			}
 			else
 			{
-				EmitConstant(NextToken()->Lexeme, OpCode::Load, OpCode::LoadLong);
+				EmitGlobal(NextToken()->Lexeme, OpCode::LoadGlobal);
 			}
 			currentToken += 2;
 		}
@@ -249,7 +255,7 @@ bool Compiler::Instruction()
 			}
 			else
 			{
-				EmitConstant(NextToken()->Lexeme, OpCode::Store, OpCode::StoreLong);
+				EmitGlobal(NextToken()->Lexeme, OpCode::StoreGlobal);
 			}
 			currentToken += 2;
 		}
@@ -277,17 +283,13 @@ bool Compiler::Instruction()
 				else
 				{
 					Token variable = *PreviousToken();
-					EmitConstant(variable.Lexeme, OpCode::Create, OpCode::CreateLong);
+					EmitGlobal(variable.Lexeme, OpCode::CreateGlobal);
 					if (NextToken() && NextToken()->TokenType == Token::Type::Do)
 					{
 						Token doStart = *NextToken();
-						EmitConstant("!" + variable.Lexeme, OpCode::Create, OpCode::CreateLong);
-						EmitConstant(variable.Lexeme, OpCode::Store, OpCode::StoreLong);
-						EmitConstant("!" + variable.Lexeme, OpCode::Store, OpCode::StoreLong);
-						uint16_t beginLoopOffset = EmitConstant("!" + variable.Lexeme, OpCode::Load, OpCode::LoadLong);
-						EmitConstant(variable.Lexeme, OpCode::Load, OpCode::LoadLong);
-						EmitByte(OpCode::GreaterThan);
-						uint16_t endLoopOffset = EmitJump(OpCode::JumpIfFalse);
+						EmitGlobal("!" + variable.Lexeme, OpCode::CreateGlobal);
+						uint16_t endLoopOffset = EmitLoop(OpCode::ForPrep, variable.Lexeme, "!" + variable.Lexeme);
+						uint16_t beginLoopOffset = CurrentChunk()->Size();
 						currentToken += 2;
 						while (CurrentToken() && CurrentToken()->TokenType != Token::Type::Loop)
 						{
@@ -304,13 +306,9 @@ bool Compiler::Instruction()
 								break;
 							}
 						}
-						EmitConstant(variable.Lexeme, OpCode::Load, OpCode::LoadLong);
-						EmitConstant(1L, OpCode::Constant, OpCode::ConstantLong);
-						EmitByte(OpCode::Add);
-						EmitConstant(variable.Lexeme, OpCode::Store, OpCode::StoreLong);
-						PatchJump(EmitJump(OpCode::Jump), beginLoopOffset);
+						PatchJump(EmitLoop(OpCode::ForLoop, variable.Lexeme, "!" + variable.Lexeme), beginLoopOffset);
 						PatchJump(endLoopOffset);
-						EmitConstant("!" + variable.Lexeme, OpCode::Del, OpCode::DelLong);
+						EmitGlobal("!" + variable.Lexeme, OpCode::DelGlobal);
 						currentToken++;
 						break;
 					}
@@ -329,7 +327,7 @@ bool Compiler::Instruction()
 				}
 				else
 				{
-					EmitConstant(PreviousToken()->Lexeme, OpCode::Del, OpCode::DelLong);
+					EmitGlobal(PreviousToken()->Lexeme, OpCode::DelGlobal);
 					currentToken++;
 				}
 				break;
@@ -474,8 +472,9 @@ bool Compiler::Instruction()
 			}
 			else
 			{
-				EmitByte(OpCode::PushJumpAddress);
-				CurrentChunk()->AddMeta(EmitJump(OpCode::Jump), NextToken()->Lexeme);
+				// a tail call jumps straight to the function, which then returns to this function's caller
+				if (!tailCalls || !TailPosition()) { EmitByte(OpCode::PushJumpAddress); }
+				CurrentChunk()->AddRelocation(EmitJump(OpCode::Jump), Relocation::Type::Call, NextToken()->Lexeme);
 				currentToken += 2;
 			}
 		}
@@ -499,6 +498,7 @@ bool Compiler::Instruction()
 				EndSymbol();
 				currentToken += 2;
 				currentSymbol = PreviousToken()->Lexeme;
+				if (TokenRelative(-2)->Lexeme == "::") { notInlined.insert(currentSymbol); }
 			}
 		}
 		else
@@ -533,12 +533,24 @@ size_t Compiler::EmitByte(OpCode op)
 
 size_t Compiler::EmitConstant(const Value& value, OpCode ifShort, OpCode ifLong)
 {
-	using namespace std::string_literals;
 	bool success;
 	size_t ret = CurrentChunk()->AddConstant(value, CurrentToken()->Line, ifShort, ifLong, success);
-	CurrentChunk()->AddMeta(ret, "!constant"s);
-	CurrentChunk()->AddMeta(ret + 1, value);
-	if (!success) { ErrorAt(*CurrentToken(), "Too many constants in one chunk"); }
+	if (!success)
+	{
+		ErrorAt(*CurrentToken(), "Too many constants in one chunk");
+		return ret;
+	}
+	uint16_t index = CurrentChunk()->Read(ret) == static_cast<uint8_t>(ifLong) ? CurrentChunk()->ReadLong(ret + 1) : CurrentChunk()->Read(ret + 1);
+	CurrentChunk()->AddRelocation(ret + 1, Relocation::Type::Constant, index);
+	return ret;
+}
+
+size_t Compiler::EmitGlobal(const std::string& name, OpCode op)
+{
+	size_t ret = EmitByte(op);
+	EmitByte(0xFF); // slot is resolved by the linker
+	EmitByte(0xFF);
+	CurrentChunk()->AddRelocation(ret + 1, Relocation::Type::Global, name);
 	return ret;
 }
 
@@ -550,6 +562,19 @@ uint16_t Compiler::EmitJump(OpCode op)
 	return CurrentChunk()->Size() - 2;
 }
 
+// the loop variable and its limit are resolved to slots by the linker, same as for EmitGlobal
+uint16_t Compiler::EmitLoop(OpCode op, const std::string& counter, const std::string& limit)
+{
+	size_t ret = EmitByte(op);
+	for (size_t i = 0; i < 6; i++)
+	{
+		EmitByte(0xFF);
+	}
+	CurrentChunk()->AddRelocation(ret + 1, Relocation::Type::Global, counter);
+	CurrentChunk()->AddRelocation(ret + 3, Relocation::Type::Global, limit);
+	return CurrentChunk()->Size() - 2;
+}
+
 void Compiler::PatchJump(uint16_t address)
 {
 	int16_t jump = CurrentChunk()->Size() - address - 2;
@@ -564,6 +589,42 @@ void Compiler::PatchJump(uint16_t address, uint16_t jumpAddress)
 	CurrentChunk()->ModifyLong(address, jump);
 }
 
+// a call is in tail position when nothing runs between its return and the end of the function.
+// only ends of if statements can follow it, along with any else branch it skips over.
+// main ends with Return instead of going back through the call stack, so its calls never are.
+bool Compiler::TailPosition()
+{
+	if (currentSymbol == "!main") { return false; }
+
+	// how deep inside a skipped else branch the token is
+	size_t skipping = 0;
+	for (int offset = 2;; offset++)
+	{
+		const Token* token = TokenRelative(offset);
+		if (!token || token->TokenType == Token::Type::FunctionHeader) { return skipping == 0; }
+
+		switch (token->TokenType)
+		{
+		case Token::Type::If:
+			if (skipping == 0) { return false; }
+			skipping++;
+			break;
+
+		case Token::Type::Else:
+			if (skipping == 0) { skipping = 1; }
+			break;
+
+		case Token::Type::EndIf:
+			if (skipping > 0) { skipping--; }
+			break;
+
+		default:
+			if (skipping == 0) { return false; }
+			break;
+		}
+	}
+}
+
 void Compiler::EndSymbol()
 {
 	if (currentSymbol != "!main")
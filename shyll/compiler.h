@@ -1,6 +1,7 @@
 #pragma once
 
 #include <map>
+#include <set>
 
 #include "chunk.h"
 #include "scanner.h"
@@ -11,18 +12,23 @@ public:
 	Compiler(const std::string& source);
 	Compiler(const std::map<std::string, std::string>& sources);
 
-	std::map<std::string, std::map<std::string, Chunk>>* Compile(bool& success);
+	// tailCalls turns calls in tail position into plain jumps. they then leave no frame for backtraces.
+	std::map<std::string, std::map<std::string, Chunk>>* Compile(bool& success, bool tailCalls = true);
+	// functions declared with '::', which the linker must not inline
+	const std::set<std::string>& NotInlined() const;
 
 private:
 	std::vector<std::string> files;
 	std::map<std::string, std::vector<Token>> tokens;
 	std::map<std::string, std::map<std::string, Chunk>> symbols;
+	std::set<std::string> notInlined;
 	size_t currentToken;
 	std::string currentSymbol;
 	std::string currentFile;
 	bool hadError;
 	bool panicMode;
 	bool compiled;
+	bool tailCalls;
 
 	Chunk* CurrentChunk();
 	const Token* PreviousToken();
@@ -35,10 +41,13 @@ private:
 	size_t EmitByte(uint8_t byte);
 	size_t EmitByte(OpCode op);
 	size_t EmitConstant(const Value& value, OpCode ifShort, OpCode ifLong);
+	size_t EmitGlobal(const std::string& name, OpCode op);
 	uint16_t EmitJump(OpCode op);
+	uint16_t EmitLoop(OpCode op, const std::string& counter, const std::string& limit);
 	void PatchJump(uint16_t address);
 	void PatchJump(uint16_t address, uint16_t jumpAddress);
 
+	bool TailPosition();
 	void EndSymbol();
 
 	void WarnAt(const Token& token, const std::string& message);
@@ -0,0 +1,587 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "image.h"
+#include "inference.h"
+#include "optimizer.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// layout, with every number little endian:
+	// the magic, the version and flags, then the number of code bytes, constants, line runs, globals, natives,
+	// symbols, relocations, inlined calls and inlined runs. the code follows the header, then the constants, line runs,
+	// global names and the natives the code calls, then the symbols, relocations, inlined calls and inlined runs when
+	// the meta flag is set.
+	constexpr uint8_t MAGIC[4] = { 'S', 'H', 'Y', 'I' };
+	constexpr size_t HEADER_SIZE = 8 + 9 * 4;
+	constexpr uint16_t FLAG_META = 1;
+
+	enum class ConstantType : uint8_t
+	{
+		Bool,
+		Long,
+		Double,
+		String
+	};
+
+	void Put(std::vector<uint8_t>& out, uint64_t value, int bytes)
+	{
+		for (int i = 0; i < bytes; i++)
+		{
+			out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+		}
+	}
+
+	void PutString(std::vector<uint8_t>& out, const std::string& value)
+	{
+		Put(out, value.size(), 4);
+		out.insert(out.end(), value.begin(), value.end());
+	}
+
+	// reads past the end only set failed, so a truncated image is reported once at the end
+	struct Reader
+	{
+		const uint8_t* at;
+		const uint8_t* end;
+		bool failed;
+
+		uint64_t Take(int bytes)
+		{
+			if (end - at < bytes)
+			{
+				failed = true;
+				return 0;
+			}
+			uint64_t value = 0;
+			for (int i = 0; i < bytes; i++)
+			{
+				value |= static_cast<uint64_t>(*at++) << (8 * i);
+			}
+			return value;
+		}
+
+		const uint8_t* Skip(size_t count)
+		{
+			const uint8_t* start = at;
+			if (static_cast<size_t>(end - at) < count)
+			{
+				failed = true;
+				return start;
+			}
+			at += count;
+			return start;
+		}
+
+		std::string TakeString()
+		{
+			size_t length = Take(4);
+			const uint8_t* start = Skip(length);
+			return failed ? std::string() : std::string(reinterpret_cast<const char*>(start), length);
+		}
+	};
+}
+
+Image::Image() : data(nullptr), size(0)
+{
+}
+
+Image::~Image()
+{
+	Unload();
+}
+
+bool Image::Write(const std::string& path, const Chunk& chunk, const GlobalSlots& globals, const NativeRegistry& natives, bool meta)
+{
+	// only the natives the code calls are recorded, to be checked against the registry it is loaded with
+	std::vector<uint16_t> called;
+	for (size_t offset = 0; offset < chunk.Size(); offset += chunk.InstructionSize(offset))
+	{
+		if (static_cast<OpCode>(chunk.Read(offset)) == OpCode::CallNative) { called.push_back(chunk.ReadLong(offset + 1)); }
+	}
+	std::sort(called.begin(), called.end());
+	called.erase(std::unique(called.begin(), called.end()), called.end());
+
+	std::vector<uint8_t> out(MAGIC, MAGIC + sizeof(MAGIC));
+	Put(out, VERSION, 2);
+	Put(out, meta ? FLAG_META : 0, 2);
+	Put(out, chunk.Size(), 4);
+	Put(out, chunk.values.size(), 4);
+	Put(out, chunk.lines.size(), 4);
+	Put(out, globals.Size(), 4);
+	Put(out, called.size(), 4);
+	Put(out, meta ? chunk.symbols.size() : 0, 4);
+	Put(out, meta ? chunk.relocations.size() : 0, 4);
+	Put(out, meta ? chunk.inlinedCalls.size() : 0, 4);
+	Put(out, meta ? chunk.inlinedRuns.size() : 0, 4);
+
+	out.insert(out.end(), chunk.Code(), chunk.Code() + chunk.Size());
+
+	for (const Value& value : chunk.values)
+	{
+		if (value.Get<bool>())
+		{
+			Put(out, static_cast<uint8_t>(ConstantType::Bool), 1);
+			Put(out, *value.Get<bool>(), 1);
+		}
+		else if (value.Get<long>())
+		{
+			Put(out, static_cast<uint8_t>(ConstantType::Long), 1);
+			Put(out, static_cast<uint64_t>(static_cast<int64_t>(*value.Get<long>())), 8);
+		}
+		else if (value.Get<double>())
+		{
+			double val = *value.Get<double>();
+			uint64_t bits;
+			std::memcpy(&bits, &val, sizeof(double));
+			Put(out, static_cast<uint8_t>(ConstantType::Double), 1);
+			Put(out, bits, 8);
+		}
+		else if (value.Get<std::string>())
+		{
+			Put(out, static_cast<uint8_t>(ConstantType::String), 1);
+			PutString(out, *value.Get<std::string>());
+		}
+		else
+		{
+			std::cerr << "Invalid constant cannot be saved to image '" << path << "'\n";
+			return false;
+		}
+	}
+
+	for (const Chunk::LineInfo& run : chunk.lines)
+	{
+		Put(out, run.start, 4);
+		Put(out, static_cast<uint32_t>(run.line), 4);
+	}
+
+	for (size_t slot = 0; slot < globals.Size(); slot++)
+	{
+		PutString(out, globals.Name(static_cast<uint16_t>(slot)));
+	}
+
+	for (uint16_t index : called)
+	{
+		Put(out, index, 2);
+		Put(out, natives.Get(index).arguments.size(), 1);
+		Put(out, natives.Get(index).results, 1);
+		PutString(out, natives.Name(index));
+	}
+
+	if (meta)
+	{
+		for (const std::string& symbol : chunk.symbols)
+		{
+			PutString(out, symbol);
+		}
+		for (const Relocation& relocation : chunk.relocations)
+		{
+			Put(out, relocation.offset, 4);
+			Put(out, static_cast<uint8_t>(relocation.type), 1);
+			Put(out, relocation.symbol, 4);
+		}
+		for (const InlinedCall& call : chunk.inlinedCalls)
+		{
+			Put(out, static_cast<uint32_t>(call.line), 4);
+			Put(out, call.symbol, 4);
+			Put(out, call.caller, 4);
+		}
+		for (const Chunk::InlinedRun& run : chunk.inlinedRuns)
+		{
+			Put(out, run.start, 4);
+			Put(out, run.call, 4);
+		}
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(out.data()), out.size());
+	if (!file.good())
+	{
+		std::cerr << "Unable to write image '" << path << "'\n";
+		return false;
+	}
+	return true;
+}
+
+bool Image::Load(const std::string& path, Chunk& chunk, GlobalSlots& globals, const NativeRegistry& natives)
+{
+	// the chunk may still run from the image being replaced, so it is cleared before that is unmapped
+	chunk = Chunk();
+	Unload();
+
+	auto fail = [&](const std::string& message)
+	{
+		std::cerr << message << '\n';
+		chunk = Chunk();
+		Unload();
+		return false;
+	};
+
+	if (!Map(path)) { return fail("Unable to open image '" + path + '\''); }
+	if (size < HEADER_SIZE || !std::equal(MAGIC, MAGIC + sizeof(MAGIC), data)) { return fail("'" + path + "' is not an image"); }
+
+	Reader reader{ data + sizeof(MAGIC), data + size, false };
+	uint16_t version = static_cast<uint16_t>(reader.Take(2));
+	if (version != VERSION)
+	{
+		return fail("Image '" + path + "' is version " + std::to_string(version) + ", this build runs version " + std::to_string(VERSION));
+	}
+	uint16_t flags = static_cast<uint16_t>(reader.Take(2));
+	size_t codeSize = reader.Take(4);
+	size_t constantCount = reader.Take(4);
+	size_t lineCount = reader.Take(4);
+	size_t globalCount = reader.Take(4);
+	size_t nativeCount = reader.Take(4);
+	size_t symbolCount = reader.Take(4);
+	size_t relocationCount = reader.Take(4);
+	size_t inlinedCallCount = reader.Take(4);
+	size_t inlinedRunCount = reader.Take(4);
+
+	uint8_t* code = const_cast<uint8_t*>(reader.Skip(codeSize));
+
+	for (size_t i = 0; i < constantCount && !reader.failed; i++)
+	{
+		switch (static_cast<ConstantType>(reader.Take(1)))
+		{
+		case ConstantType::Bool:
+			chunk.PushConstant(Value(reader.Take(1) != 0));
+			break;
+
+		case ConstantType::Long:
+		{
+			int64_t wide = static_cast<int64_t>(reader.Take(8));
+			// a long is narrower on some platforms than the one the image was written on
+			if (static_cast<int64_t>(static_cast<long>(wide)) != wide) { return fail("Constant in image '" + path + "' does not fit a long"); }
+			chunk.PushConstant(Value(static_cast<long>(wide)));
+			break;
+		}
+
+		case ConstantType::Double:
+		{
+			uint64_t bits = reader.Take(8);
+			double val;
+			std::memcpy(&val, &bits, sizeof(double));
+			chunk.PushConstant(Value(val));
+			break;
+		}
+
+		case ConstantType::String:
+			chunk.PushConstant(Value(reader.TakeString()));
+			break;
+
+		default:
+			return fail("Invalid constant in image '" + path + '\'');
+		}
+	}
+
+	for (size_t i = 0; i < lineCount && !reader.failed; i++)
+	{
+		size_t start = reader.Take(4);
+		int line = static_cast<int>(static_cast<uint32_t>(reader.Take(4)));
+		chunk.lines.push_back(Chunk::LineInfo{ start, line });
+	}
+
+	globals.Clear();
+	for (size_t i = 0; i < globalCount && !reader.failed; i++)
+	{
+		uint16_t slot;
+		if (!globals.Resolve(reader.TakeString(), slot)) { return fail("Too many globals in image '" + path + '\''); }
+	}
+
+	std::vector<uint16_t> bound;
+	for (size_t i = 0; i < nativeCount && !reader.failed; i++)
+	{
+		uint16_t index = static_cast<uint16_t>(reader.Take(2));
+		size_t arguments = reader.Take(1);
+		uint8_t results = static_cast<uint8_t>(reader.Take(1));
+		std::string name = reader.TakeString();
+		uint16_t found;
+		if (!reader.failed && (!natives.Find(name, found) || found != index || natives.Get(found).arguments.size() != arguments || natives.Get(found).results != results))
+		{
+			return fail("Native '" + name + "' is not bound the way image '" + path + "' expects");
+		}
+		bound.push_back(index);
+	}
+
+	if (flags & FLAG_META)
+	{
+		for (size_t i = 0; i < symbolCount && !reader.failed; i++)
+		{
+			std::string symbol = reader.TakeString();
+			chunk.symbolIndices.emplace(symbol, static_cast<uint32_t>(chunk.symbols.size()));
+			chunk.symbols.push_back(symbol);
+		}
+		for (size_t i = 0; i < relocationCount && !reader.failed; i++)
+		{
+			size_t offset = reader.Take(4);
+			Relocation::Type type = static_cast<Relocation::Type>(reader.Take(1));
+			uint32_t symbol = static_cast<uint32_t>(reader.Take(4));
+			chunk.relocations.push_back(Relocation{ offset, type, symbol });
+		}
+		for (size_t i = 0; i < inlinedCallCount && !reader.failed; i++)
+		{
+			int line = static_cast<int>(static_cast<uint32_t>(reader.Take(4)));
+			uint32_t symbol = static_cast<uint32_t>(reader.Take(4));
+			uint32_t caller = static_cast<uint32_t>(reader.Take(4));
+			chunk.inlinedIndices.emplace(std::make_tuple(line, symbol, caller), static_cast<uint32_t>(chunk.inlinedCalls.size()));
+			chunk.inlinedCalls.push_back(InlinedCall{ line, symbol, caller });
+		}
+		for (size_t i = 0; i < inlinedRunCount && !reader.failed; i++)
+		{
+			size_t start = reader.Take(4);
+			uint32_t call = static_cast<uint32_t>(reader.Take(4));
+			chunk.inlinedRuns.push_back(Chunk::InlinedRun{ start, call });
+		}
+	}
+
+	// every offset in the code has to fall in a line run for errors to report it
+	if (reader.failed || (codeSize > 0 && (chunk.lines.empty() || chunk.lines.front().start != 0)))
+	{
+		return fail("Image '" + path + "' is truncated");
+	}
+
+	chunk.mapped = code;
+	chunk.mappedSize = codeSize;
+	std::sort(bound.begin(), bound.end());
+	if (!Check(chunk, globalCount, bound, natives)) { return fail("Image '" + path + "' is corrupt"); }
+
+	// specialized ops skip their type checks on the word of the inference that wrote them, which a file can't be
+	// taken on. they go back to the generic op and whatever can be proven against this code is specialized again.
+	bool specialized = false;
+	for (size_t offset = 0; offset < codeSize; offset += chunk.InstructionSize(offset))
+	{
+		OpCode op = static_cast<OpCode>(chunk.Read(offset));
+		if (op >= OpCode::AddLongLong && op <= OpCode::NotEqualDoubleDouble)
+		{
+			chunk.Modify(offset, static_cast<uint8_t>(GenericOperation(op)));
+			specialized = true;
+		}
+	}
+	if (specialized) { TypeInference(chunk, globalCount).Specialize(); }
+	return true;
+}
+
+// the verifier checks how code uses the stack, but trusts the operands the linker filled in. an image can hold
+// anything, so every operand has to be in range of what the image brought before any of its code runs.
+bool Image::Check(const Chunk& chunk, size_t globalCount, const std::vector<uint16_t>& bound, const NativeRegistry& natives)
+{
+	size_t codeSize = chunk.Size();
+	size_t constantCount = chunk.values.size();
+
+	for (size_t i = 0; i < chunk.lines.size(); i++)
+	{
+		size_t start = chunk.lines[i].start;
+		if (start >= codeSize || (i > 0 && start <= chunk.lines[i - 1].start)) { return false; }
+	}
+
+	for (size_t i = 0; i < chunk.relocations.size(); i++)
+	{
+		const Relocation& relocation = chunk.relocations[i];
+		if (relocation.offset >= codeSize || (i > 0 && relocation.offset <= chunk.relocations[i - 1].offset)) { return false; }
+		switch (relocation.type)
+		{
+		case Relocation::Type::Constant:
+			if (relocation.symbol >= constantCount) { return false; }
+			break;
+
+		case Relocation::Type::Global:
+		case Relocation::Type::Call:
+			if (relocation.symbol >= chunk.symbols.size()) { return false; }
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	// a call can only be made in one that comes before it, so following callers always ends
+	for (size_t i = 0; i < chunk.inlinedCalls.size(); i++)
+	{
+		const InlinedCall& call = chunk.inlinedCalls[i];
+		if (call.symbol >= chunk.symbols.size() || (call.caller != InlinedCall::NONE && call.caller >= i)) { return false; }
+	}
+
+	for (size_t i = 0; i < chunk.inlinedRuns.size(); i++)
+	{
+		const Chunk::InlinedRun& run = chunk.inlinedRuns[i];
+		if (run.start >= codeSize || (i > 0 && run.start <= chunk.inlinedRuns[i - 1].start)) { return false; }
+		if (run.call != InlinedCall::NONE && run.call >= chunk.inlinedCalls.size()) { return false; }
+	}
+
+	auto global = [&](size_t offset) { return chunk.ReadLong(offset) < globalCount; };
+	auto constant = [&](size_t offset) { return chunk.ReadLong(offset) < constantCount; };
+	auto operation = [&](size_t offset) { return GenericOperation(static_cast<OpCode>(chunk.Read(offset))); };
+
+	// one past the end is a start too, since that is where a jump past the last instruction lands
+	std::vector<bool> starts(codeSize + 1, false);
+	std::vector<size_t> jumps;
+	for (size_t offset = 0; offset < codeSize;)
+	{
+		starts[offset] = true;
+		OpCode op = static_cast<OpCode>(chunk.Read(offset));
+
+		// the fewest bytes each superinstruction's operands take up
+		size_t least = 1;
+		switch (op)
+		{
+		case OpCode::GlobalArithConstant:
+			least = 7;
+			break;
+
+		case OpCode::GlobalsArithStore:
+		case OpCode::CompareGlobalsJumpIfFalse:
+		case OpCode::CompareGlobalConstantJumpIfFalse:
+			least = 9;
+			break;
+
+		default:
+			break;
+		}
+		if (least > 1 && offset + 1 >= codeSize) { return false; }
+
+		size_t size = chunk.InstructionSize(offset);
+		if (size < least || offset + size > codeSize) { return false; }
+
+		bool valid = true;
+		switch (op)
+		{
+		case OpCode::Constant:
+			valid = chunk.Read(offset + 1) < constantCount;
+			break;
+
+		case OpCode::ConstantLong:
+			valid = constant(offset + 1);
+			break;
+
+		case OpCode::StoreGlobal:
+		case OpCode::LoadGlobal:
+		case OpCode::DelGlobal:
+		case OpCode::CreateGlobal:
+			valid = global(offset + 1);
+			break;
+
+		case OpCode::ForPrep:
+		case OpCode::ForLoop:
+			valid = global(offset + 1) && global(offset + 3);
+			break;
+
+		case OpCode::GlobalArithConstant:
+			valid = Optimizer::IsArithmetic(operation(offset + 2)) && global(offset + 3) && constant(offset + 5);
+			break;
+
+		case OpCode::GlobalsArithStore:
+			valid = Optimizer::IsArithmetic(operation(offset + 2)) && global(offset + 3) && global(offset + 5) && global(offset + 7);
+			break;
+
+		case OpCode::CompareGlobalsJumpIfFalse:
+			valid = Optimizer::IsComparison(operation(offset + 2)) && global(offset + 3) && global(offset + 5);
+			break;
+
+		case OpCode::CompareGlobalConstantJumpIfFalse:
+			valid = Optimizer::IsComparison(operation(offset + 2)) && global(offset + 3) && constant(offset + 5);
+			break;
+
+		case OpCode::PushJumpAddress:
+			// the return address is taken to be just past a jump right after this
+			valid = offset + 1 < codeSize && static_cast<OpCode>(chunk.Read(offset + 1)) == OpCode::Jump;
+			break;
+
+		case OpCode::CallNative:
+		{
+			uint16_t index = chunk.ReadLong(offset + 1);
+			valid = std::binary_search(bound.begin(), bound.end(), index)
+				&& chunk.Read(offset + 3) == natives.Get(index).arguments.size()
+				&& chunk.Read(offset + 4) == natives.Get(index).results;
+			break;
+		}
+
+		default:
+			break;
+		}
+		if (!valid) { return false; }
+
+		if (chunk.JumpOperand(offset)) { jumps.push_back(offset); }
+		offset += size;
+	}
+	starts[codeSize] = true;
+
+	// jumps are relative to the end of their instruction, and must not land inside another
+	for (size_t offset : jumps)
+	{
+		size_t target = offset + chunk.InstructionSize(offset) + static_cast<int16_t>(chunk.ReadLong(chunk.JumpOperand(offset)));
+		if (target > codeSize || !starts[target]) { return false; }
+	}
+
+	return true;
+}
+
+void Image::Unload()
+{
+	if (!data) { return; }
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(data, size);
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+bool Image::Probe(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	uint8_t magic[sizeof(MAGIC)];
+	file.read(reinterpret_cast<char*>(magic), sizeof(magic));
+	return file.good() && std::equal(MAGIC, MAGIC + sizeof(MAGIC), magic);
+}
+
+// the mapping is private and writable, so quickening copies only the pages it touches and never writes to the file
+bool Image::Map(const std::string& path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) { return false; }
+	LARGE_INTEGER length;
+	if (!GetFileSizeEx(file, &length) || length.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping) { return false; }
+	void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!view) { return false; }
+	data = static_cast<uint8_t*>(view);
+	size = static_cast<size_t>(length.QuadPart);
+#else
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0) { return false; }
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size == 0)
+	{
+		close(file);
+		return false;
+	}
+	void* memory = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+	close(file);
+	if (memory == MAP_FAILED) { return false; }
+	data = static_cast<uint8_t*>(memory);
+	size = static_cast<size_t>(info.st_size);
+#endif
+	return true;
+}
\ No newline at end of file
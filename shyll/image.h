@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chunk.h"
+#include "linker.h"
+#include "native.h"
+
+// a linked chunk saved to a file, so a program can run again without being compiled and linked.
+// the code comes right after the header and is mapped copy-on-write, so it runs from the file's pages and every
+// process running the same image shares them until quickening writes to one. constants, line runs and global names
+// are decoded on load. the relocations and inlined calls are optional debug meta, only kept so disassembly and call
+// traces have names and call traces show the calls the linker inlined.
+class Image
+{
+public:
+	Image();
+	~Image();
+
+	Image(const Image&) = delete;
+	Image& operator=(const Image&) = delete;
+
+	static bool Write(const std::string& path, const Chunk& chunk, const GlobalSlots& globals, const NativeRegistry& natives, bool meta);
+	// the chunk runs from this image's mapping, so it has to stay loaded for as long as the chunk is used.
+	// the natives the code calls have to be bound at the same indices as when it was written.
+	// on any failure the chunk is left empty, and code that does not check out against the rest of the image fails.
+	bool Load(const std::string& path, Chunk& chunk, GlobalSlots& globals, const NativeRegistry& natives);
+	void Unload();
+
+	// whether the file at path starts like an image
+	static bool Probe(const std::string& path);
+
+	// bump whenever the opcodes, their operands or the layout change. images of any other version are refused.
+	static constexpr uint16_t VERSION = 2;
+
+private:
+	uint8_t* data;
+	size_t size;
+
+	bool Map(const std::string& path);
+	// whether every line run, relocation, inlined call, operand and jump in a loaded chunk is in range of the image.
+	// bound holds the native indices the image recorded, sorted, which were already checked against natives.
+	static bool Check(const Chunk& chunk, size_t globalCount, const std::vector<uint16_t>& bound, const NativeRegistry& natives);
+};
\ No newline at end of file
@@ -0,0 +1,424 @@
+#include "inference.h"
+
+TypeInference::TypeInference(Chunk& chunk, size_t globalCount) : chunk(chunk), globalCount(globalCount)
+{
+}
+
+void TypeInference::Specialize()
+{
+	states.assign(chunk.Size(), State{ false, { }, { } });
+	work.clear();
+	stores.clear();
+
+	Flow(0, Unknown());
+	while (!work.empty())
+	{
+		size_t offset = work.back();
+		work.pop_back();
+		Transfer(offset);
+	}
+
+	for (size_t offset = 0; offset < chunk.Size(); offset++)
+	{
+		const State& state = states[offset];
+		if (!state.reached || state.stack.size() < 2) { continue; }
+
+		OpCode op = static_cast<OpCode>(chunk.Read(offset));
+		OpCode specialized = Specialization(op, state.stack[state.stack.size() - 2], state.stack.back());
+		if (specialized != op)
+		{
+			chunk.Modify(offset, static_cast<uint8_t>(specialized));
+		}
+	}
+}
+
+// joins state into what is known at offset and queues it again if that changed anything.
+// stacks are lined up from the top, since that is the part the instructions there can see.
+void TypeInference::Flow(size_t offset, const State& state)
+{
+	if (offset >= chunk.Size()) { return; }
+
+	State& known = states[offset];
+	if (!known.reached)
+	{
+		known = state;
+		known.reached = true;
+		work.push_back(offset);
+		return;
+	}
+
+	bool changed = false;
+	if (known.stack.size() > state.stack.size())
+	{
+		known.stack.erase(known.stack.begin(), known.stack.begin() + (known.stack.size() - state.stack.size()));
+		changed = true;
+	}
+	size_t skip = state.stack.size() - known.stack.size();
+	for (size_t i = 0; i < known.stack.size(); i++)
+	{
+		Type joined = Join(known.stack[i], state.stack[skip + i]);
+		changed |= joined != known.stack[i];
+		known.stack[i] = joined;
+	}
+	for (size_t i = 0; i < known.globals.size(); i++)
+	{
+		Type joined = Join(known.globals[i], state.globals[i]);
+		changed |= joined != known.globals[i];
+		known.globals[i] = joined;
+	}
+
+	if (changed) { work.push_back(offset); }
+}
+
+void TypeInference::Transfer(size_t offset)
+{
+	State state = states[offset];
+	OpCode op = GenericOperation(static_cast<OpCode>(chunk.Read(offset)));
+	size_t next = offset + chunk.InstructionSize(offset);
+
+	// every slot in the chunk was resolved by the same link that counted the globals
+	auto global = [&](size_t at) -> Type&
+	{
+		return state.globals[chunk.ReadLong(at)];
+	};
+
+	switch (op)
+	{
+	case OpCode::Return:
+	case OpCode::JumpToCallStackAddress:
+		return;
+
+	case OpCode::PushJumpAddress:
+	{
+		if (next + 3 > chunk.Size() || static_cast<OpCode>(chunk.Read(next)) != OpCode::Jump) { return; }
+		size_t entry = next + 3 + static_cast<int16_t>(chunk.ReadLong(next + 1));
+		Flow(entry, Unknown());
+
+		const std::vector<bool>& written = Stores(entry);
+		state.stack.clear();
+		for (size_t slot = 0; slot < globalCount; slot++)
+		{
+			if (written[slot]) { state.globals[slot] = Type::Any; }
+		}
+		Flow(next + 3, state);
+		return;
+	}
+
+	case OpCode::Constant:
+		state.stack.push_back(ConstantType(chunk.ReadConstant(chunk.Read(offset + 1))));
+		break;
+
+	case OpCode::ConstantLong:
+		state.stack.push_back(ConstantType(chunk.ReadConstant(chunk.ReadLong(offset + 1))));
+		break;
+
+	case OpCode::LoadGlobal:
+		state.stack.push_back(global(offset + 1));
+		break;
+
+	case OpCode::StoreGlobal:
+	{
+		Type type = Pop(state);
+		global(offset + 1) = type;
+		break;
+	}
+
+	case OpCode::DelGlobal:
+		global(offset + 1) = Type::Any;
+		break;
+
+	case OpCode::AsDouble:
+		Pop(state);
+		state.stack.push_back(Type::Double);
+		break;
+
+	case OpCode::AsLong:
+		Pop(state);
+		state.stack.push_back(Type::Long);
+		break;
+
+	case OpCode::AsString:
+		Pop(state);
+		state.stack.push_back(Type::String);
+		break;
+
+	case OpCode::Negate:
+	{
+		Type type = Pop(state);
+		state.stack.push_back(type == Type::Long || type == Type::Double ? type : Type::Any);
+		break;
+	}
+
+	case OpCode::LogicalNot:
+		Pop(state);
+		state.stack.push_back(Type::Bool);
+		break;
+
+	case OpCode::Duplicate:
+	{
+		Type type = Pop(state);
+		state.stack.push_back(type);
+		state.stack.push_back(type);
+		break;
+	}
+
+	case OpCode::Add:
+	case OpCode::Subtract:
+	case OpCode::Multiply:
+	case OpCode::Divide:
+	case OpCode::Exponent:
+	case OpCode::LessThan:
+	case OpCode::LessThanEqual:
+	case OpCode::GreaterThan:
+	case OpCode::GreaterThanEqual:
+	case OpCode::Equal:
+	case OpCode::NotEqual:
+	case OpCode::LogicalAnd:
+	case OpCode::LogicalOr:
+	{
+		Type b = Pop(state);
+		Type a = Pop(state);
+		state.stack.push_back(ResultType(op, a, b));
+		break;
+	}
+
+	case OpCode::GlobalArithConstant:
+	{
+		OpCode arith = GenericOperation(static_cast<OpCode>(chunk.Read(offset + 2)));
+		Type constant = ConstantType(chunk.ReadConstant(chunk.ReadLong(offset + 5)));
+		Type& slot = global(offset + 3);
+		slot = ResultType(arith, slot, constant);
+		break;
+	}
+
+	case OpCode::GlobalsArithStore:
+	{
+		OpCode arith = GenericOperation(static_cast<OpCode>(chunk.Read(offset + 2)));
+		Type result = ResultType(arith, global(offset + 3), global(offset + 5));
+		global(offset + 7) = result;
+		break;
+	}
+
+	case OpCode::Jump:
+		Flow(next + static_cast<int16_t>(chunk.ReadLong(offset + 1)), state);
+		return;
+
+	case OpCode::JumpIfFalse:
+		Pop(state);
+		Flow(next + static_cast<int16_t>(chunk.ReadLong(offset + 1)), state);
+		break;
+
+	case OpCode::CompareGlobalsJumpIfFalse:
+	case OpCode::CompareGlobalConstantJumpIfFalse:
+		Flow(next + static_cast<int16_t>(chunk.ReadLong(offset + 7)), state);
+		break;
+
+	case OpCode::ForPrep:
+	{
+		Type start = Pop(state);
+		global(offset + 3) = Pop(state);
+		global(offset + 1) = start;
+		Flow(next + static_cast<int16_t>(chunk.ReadLong(offset + 5)), state);
+		break;
+	}
+
+	case OpCode::ForLoop:
+	{
+		Type& counter = global(offset + 1);
+		counter = ResultType(OpCode::Add, counter, Type::Long);
+		Flow(next + static_cast<int16_t>(chunk.ReadLong(offset + 5)), state);
+		break;
+	}
+
+	case OpCode::CallNative:
+		for (uint8_t i = 0; i < chunk.Read(offset + 3); i++) { Pop(state); }
+		for (uint8_t i = 0; i < chunk.Read(offset + 4); i++) { state.stack.push_back(Type::Any); }
+		break;
+
+	default:
+	{
+		int32_t pops;
+		int32_t pushes;
+		if (!StackEffect(op, pops, pushes)) { return; }
+		for (int32_t i = 0; i < pops; i++) { Pop(state); }
+		for (int32_t i = 0; i < pushes; i++) { state.stack.push_back(Type::Any); }
+		break;
+	}
+	}
+
+	Flow(next, state);
+}
+
+// every global a call to the function at entry can store to, including through the functions it calls.
+const std::vector<bool>& TypeInference::Stores(size_t entry)
+{
+	auto it = stores.find(entry);
+	if (it != stores.end()) { return it->second; }
+
+	std::vector<bool>& written = stores[entry];
+	written.assign(globalCount, false);
+
+	std::vector<bool> visited(chunk.Size(), false);
+	std::vector<size_t> pending{ entry };
+	auto write = [&](size_t at)
+	{
+		written[chunk.ReadLong(at)] = true;
+	};
+
+	while (!pending.empty())
+	{
+		size_t offset = pending.back();
+		pending.pop_back();
+		if (offset >= chunk.Size() || visited[offset]) { continue; }
+		visited[offset] = true;
+
+		size_t next = offset + chunk.InstructionSize(offset);
+		switch (GenericOperation(static_cast<OpCode>(chunk.Read(offset))))
+		{
+		case OpCode::Return:
+		case OpCode::JumpToCallStackAddress:
+			break;
+
+		case OpCode::StoreGlobal:
+		case OpCode::DelGlobal:
+			write(offset + 1);
+			pending.push_back(next);
+			break;
+
+		case OpCode::GlobalArithConstant:
+			write(offset + 3);
+			pending.push_back(next);
+			break;
+
+		case OpCode::GlobalsArithStore:
+			write(offset + 7);
+			pending.push_back(next);
+			break;
+
+		case OpCode::Jump:
+			pending.push_back(next + static_cast<int16_t>(chunk.ReadLong(offset + 1)));
+			break;
+
+		case OpCode::JumpIfFalse:
+			pending.push_back(next + static_cast<int16_t>(chunk.ReadLong(offset + 1)));
+			pending.push_back(next);
+			break;
+
+		case OpCode::CompareGlobalsJumpIfFalse:
+		case OpCode::CompareGlobalConstantJumpIfFalse:
+			pending.push_back(next + static_cast<int16_t>(chunk.ReadLong(offset + 7)));
+			pending.push_back(next);
+			break;
+
+		case OpCode::ForPrep:
+			write(offset + 3);
+			[[fallthrough]];
+
+		case OpCode::ForLoop:
+			write(offset + 1);
+			pending.push_back(next + static_cast<int16_t>(chunk.ReadLong(offset + 5)));
+			pending.push_back(next);
+			break;
+
+		case OpCode::PushJumpAddress:
+			if (next + 3 <= chunk.Size())
+			{
+				pending.push_back(next + 3 + static_cast<int16_t>(chunk.ReadLong(next + 1)));
+				pending.push_back(next + 3);
+			}
+			break;
+
+		default:
+			pending.push_back(next);
+			break;
+		}
+	}
+
+	return written;
+}
+
+TypeInference::State TypeInference::Unknown() const
+{
+	return State{ true, { }, std::vector<Type>(globalCount, Type::Any) };
+}
+
+TypeInference::Type TypeInference::Pop(State& state)
+{
+	if (state.stack.empty()) { return Type::Any; }
+	Type type = state.stack.back();
+	state.stack.pop_back();
+	return type;
+}
+
+TypeInference::Type TypeInference::Join(Type a, Type b)
+{
+	if (a == Type::None) { return b; }
+	if (b == Type::None || a == b) { return a; }
+	return Type::Any;
+}
+
+TypeInference::Type TypeInference::ConstantType(const Value& value)
+{
+	if (value.Get<long>()) { return Type::Long; }
+	if (value.Get<double>()) { return Type::Double; }
+	if (value.Get<bool>()) { return Type::Bool; }
+	if (value.Get<std::string>()) { return Type::String; }
+	return Type::Any;
+}
+
+// the type of a successful operation on these operands, following Value's operators.
+// an operation that fails stops the program, so only the successful cases matter.
+TypeInference::Type TypeInference::ResultType(OpCode op, Type a, Type b)
+{
+	bool numeric = (a == Type::Long || a == Type::Double) && (b == Type::Long || b == Type::Double);
+
+	switch (op)
+	{
+	case OpCode::Add:
+		if (a == Type::String || b == Type::String) { return Type::String; }
+		[[fallthrough]];
+
+	case OpCode::Subtract:
+	case OpCode::Multiply:
+	case OpCode::Divide:
+		if (!numeric) { return Type::Any; }
+		return a == Type::Long && b == Type::Long ? Type::Long : Type::Double;
+
+	case OpCode::Exponent:
+		return Type::Double;
+
+	case OpCode::LessThan:
+	case OpCode::LessThanEqual:
+	case OpCode::GreaterThan:
+	case OpCode::GreaterThanEqual:
+	case OpCode::Equal:
+	case OpCode::NotEqual:
+	case OpCode::LogicalAnd:
+	case OpCode::LogicalOr:
+		return Type::Bool;
+
+	default:
+		return Type::Any;
+	}
+}
+
+OpCode TypeInference::Specialization(OpCode op, Type a, Type b)
+{
+	bool longs = a == Type::Long && b == Type::Long;
+	if (!longs && !(a == Type::Double && b == Type::Double)) { return op; }
+
+	switch (op)
+	{
+	case OpCode::Add: return longs ? OpCode::AddLongLong : OpCode::AddDoubleDouble;
+	case OpCode::Subtract: return longs ? OpCode::SubtractLongLong : OpCode::SubtractDoubleDouble;
+	case OpCode::Multiply: return longs ? OpCode::MultiplyLongLong : OpCode::MultiplyDoubleDouble;
+	case OpCode::Divide: return longs ? OpCode::DivideLongLong : OpCode::DivideDoubleDouble;
+	case OpCode::LessThan: return longs ? OpCode::LessThanLongLong : OpCode::LessThanDoubleDouble;
+	case OpCode::LessThanEqual: return longs ? OpCode::LessThanEqualLongLong : OpCode::LessThanEqualDoubleDouble;
+	case OpCode::GreaterThan: return longs ? OpCode::GreaterThanLongLong : OpCode::GreaterThanDoubleDouble;
+	case OpCode::GreaterThanEqual: return longs ? OpCode::GreaterThanEqualLongLong : OpCode::GreaterThanEqualDoubleDouble;
+	case OpCode::Equal: return longs ? OpCode::EqualLongLong : OpCode::EqualDoubleDouble;
+	case OpCode::NotEqual: return longs ? OpCode::NotEqualLongLong : OpCode::NotEqualDoubleDouble;
+	default: return op;
+	}
+}
\ No newline at end of file
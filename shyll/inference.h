@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "chunk.h"
+
+// forward dataflow over a linked chunk that tracks the type of every stack slot and global at each instruction.
+// where both operands of an arithmetic or comparison op are proven to be longs or proven to be doubles on every path,
+// the op is rewritten into its specialized form, which skips the type and stack checks entirely.
+// globals start out unknown since the REPL keeps them between chunks. a call forgets the stack and every global the
+// function can store to, and a function body starts from nothing known.
+class TypeInference
+{
+public:
+	TypeInference(Chunk& chunk, size_t globalCount);
+
+	void Specialize();
+
+	enum class Type : uint8_t
+	{
+		None,
+		Long,
+		Double,
+		Bool,
+		String,
+		Any
+	};
+
+private:
+	struct State
+	{
+		bool reached;
+		// types from the bottom of what is known up to the top. anything below is Any.
+		std::vector<Type> stack;
+		std::vector<Type> globals;
+	};
+
+	Chunk& chunk;
+	size_t globalCount;
+	std::vector<State> states;
+	std::vector<size_t> work;
+	std::map<size_t, std::vector<bool>> stores;
+
+	void Flow(size_t offset, const State& state);
+	void Transfer(size_t offset);
+	const std::vector<bool>& Stores(size_t entry);
+	State Unknown() const;
+
+	static Type Pop(State& state);
+	static Type Join(Type a, Type b);
+	static Type ConstantType(const Value& value);
+	static Type ResultType(OpCode op, Type a, Type b);
+	static OpCode Specialization(OpCode op, Type a, Type b);
+};
\ No newline at end of file
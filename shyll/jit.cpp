@@ -0,0 +1,475 @@
+#include "jit.h"
+#include "assembler.h"
+#include "vm.h"
+
+#ifdef JIT_SUPPORTED
+namespace
+{
+	// register use in compiled code:
+	// rbx holds the Jit, r12 the stack top and r13 the address of VM::stackTop, which is written back around calls.
+	// rax, rcx, rdx and r8-r10 are scratch, xmm0 and xmm1 hold doubles.
+	constexpr Reg JIT = RBX;
+	constexpr Reg TOP = R12;
+	constexpr Reg TOP_ADDRESS = R13;
+
+	constexpr uint64_t INVALID_BITS = 0xFFF8000000000000;
+	constexpr uint64_t PAYLOAD_BITS = 0x0000FFFFFFFFFFFF;
+	// results narrower than this many bits are stored inline. where long has 32 bits this also keeps its wraparound.
+	constexpr uint8_t LONG_SHIFT = static_cast<uint8_t>(64 - (sizeof(long) * 8 < 48 ? sizeof(long) * 8 : 48));
+	// tag and box bits of an inline long and of a bool, shifted down by 48
+	constexpr uint32_t LONG_HIGH = 0xFFFA;
+	constexpr uint32_t BOOL_HIGH = 0xFFF9;
+	// box and heap bits, shifted down by 50
+	constexpr uint32_t HEAP_HIGH = 0x3FFF;
+
+	bool IsComparison(OpCode op)
+	{
+		switch (op)
+		{
+		case OpCode::LessThan:
+		case OpCode::LessThanEqual:
+		case OpCode::GreaterThan:
+		case OpCode::GreaterThanEqual:
+		case OpCode::Equal:
+		case OpCode::NotEqual:
+			return true;
+
+		default:
+			return false;
+		}
+	}
+
+	// jumps to slow unless reg holds a valid value that owns nothing on the heap
+	void EmitCheckPlain(Assembler& a, Reg reg, size_t slow)
+	{
+		a.Mov(RDX, reg);
+		a.ShiftImm(SHR, RDX, 50);
+		a.Cmp32Imm(RDX, HEAP_HIGH);
+		a.JumpIf(EQUAL, slow);
+		a.MovImm(RDX, INVALID_BITS);
+		a.Alu(CMP, reg, RDX);
+		a.JumpIf(EQUAL, slow);
+	}
+
+	// rax op rcx for two inline longs or two doubles, anything else jumps to slow before touching memory.
+	// arithmetic leaves the boxed result in rax, comparisons leave 0 or 1 in rax.
+	// results the interpreter would box differently, such as longs wider than 48 bits or NaNs, also go to slow.
+	bool EmitNumeric(Assembler& a, OpCode op, size_t slow)
+	{
+		Condition longCondition = EQUAL;
+		Condition doubleCondition = EQUAL;
+		SseOp sse = ADDSD;
+		switch (op)
+		{
+		case OpCode::Add: sse = ADDSD; break;
+		case OpCode::Subtract: sse = SUBSD; break;
+		case OpCode::Multiply: sse = MULSD; break;
+		case OpCode::Divide: sse = DIVSD; break;
+		case OpCode::LessThan: longCondition = LESS; doubleCondition = BELOW; break;
+		case OpCode::LessThanEqual: longCondition = LESS_EQUAL; doubleCondition = BELOW_EQUAL; break;
+		case OpCode::GreaterThan: longCondition = GREATER; doubleCondition = ABOVE; break;
+		case OpCode::GreaterThanEqual: longCondition = GREATER_EQUAL; doubleCondition = ABOVE_EQUAL; break;
+		case OpCode::Equal: longCondition = EQUAL; doubleCondition = EQUAL; break;
+		case OpCode::NotEqual: longCondition = NOT_EQUAL; doubleCondition = NOT_EQUAL; break;
+		default: return false;
+		}
+
+		size_t notLong = a.NewLabel();
+		size_t done = a.NewLabel();
+
+		a.Mov(RDX, RAX);
+		a.ShiftImm(SHR, RDX, 48);
+		a.Cmp32Imm(RDX, LONG_HIGH);
+		a.JumpIf(NOT_EQUAL, notLong);
+		if (op == OpCode::Divide)
+		{
+			// integer division keeps the interpreter's rounding and division by zero error
+			a.Jump(slow);
+		}
+		else
+		{
+			a.Mov(RDX, RCX);
+			a.ShiftImm(SHR, RDX, 48);
+			a.Cmp32Imm(RDX, LONG_HIGH);
+			a.JumpIf(NOT_EQUAL, slow);
+			a.ShiftImm(SHL, RAX, 16);
+			a.ShiftImm(SAR, RAX, 16);
+			a.ShiftImm(SHL, RCX, 16);
+			a.ShiftImm(SAR, RCX, 16);
+			if (IsComparison(op))
+			{
+				a.Alu(CMP, RAX, RCX);
+				a.SetAl(longCondition);
+			}
+			else
+			{
+				if (op == OpCode::Multiply)
+				{
+					a.Imul(RAX, RCX);
+				}
+				else
+				{
+					a.Alu(op == OpCode::Add ? ADD : SUB, RAX, RCX);
+				}
+				a.Mov(RDX, RAX);
+				a.ShiftImm(SHL, RDX, LONG_SHIFT);
+				a.ShiftImm(SAR, RDX, LONG_SHIFT);
+				a.Alu(CMP, RDX, RAX);
+				a.JumpIf(NOT_EQUAL, slow);
+				a.MovImm(RDX, PAYLOAD_BITS);
+				a.Alu(AND, RAX, RDX);
+				a.MovImm(RDX, static_cast<uint64_t>(LONG_HIGH) << 48);
+				a.Alu(OR, RAX, RDX);
+			}
+			a.Jump(done);
+		}
+
+		a.Bind(notLong);
+		a.MovImm(RDX, INVALID_BITS);
+		a.Mov(R8, RAX);
+		a.Alu(AND, R8, RDX);
+		a.Alu(CMP, R8, RDX);
+		a.JumpIf(EQUAL, slow);
+		a.Mov(R8, RCX);
+		a.Alu(AND, R8, RDX);
+		a.Alu(CMP, R8, RDX);
+		a.JumpIf(EQUAL, slow);
+		a.MovToXmm(0, RAX);
+		a.MovToXmm(1, RCX);
+		if (IsComparison(op))
+		{
+			a.Sse(0x66, UCOMISD, 0, 1);
+			a.JumpIf(PARITY, slow);
+			a.SetAl(doubleCondition);
+		}
+		else
+		{
+			a.Sse(0xF2, sse, 0, 1);
+			a.Sse(0x66, UCOMISD, 0, 0);
+			a.JumpIf(PARITY, slow);
+			a.MovFromXmm(RAX, 0);
+		}
+
+		a.Bind(done);
+		return true;
+	}
+
+	void EmitBoxBool(Assembler& a)
+	{
+		a.MovImm(RDX, static_cast<uint64_t>(BOOL_HIGH) << 48);
+		a.Alu(OR, RAX, RDX);
+	}
+
+	void EmitReturn(Assembler& a, uint32_t status)
+	{
+		a.Store(TOP_ADDRESS, 0, TOP);
+		a.MovImm32(RAX, status);
+		a.AddImm(RSP, 32);
+		a.Pop(R13);
+		a.Pop(R12);
+		a.Pop(RBX);
+		a.Ret();
+	}
+}
+#endif
+
+Jit::Jit() : vm(nullptr), code(nullptr), codeSize(0), errorExit(0)
+{
+}
+
+Jit::~Jit()
+{
+	Release();
+}
+
+void Jit::Release()
+{
+#ifdef JIT_SUPPORTED
+	Assembler::Free(code, codeSize);
+#endif
+	code = nullptr;
+	codeSize = 0;
+}
+
+bool Jit::Compile(VM& vm)
+{
+#ifndef JIT_SUPPORTED
+	return false;
+#else
+	this->vm = &vm;
+	Release();
+
+	const Chunk& chunk = vm.chunk;
+	Assembler a;
+
+	// entry(Jit* jit, Value** stackTop). three pushes and the shadow space keep calls 16-byte aligned.
+	a.Push(RBX);
+	a.Push(R12);
+	a.Push(R13);
+	a.SubImm(RSP, 32);
+	a.Mov(JIT, ARG0);
+	a.Mov(TOP_ADDRESS, ARG1);
+	a.Load(TOP, TOP_ADDRESS, 0);
+
+	addresses.assign(chunk.Size(), NO_ADDRESS);
+	for (size_t offset = 0; offset < chunk.Size(); offset += chunk.InstructionSize(offset))
+	{
+		size_t label = a.OffsetLabel(offset);
+		a.Bind(label);
+		addresses[offset] = a.Position(label);
+		CompileInstruction(a, offset, offset + chunk.InstructionSize(offset));
+	}
+	// running off the end, or jumping somewhere that is not an instruction, is left to the interpreter to report
+	EmitStep(a, chunk.Size());
+	for (const std::pair<const size_t, size_t>& label : a.OffsetLabels())
+	{
+		if (!a.Bound(label.second))
+		{
+			a.Bind(label.second);
+			EmitStep(a, label.first);
+		}
+	}
+
+	errorExit = a.bytes.size();
+	EmitReturn(a, 1);
+	code = a.Finish(codeSize);
+	return code != nullptr;
+#endif
+}
+
+InterpretResult Jit::Run()
+{
+	using Entry = int (*)(Jit*, Value**);
+	return reinterpret_cast<Entry>(code)(this, &vm->stackTop) == 0 ? InterpretResult::Ok : InterpretResult::RuntimeError;
+}
+
+const uint8_t* Jit::Step(Jit* jit, size_t offset)
+{
+	VM& vm = *jit->vm;
+	vm.ip = offset;
+	// an instruction can land in the middle of another one, keep interpreting until it reaches compiled code again
+	do
+	{
+		if (vm.Step() != InterpretResult::Ok)
+		{
+			return jit->code + jit->errorExit;
+		}
+	} while (vm.ip >= jit->addresses.size() || jit->addresses[vm.ip] == NO_ADDRESS);
+
+	return jit->code + jit->addresses[vm.ip];
+}
+
+#ifdef JIT_SUPPORTED
+void Jit::EmitStep(Assembler& a, size_t offset)
+{
+	a.Store(TOP_ADDRESS, 0, TOP);
+	a.Mov(ARG0, JIT);
+	a.MovImm(ARG1, offset);
+	a.MovImm(RAX, reinterpret_cast<uint64_t>(&Jit::Step));
+	a.Call(RAX);
+	a.Load(TOP, TOP_ADDRESS, 0);
+	a.JumpTo(RAX);
+}
+
+void Jit::EmitLoadGlobal(Assembler& a, int reg, uint16_t slot, size_t slow)
+{
+	a.MovImm(R9, reinterpret_cast<uint64_t>(&vm->globals[slot]));
+	a.Load(static_cast<Reg>(reg), R9, 0);
+	EmitCheckPlain(a, static_cast<Reg>(reg), slow);
+}
+
+// growing the stack moves it, so its bounds are read from the vm every time instead of being compiled in.
+void Jit::EmitCheckDepth(Assembler& a, int count, size_t slow)
+{
+	a.MovImm(RDX, reinterpret_cast<uint64_t>(&vm->stack));
+	a.Load(RDX, RDX, 0);
+	a.AddImm(RDX, static_cast<int32_t>(count * sizeof(Value)));
+	a.Alu(CMP, TOP, RDX);
+	a.JumpIf(BELOW, slow);
+}
+
+// the interpreter grows the stack when a push does not fit, or reports the overflow
+void Jit::EmitCheckRoom(Assembler& a, size_t slow)
+{
+	a.MovImm(RDX, reinterpret_cast<uint64_t>(&vm->stackEnd));
+	a.Load(RDX, RDX, 0);
+	a.Alu(CMP, TOP, RDX);
+	a.JumpIf(ABOVE_EQUAL, slow);
+}
+
+void Jit::CompileInstruction(Assembler& a, size_t offset, size_t next)
+{
+	const Chunk& chunk = vm->chunk;
+	OpCode op = GenericOperation(static_cast<OpCode>(chunk.Read(offset)));
+	size_t slow = a.NewLabel();
+	size_t done = a.NewLabel();
+
+	switch (op)
+	{
+	case OpCode::None:
+		return;
+
+	case OpCode::Return:
+		EmitReturn(a, 0);
+		return;
+
+	case OpCode::Constant:
+	case OpCode::ConstantLong:
+	{
+		const Value& constant = chunk.ReadConstant(op == OpCode::Constant ? chunk.Read(offset + 1) : chunk.ReadLong(offset + 1));
+		if (constant.IsHeap() || !constant.Valid()) { break; }
+		EmitCheckRoom(a, slow);
+		a.MovImm(RAX, constant.bits);
+		a.Store(TOP, 0, RAX);
+		a.AddImm(TOP, sizeof(Value));
+		a.Jump(done);
+		break;
+	}
+
+	case OpCode::LoadGlobal:
+		EmitCheckRoom(a, slow);
+		EmitLoadGlobal(a, RAX, chunk.ReadLong(offset + 1), slow);
+		a.Store(TOP, 0, RAX);
+		a.AddImm(TOP, sizeof(Value));
+		a.Jump(done);
+		break;
+
+	case OpCode::StoreGlobal:
+		// a valid old value means the global is declared, and a plain one has nothing to release
+		EmitCheckDepth(a, 1, slow);
+		a.Load(RAX, TOP, -8);
+		EmitCheckPlain(a, RAX, slow);
+		EmitLoadGlobal(a, RCX, chunk.ReadLong(offset + 1), slow);
+		a.Store(R9, 0, RAX);
+		a.SubImm(TOP, sizeof(Value));
+		a.Jump(done);
+		break;
+
+	case OpCode::Pop:
+		EmitCheckDepth(a, 1, slow);
+		a.Load(RAX, TOP, -8);
+		EmitCheckPlain(a, RAX, slow);
+		a.SubImm(TOP, sizeof(Value));
+		a.Jump(done);
+		break;
+
+	case OpCode::Duplicate:
+		EmitCheckDepth(a, 1, slow);
+		EmitCheckRoom(a, slow);
+		a.Load(RAX, TOP, -8);
+		EmitCheckPlain(a, RAX, slow);
+		a.Store(TOP, 0, RAX);
+		a.AddImm(TOP, sizeof(Value));
+		a.Jump(done);
+		break;
+
+	case OpCode::Add:
+	case OpCode::Subtract:
+	case OpCode::Multiply:
+	case OpCode::Divide:
+	case OpCode::LessThan:
+	case OpCode::LessThanEqual:
+	case OpCode::GreaterThan:
+	case OpCode::GreaterThanEqual:
+	case OpCode::Equal:
+	case OpCode::NotEqual:
+		EmitCheckDepth(a, 2, slow);
+		a.Load(RAX, TOP, -16);
+		a.Load(RCX, TOP, -8);
+		EmitNumeric(a, op, slow);
+		if (IsComparison(op)) { EmitBoxBool(a); }
+		a.Store(TOP, -16, RAX);
+		a.SubImm(TOP, sizeof(Value));
+		a.Jump(done);
+		break;
+
+	case OpCode::Jump:
+		a.Jump(a.OffsetLabel(next + static_cast<int16_t>(chunk.ReadLong(offset + 1))));
+		return;
+
+	case OpCode::JumpIfFalse:
+		EmitCheckDepth(a, 1, slow);
+		a.Load(RAX, TOP, -8);
+		a.Mov(RDX, RAX);
+		a.ShiftImm(SHR, RDX, 48);
+		a.Cmp32Imm(RDX, BOOL_HIGH);
+		a.JumpIf(NOT_EQUAL, slow);
+		a.SubImm(TOP, sizeof(Value));
+		a.TestAl1();
+		a.JumpIf(EQUAL, a.OffsetLabel(next + static_cast<int16_t>(chunk.ReadLong(offset + 1))));
+		a.Jump(done);
+		break;
+
+	case OpCode::GlobalArithConstant:
+	{
+		// superinstructions run whole or not at all, so every check comes before the store
+		const Value& constant = chunk.ReadConstant(chunk.ReadLong(offset + 5));
+		if (constant.IsHeap() || !constant.Valid()) { break; }
+		EmitLoadGlobal(a, RAX, chunk.ReadLong(offset + 3), slow);
+		a.MovImm(RCX, constant.bits);
+		if (!EmitNumeric(a, GenericOperation(static_cast<OpCode>(chunk.Read(offset + 2))), slow)) { break; }
+		a.Store(R9, 0, RAX);
+		a.Jump(done);
+		break;
+	}
+
+	case OpCode::GlobalsArithStore:
+		EmitLoadGlobal(a, R10, chunk.ReadLong(offset + 7), slow);
+		EmitLoadGlobal(a, RAX, chunk.ReadLong(offset + 3), slow);
+		EmitLoadGlobal(a, RCX, chunk.ReadLong(offset + 5), slow);
+		if (!EmitNumeric(a, GenericOperation(static_cast<OpCode>(chunk.Read(offset + 2))), slow)) { break; }
+		a.MovImm(R9, reinterpret_cast<uint64_t>(&vm->globals[chunk.ReadLong(offset + 7)]));
+		a.Store(R9, 0, RAX);
+		a.Jump(done);
+		break;
+
+	case OpCode::CompareGlobalsJumpIfFalse:
+	case OpCode::CompareGlobalConstantJumpIfFalse:
+	{
+		EmitLoadGlobal(a, RAX, chunk.ReadLong(offset + 3), slow);
+		if (op == OpCode::CompareGlobalsJumpIfFalse)
+		{
+			EmitLoadGlobal(a, RCX, chunk.ReadLong(offset + 5), slow);
+		}
+		else
+		{
+			const Value& constant = chunk.ReadConstant(chunk.ReadLong(offset + 5));
+			if (constant.IsHeap() || !constant.Valid()) { break; }
+			a.MovImm(RCX, constant.bits);
+		}
+		if (!EmitNumeric(a, GenericOperation(static_cast<OpCode>(chunk.Read(offset + 2))), slow)) { break; }
+		a.Alu(TEST, RAX, RAX);
+		a.JumpIf(EQUAL, a.OffsetLabel(next + static_cast<int16_t>(chunk.ReadLong(offset + 7))));
+		a.Jump(done);
+		break;
+	}
+
+	case OpCode::ForLoop:
+	{
+		// the count is only stored once the test is known to run here too, so a bail out leaves it as it was
+		EmitLoadGlobal(a, R10, chunk.ReadLong(offset + 3), slow);
+		EmitLoadGlobal(a, RAX, chunk.ReadLong(offset + 1), slow);
+		a.MovImm(RCX, Value(1L).bits);
+		EmitNumeric(a, OpCode::Add, slow);
+		a.Mov(RCX, RAX);
+		a.Mov(RAX, R10);
+		a.Mov(R10, RCX);
+		EmitNumeric(a, OpCode::GreaterThan, slow);
+		a.Store(R9, 0, R10);
+		a.Alu(TEST, RAX, RAX);
+		a.JumpIf(NOT_EQUAL, a.OffsetLabel(next + static_cast<int16_t>(chunk.ReadLong(offset + 5))));
+		a.Jump(done);
+		break;
+	}
+
+	default:
+		break;
+	}
+
+	// everything without a template, and every template that bails out, runs this instruction in the interpreter.
+	// a template that gives up part way has only read memory so far, so falling through into this is still correct.
+	a.Bind(slow);
+	EmitStep(a, offset);
+	a.Bind(done);
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "chunk.h"
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(EXCLUDE_JIT)
+#define JIT_SUPPORTED
+#endif
+
+class VM;
+class Assembler;
+enum class InterpretResult;
+
+// baseline template jit for x86-64.
+// each instruction of the linked chunk is compiled to a fixed machine code template, so hot instructions run
+// without dispatch or operand decoding. templates only handle plain longs, doubles and bools in place and hand
+// everything else back to the interpreter one instruction at a time, so the vm stack and error reporting stay the same.
+class Jit
+{
+public:
+	Jit();
+	~Jit();
+
+	Jit(const Jit&) = delete;
+	Jit& operator=(const Jit&) = delete;
+
+	// returns false if there is no jit for this platform, in which case the chunk has to be interpreted.
+	bool Compile(VM& vm);
+	InterpretResult Run();
+
+	static constexpr size_t NO_ADDRESS = SIZE_MAX;
+
+private:
+	VM* vm;
+	uint8_t* code;
+	size_t codeSize;
+	// offset into the code for each instruction start, NO_ADDRESS elsewhere
+	std::vector<size_t> addresses;
+	size_t errorExit;
+
+	void Release();
+
+	void CompileInstruction(Assembler& assembler, size_t offset, size_t next);
+	void EmitStep(Assembler& assembler, size_t offset);
+	void EmitLoadGlobal(Assembler& assembler, int reg, uint16_t slot, size_t slow);
+	void EmitCheckDepth(Assembler& assembler, int count, size_t slow);
+	void EmitCheckRoom(Assembler& assembler, size_t slow);
+
+	// runs the instruction at offset in the interpreter and returns where the native code continues.
+	static const uint8_t* Step(Jit* jit, size_t offset);
+};
\ No newline at end of file
@@ -1,4 +1,7 @@
 #include "linker.h"
+#include "inference.h"
+#include "optimizer.h"
+#include "peephole.h"
 
 #ifndef EXCLUDE_RAYLIB
 #include "..\lib\raylib\src\raylib.h"
@@ -12,13 +15,14 @@ Linker::Linker(const std::map<std::string, std::string>& sources) : compiler(sou
 {
 }
 
-BuildResult Linker::Link(Chunk& chunk)
+BuildResult Linker::Link(Chunk& chunk, GlobalSlots& globals, const NativeRegistry& natives, OptimizationLevel level)
 {
 	bool success;
-	std::map<std::string, std::map<std::string, Chunk>>* symbols = compiler.Compile(success);
+	std::map<std::string, std::map<std::string, Chunk>>* symbols = compiler.Compile(success, level != OptimizationLevel::None);
 	if (!success) { return BuildResult::CompilerError; }
 
 	locs.clear();
+	if (level != OptimizationLevel::None) { Inline(symbols); }
 
 	{
 		std::vector<std::string> filesFoundIn;
@@ -48,175 +52,82 @@ BuildResult Linker::Link(Chunk& chunk)
 	}
 
 #ifndef EXCLUDE_RAYLIB
-	std::map<std::string, Chunk> raylibSymbols;
-#pragma region CORE MODULE
-	MakeSymbol(&raylibSymbols, "initwindow", OpCode::InitWindow);
-	MakeSymbol(&raylibSymbols, "windowshouldclose", OpCode::WindowShouldClose);
-	MakeSymbol(&raylibSymbols, "closewindow", OpCode::CloseWindow);
-	MakeSymbol(&raylibSymbols, "showcursor", OpCode::ShowCursor);
-	MakeSymbol(&raylibSymbols, "hidecursor", OpCode::HideCursor);
-	MakeSymbol(&raylibSymbols, "clearbackground", OpCode::ClearBackground);
-	MakeSymbol(&raylibSymbols, "begindrawing", OpCode::BeginDrawing);
-	MakeSymbol(&raylibSymbols, "enddrawing", OpCode::EndDrawing);
-	MakeSymbol(&raylibSymbols, "settargetfps", OpCode::SetTargetFPS);
-	MakeSymbol(&raylibSymbols, "gettime", OpCode::GetTime);
-	MakeSymbol(&raylibSymbols, "getrandomvalue", OpCode::GetRandomValue);
-	// TODO: save in loaded file's directory when implemented. save next to exe when in REPL.
-	// MakeSymbol(&raylibSymbols, "loadstoragevalue", OpCode::LoadStorageValue);
-	// MakeSymbol(&raylibSymbols, "savestoragevalue", OpCode::SaveStorageValue);
-	MakeSymbol(&raylibSymbols, "iskeypressed", OpCode::IsKeyPressed);
-	MakeSymbol(&raylibSymbols, "iskeydown", OpCode::IsKeyDown);
-	MakeSymbol(&raylibSymbols, "iskeyreleased", OpCode::IsKeyReleased);
-	MakeSymbol(&raylibSymbols, "iskeyup", OpCode::IsKeyUp);
-	MakeSymbol(&raylibSymbols, "getkeypressed", OpCode::GetKeyPressed);
-	MakeSymbol(&raylibSymbols, "setexitkey", OpCode::SetExitKey);
-	MakeSymbol(&raylibSymbols, "ismousebuttonpressed", OpCode::IsMouseButtonPressed);
-	MakeSymbol(&raylibSymbols, "ismousebuttondown", OpCode::IsMouseButtonDown);
-	MakeSymbol(&raylibSymbols, "ismousebuttonreleased", OpCode::IsMouseButtonReleased);
-	MakeSymbol(&raylibSymbols, "ismousebuttonup", OpCode::IsMouseButtonUp);
-	MakeSymbol(&raylibSymbols, "getmousex", OpCode::GetMouseX);
-	MakeSymbol(&raylibSymbols, "getmousey", OpCode::GetMouseY);
-	MakeSymbol(&raylibSymbols, "getmousepos", OpCode::GetMousePosition);
-	MakeSymbol(&raylibSymbols, "setmousepos", OpCode::SetMousePosition);
-	MakeSymbol(&raylibSymbols, "setmouseoffset", OpCode::SetMouseOffset);
-	MakeSymbol(&raylibSymbols, "setmousescale", OpCode::SetMouseScale);
-	MakeSymbol(&raylibSymbols, "getmousewheel", OpCode::GetMouseWheelMove);
-#pragma endregion
-
-#pragma region SHAPES MODULE
-	MakeSymbol(&raylibSymbols, "drawpixel", OpCode::DrawPixel);
-	MakeSymbol(&raylibSymbols, "drawline", OpCode::DrawLine);
-	// MakeSymbol(&raylibSymbols, "drawlinestrip", OpCode::DrawLineStrip);
-	MakeSymbol(&raylibSymbols, "drawcircle", OpCode::DrawCircle);
-	// MakeSymbol(&raylibSymbols, "drawcirclesector", OpCode::DrawCircleSector);
-	// MakeSymbol(&raylibSymbols, "drawcirclesectorlines", OpCode::DrawCircleSectorLines);
-	MakeSymbol(&raylibSymbols, "drawcirclegradient", OpCode::DrawCircleGradient);
-	MakeSymbol(&raylibSymbols, "drawcirclelines", OpCode::DrawCircleLines);
-	MakeSymbol(&raylibSymbols, "drawellipse", OpCode::DrawEllipse);
-	MakeSymbol(&raylibSymbols, "drawellipselines", OpCode::DrawEllipseLines);
-	// MakeSymbol(&raylibSymbols, "drawring", OpCode::DrawRing);
-	// MakeSymbol(&raylibSymbols, "drawringlines", OpCode::DrawRingLines);
-	MakeSymbol(&raylibSymbols, "drawrectangle", OpCode::DrawRectangle);
-	// MakeSymbol(&raylibSymbols, "drawrectanglegradient", OpCode::DrawRectangleGradient);
-	MakeSymbol(&raylibSymbols, "drawrectanglelines", OpCode::DrawRectangleLines);
-	// MakeSymbol(&raylibSymbols, "drawrectanglerounded", OpCode::DrawRectangleRounded);
-	// MakeSymbol(&raylibSymbols, "drawrectangleroundedlines", OpCode::DrawRectangleRoundedLines);
-	MakeSymbol(&raylibSymbols, "drawtriangle", OpCode::DrawTriangle);
-	MakeSymbol(&raylibSymbols, "drawtrianglelines", OpCode::DrawTriangleLines);
-	// MakeSymbol(&raylibSymbols, "drawtrianglefan", OpCode::DrawTriangleFan);
-	// MakeSymbol(&raylibSymbols, "drawtrianglestrip", OpCode::DrawTriangleStrip);
-	// MakeSymbol(&raylibSymbols, "drawpolygon", OpCode::DrawPolygon);
-	// MakeSymbol(&raylibSymbols, "drawpolygonlines", OpCode::DrawPolygonLines);
-	// MakeSymbol(&raylibSymbols, "checkcollisionrectangle", OpCode::CheckCollisionRectangle);
-	// MakeSymbol(&raylibSymbols, "checkcollisioncircle", OpCode::CheckCollisionCircle);
-	// MakeSymbol(&raylibSymbols, "checkcollisioncirclerectangle", OpCode::CheckCollisionCircleRectangle);
-	// MakeSymbol(&raylibSymbols, "getcollisionrectangle", OpCode::GetCollisionRectangle);
-	// MakeSymbol(&raylibSymbols, "checkcollisionpointrectangle", OpCode::CheckCollisionPointRectangle);
-	// MakeSymbol(&raylibSymbols, "checkcollisionpointcircle", OpCode::CheckCollisionPointCircle);
-	// MakeSymbol(&raylibSymbols, "checkcollisionpointtriangle", OpCode::CheckCollisionPointTriangle);
-#pragma endregion
-
-#pragma region TEXT MODULE
-	MakeSymbol(&raylibSymbols, "drawfps", OpCode::DrawFPS);
-	MakeSymbol(&raylibSymbols, "drawtext", OpCode::DrawText);
-	MakeSymbol(&raylibSymbols, "measuretext", OpCode::MeasureText);
-#pragma endregion
-
-#pragma region CONSTANTS
-	MakeSymbol(&raylibSymbols, "key_a", static_cast<long>(KEY_A));
-	MakeSymbol(&raylibSymbols, "key_b", static_cast<long>(KEY_B));
-	MakeSymbol(&raylibSymbols, "key_c", static_cast<long>(KEY_C));
-	MakeSymbol(&raylibSymbols, "key_d", static_cast<long>(KEY_D));
-	MakeSymbol(&raylibSymbols, "key_e", static_cast<long>(KEY_E));
-	MakeSymbol(&raylibSymbols, "key_f", static_cast<long>(KEY_F));
-	MakeSymbol(&raylibSymbols, "key_g", static_cast<long>(KEY_G));
-	MakeSymbol(&raylibSymbols, "key_h", static_cast<long>(KEY_H));
-	MakeSymbol(&raylibSymbols, "key_i", static_cast<long>(KEY_I));
-	MakeSymbol(&raylibSymbols, "key_j", static_cast<long>(KEY_J));
-	MakeSymbol(&raylibSymbols, "key_k", static_cast<long>(KEY_K));
-	MakeSymbol(&raylibSymbols, "key_l", static_cast<long>(KEY_L));
-	MakeSymbol(&raylibSymbols, "key_m", static_cast<long>(KEY_M));
-	MakeSymbol(&raylibSymbols, "key_n", static_cast<long>(KEY_N));
-	MakeSymbol(&raylibSymbols, "key_o", static_cast<long>(KEY_O));
-	MakeSymbol(&raylibSymbols, "key_p", static_cast<long>(KEY_P));
-	MakeSymbol(&raylibSymbols, "key_q", static_cast<long>(KEY_Q));
-	MakeSymbol(&raylibSymbols, "key_r", static_cast<long>(KEY_R));
-	MakeSymbol(&raylibSymbols, "key_s", static_cast<long>(KEY_S));
-	MakeSymbol(&raylibSymbols, "key_t", static_cast<long>(KEY_T));
-	MakeSymbol(&raylibSymbols, "key_u", static_cast<long>(KEY_U));
-	MakeSymbol(&raylibSymbols, "key_v", static_cast<long>(KEY_V));
-	MakeSymbol(&raylibSymbols, "key_w", static_cast<long>(KEY_W));
-	MakeSymbol(&raylibSymbols, "key_x", static_cast<long>(KEY_X));
-	MakeSymbol(&raylibSymbols, "key_y", static_cast<long>(KEY_Y));
-	MakeSymbol(&raylibSymbols, "key_z", static_cast<long>(KEY_Z));
-	MakeSymbol(&raylibSymbols, "mouse_left", static_cast<long>(MOUSE_LEFT_BUTTON));
-	MakeSymbol(&raylibSymbols, "mouse_middle", static_cast<long>(MOUSE_MIDDLE_BUTTON));
-	MakeSymbol(&raylibSymbols, "mouse_right", static_cast<long>(MOUSE_RIGHT_BUTTON));
-#pragma endregion
+	const std::unordered_map<std::string, Chunk>& raylibSymbols = RaylibSymbols();
 #endif
 
+	// functions main cannot reach are left out, but they still have to be defined only once
+	std::set<std::string> live = Reachable(*symbols, chunk);
+	std::set<std::string> defined;
 	for (auto& [file, _symbols] : *symbols)
 	{
 		for (auto& [symbol, _chunk] : _symbols)
 		{
 			if (symbol == "!main") { continue; }
+			uint16_t native;
 #ifndef EXCLUDE_RAYLIB
-			if (locs.find(symbol) != locs.end() || raylibSymbols.find(symbol) != raylibSymbols.end())
+			if (!defined.insert(symbol).second || raylibSymbols.find(symbol) != raylibSymbols.end() || natives.Find(symbol, native))
 #else
-			if (locs.find(symbol) != locs.end())
+			if (!defined.insert(symbol).second || natives.Find(symbol, native))
 #endif
 			{
 				std::cerr << "Function '" << symbol << "' already exists\n";
 				success = false;
 			}
-			else
+			else if (live.count(symbol) > 0)
 			{
-				locs[symbol] = chunk.Size();
-
-				for (size_t i = 0; i < _chunk.Size(); i++)
-				{
-					chunk.Write(_chunk.Read(i), _chunk.ReadLine(i));
-					if (_chunk.GetMeta(i)) { chunk.AddMeta(locs[symbol] + i, *_chunk.GetMeta(i)); }
-				}
+				locs[symbol] = chunk.Append(_chunk, 0, _chunk.Size());
 			}
 		}
 	}
 
-	for (size_t i = 0; i < chunk.Size(); i++)
+	// constants were moved over as the functions were copied, so only names are left. raylib constants and natives
+	// are added to the end as they are first called, which adds to the relocations being walked.
+	for (size_t i = 0; i < chunk.Relocations().size(); i++)
 	{
-		if (chunk.GetMeta(i) && chunk.GetMeta(i)->Get<std::string>())
+		const Relocation relocation = chunk.Relocations()[i];
+		if (relocation.type == Relocation::Type::Constant) { continue; }
+
+		const std::string name = chunk.Symbol(relocation.symbol);
+		uint16_t index;
+		if (relocation.type == Relocation::Type::Global)
 		{
-			const std::string* meta = chunk.GetMeta(i)->Get<std::string>();
-			if (*meta == "!constant")
+			uint16_t slot;
+			if (!globals.Resolve(name, slot))
 			{
-				if (chunk.GetMeta(i + 1))
-				{
-					chunk.ModifyConstant(i + 1, *chunk.GetMeta(i + 1));
-					i++;
-				}
-			}
-			else if (locs.find(*meta) != locs.end())
-			{
-				chunk.ModifyLong(i, locs[*meta] - i - 2);
+				std::cerr << "Too many global variables\n";
+				success = false;
 			}
+			chunk.ModifyLong(relocation.offset, slot);
+		}
+		else if (locs.find(name) != locs.end())
+		{
+			chunk.ModifyLong(relocation.offset, locs[name] - relocation.offset - 2);
+		}
 #ifndef EXCLUDE_RAYLIB
-			else if (raylibSymbols.find(*meta) != raylibSymbols.end())
-			{
-				locs[*meta] = chunk.Size();
-				for (size_t j = 0; j < raylibSymbols[*meta].Size(); j++)
-				{
-					chunk.Write(raylibSymbols[*meta].Read(j), raylibSymbols[*meta].ReadLine(j));
-					if (raylibSymbols[*meta].GetMeta(j)) { chunk.AddMeta(locs[*meta] + j, *raylibSymbols[*meta].GetMeta(j)); }
-				}
-				chunk.ModifyLong(i, locs[*meta] - i - 2);
-			}
+		else if (raylibSymbols.find(name) != raylibSymbols.end())
+		{
+			const Chunk& function = raylibSymbols.at(name);
+			locs[name] = chunk.Append(function, 0, function.Size());
+			chunk.ModifyLong(relocation.offset, locs[name] - relocation.offset - 2);
+		}
 #endif
-			else
-			{
-				std::cerr << "Undefined function '" << *meta << "'\n";
-				success = false;
-			}
+		else if (natives.Find(name, index))
+		{
+			locs[name] = AppendNative(chunk, index, natives.Get(index));
+			chunk.ModifyLong(relocation.offset, locs[name] - relocation.offset - 2);
 		}
+		else
+		{
+			std::cerr << "Undefined function '" << name << "'\n";
+			success = false;
+		}
+	}
+
+	if (success && level != OptimizationLevel::None)
+	{
+		if (level == OptimizationLevel::Full) { Peephole(chunk).Optimize(); }
+		Optimizer(chunk).FuseSuperinstructions();
+		TypeInference(chunk, globals.Size()).Specialize();
 	}
 
 #ifndef NDEBUG
@@ -227,22 +138,227 @@ BuildResult Linker::Link(Chunk& chunk)
 	return success ? BuildResult::Ok : BuildResult::LinkerError;
 }
 
-bool Linker::MakeSymbol(std::map<std::string, Chunk>* symbols, const std::string& name, OpCode opcode)
+// calls to small functions that call nothing themselves are replaced by their bodies. this repeats until nothing
+// changes, so a function whose calls were all inlined can then be inlined too. a recursive function always has a call
+// left in it, so it never is.
+void Linker::Inline(std::map<std::string, std::map<std::string, Chunk>>* symbols)
 {
-	if (symbols->find(name) != symbols->end())
+	bool changed = true;
+	while (changed)
 	{
-		std::cerr << "Symbol '" << name << "' already exists\n";
+		std::map<std::string, const Chunk*> bodies;
+		std::map<std::string, size_t> definitions;
+		for (auto& [file, _symbols] : *symbols)
+		{
+			for (auto& [symbol, _chunk] : _symbols)
+			{
+				if (symbol == "!main") { continue; }
+				definitions[symbol]++;
+				if (Inlinable(symbol, _chunk)) { bodies[symbol] = &_chunk; }
+			}
+		}
+		// a function defined more than once is reported when the symbols are linked
+		for (auto& [symbol, count] : definitions)
+		{
+			if (count > 1) { bodies.erase(symbol); }
+		}
+
+		// the bodies call nothing, so none of them is changed while it is being spliced in
+		changed = false;
+		for (auto& [file, _symbols] : *symbols)
+		{
+			for (auto& [symbol, _chunk] : _symbols)
+			{
+				changed |= InlineCalls(_chunk, bodies);
+			}
+		}
+	}
+}
+
+bool Linker::Inlinable(const std::string& name, const Chunk& chunk) const
+{
+	if (compiler.NotInlined().count(name) > 0) { return false; }
+
+	size_t size = chunk.Size();
+	if (size == 0 || size - 1 > INLINE_MAX || static_cast<OpCode>(chunk.Read(size - 1)) != OpCode::JumpToCallStackAddress)
+	{
+		return false;
+	}
+	for (size_t offset = 0; offset < size; offset += chunk.InstructionSize(offset))
+	{
+		if (Callee(chunk, offset)) { return false; }
+	}
+	return true;
+}
+
+// rebuilds chunk with each call to one of bodies replaced by that body without its return.
+// jumps inside a body are relative and it is copied whole, so only the jumps of chunk itself are moved.
+// a jump to the end of the body lands on the instruction after the call, which is where the return went.
+// the body remembers the call it came from, so a backtrace through it still shows the call.
+bool Linker::InlineCalls(Chunk& chunk, const std::map<std::string, const Chunk*>& bodies)
+{
+	Chunk result;
+	// where each instruction of chunk ended up in result
+	std::vector<size_t> moved(chunk.Size() + 1, 0);
+	// jumps copied from chunk, as (offset in chunk, offset in result)
+	std::vector<std::pair<size_t, size_t>> jumps;
+	bool inlined = false;
+
+	for (size_t offset = 0; offset < chunk.Size();)
+	{
+		moved[offset] = result.Size();
+
+		// a call is PushJumpAddress followed by the jump, a tail call is the jump alone
+		size_t call = offset;
+		if (static_cast<OpCode>(chunk.Read(offset)) == OpCode::PushJumpAddress && offset + 1 < chunk.Size()) { call = offset + 1; }
+		const std::string* callee = Callee(chunk, call);
+		auto body = callee ? bodies.find(*callee) : bodies.end();
+		if (body != bodies.end())
+		{
+			moved[call] = result.Size();
+			const Chunk& code = *body->second;
+			result.AppendInlined(code, 0, code.Size() - 1, chunk.ReadLine(call), *callee);
+			offset = call + 3;
+			inlined = true;
+			continue;
+		}
+
+		if (chunk.JumpOperand(offset) && !Callee(chunk, offset))
+		{
+			jumps.emplace_back(offset, result.Size());
+		}
+		size_t size = chunk.InstructionSize(offset);
+		result.Append(chunk, offset, offset + size);
+		offset += size;
+	}
+	if (!inlined) { return false; }
+	moved[chunk.Size()] = result.Size();
+
+	for (const std::pair<size_t, size_t>& jump : jumps)
+	{
+		size_t end = jump.first + chunk.InstructionSize(jump.first);
+		size_t target = end + static_cast<int16_t>(chunk.ReadLong(chunk.JumpOperand(jump.first)));
+		result.ModifyLong(result.JumpOperand(jump.second), static_cast<uint16_t>(moved[target] - (jump.second + end - jump.first)));
+	}
+	chunk = result;
+	return true;
+}
+
+// every function a call in main leads to, following the calls in those functions in turn.
+std::set<std::string> Linker::Reachable(const std::map<std::string, std::map<std::string, Chunk>>& symbols, const Chunk& main)
+{
+	std::set<std::string> live;
+	std::vector<const Chunk*> work{ &main };
+	while (!work.empty())
+	{
+		const Chunk& chunk = *work.back();
+		work.pop_back();
+		for (size_t offset = 0; offset < chunk.Size(); offset += chunk.InstructionSize(offset))
+		{
+			const std::string* callee = Callee(chunk, offset);
+			if (!callee || !live.insert(*callee).second) { continue; }
+			for (auto& [file, _symbols] : symbols)
+			{
+				auto found = _symbols.find(*callee);
+				if (found != _symbols.end()) { work.push_back(&found->second); }
+			}
+		}
+	}
+	return live;
+}
+
+// the name of the function the jump at offset calls, if it is a call
+const std::string* Linker::Callee(const Chunk& chunk, size_t offset)
+{
+	if (offset >= chunk.Size() || static_cast<OpCode>(chunk.Read(offset)) != OpCode::Jump) { return nullptr; }
+	return chunk.SymbolAt(offset + 1);
+}
+
+bool GlobalSlots::Resolve(const std::string& name, uint16_t& slot)
+{
+	if (slots.find(name) != slots.end())
+	{
+		slot = slots[name];
+		return true;
+	}
+	else if (names.size() >= UINT16_MAX)
+	{
+		slot = 0;
 		return false;
 	}
 	else
 	{
-		(*symbols)[name].Write(opcode, -1);
-		(*symbols)[name].Write(OpCode::JumpToCallStackAddress, -1);
+		slot = static_cast<uint16_t>(names.size());
+		slots[name] = slot;
+		names.push_back(name);
 		return true;
 	}
 }
 
-bool Linker::MakeSymbol(std::map<std::string, Chunk>* symbols, const std::string& name, Value value)
+const std::string& GlobalSlots::Name(uint16_t slot) const
+{
+	return names[slot];
+}
+
+size_t GlobalSlots::Size() const
+{
+	return names.size();
+}
+
+void GlobalSlots::Clear()
+{
+	slots.clear();
+	names.clear();
+}
+
+#ifndef EXCLUDE_RAYLIB
+// the key and mouse button constants raylib provides never change, so the table is made the first time anything is
+// linked and only read after that. its functions are natives the vm binds.
+const std::unordered_map<std::string, Chunk>& Linker::RaylibSymbols()
+{
+	static const std::unordered_map<std::string, Chunk> raylibSymbols = []
+	{
+		std::unordered_map<std::string, Chunk> symbols;
+#pragma region CONSTANTS
+		MakeSymbol(&symbols, "key_a", static_cast<long>(KEY_A));
+		MakeSymbol(&symbols, "key_b", static_cast<long>(KEY_B));
+		MakeSymbol(&symbols, "key_c", static_cast<long>(KEY_C));
+		MakeSymbol(&symbols, "key_d", static_cast<long>(KEY_D));
+		MakeSymbol(&symbols, "key_e", static_cast<long>(KEY_E));
+		MakeSymbol(&symbols, "key_f", static_cast<long>(KEY_F));
+		MakeSymbol(&symbols, "key_g", static_cast<long>(KEY_G));
+		MakeSymbol(&symbols, "key_h", static_cast<long>(KEY_H));
+		MakeSymbol(&symbols, "key_i", static_cast<long>(KEY_I));
+		MakeSymbol(&symbols, "key_j", static_cast<long>(KEY_J));
+		MakeSymbol(&symbols, "key_k", static_cast<long>(KEY_K));
+		MakeSymbol(&symbols, "key_l", static_cast<long>(KEY_L));
+		MakeSymbol(&symbols, "key_m", static_cast<long>(KEY_M));
+		MakeSymbol(&symbols, "key_n", static_cast<long>(KEY_N));
+		MakeSymbol(&symbols, "key_o", static_cast<long>(KEY_O));
+		MakeSymbol(&symbols, "key_p", static_cast<long>(KEY_P));
+		MakeSymbol(&symbols, "key_q", static_cast<long>(KEY_Q));
+		MakeSymbol(&symbols, "key_r", static_cast<long>(KEY_R));
+		MakeSymbol(&symbols, "key_s", static_cast<long>(KEY_S));
+		MakeSymbol(&symbols, "key_t", static_cast<long>(KEY_T));
+		MakeSymbol(&symbols, "key_u", static_cast<long>(KEY_U));
+		MakeSymbol(&symbols, "key_v", static_cast<long>(KEY_V));
+		MakeSymbol(&symbols, "key_w", static_cast<long>(KEY_W));
+		MakeSymbol(&symbols, "key_x", static_cast<long>(KEY_X));
+		MakeSymbol(&symbols, "key_y", static_cast<long>(KEY_Y));
+		MakeSymbol(&symbols, "key_z", static_cast<long>(KEY_Z));
+		MakeSymbol(&symbols, "mouse_left", static_cast<long>(MOUSE_LEFT_BUTTON));
+		MakeSymbol(&symbols, "mouse_middle", static_cast<long>(MOUSE_MIDDLE_BUTTON));
+		MakeSymbol(&symbols, "mouse_right", static_cast<long>(MOUSE_RIGHT_BUTTON));
+#pragma endregion
+
+		return symbols;
+	}();
+
+	return raylibSymbols;
+}
+#endif
+
+bool Linker::MakeSymbol(std::unordered_map<std::string, Chunk>* symbols, const std::string& name, Value value)
 {
 	if (symbols->find(name) != symbols->end())
 	{
@@ -251,12 +367,20 @@ bool Linker::MakeSymbol(std::map<std::string, Chunk>* symbols, const std::string
 	}
 	else
 	{
-		using namespace std::string_literals;
-
 		size_t ret = (*symbols)[name].AddConstant(value, -1, OpCode::Constant, OpCode::ConstantLong);
-		(*symbols)[name].AddMeta(ret, "!constant"s);
-		(*symbols)[name].AddMeta(ret + 1, value);
+		(*symbols)[name].AddRelocation(ret + 1, Relocation::Type::Constant, (*symbols)[name].Read(ret + 1));
 		(*symbols)[name].Write(OpCode::JumpToCallStackAddress, -1);
 		return true;
 	}
+}
+
+// natives are called like functions, through a stub that makes the call and returns
+size_t Linker::AppendNative(Chunk& chunk, uint16_t index, const Native& native)
+{
+	size_t start = chunk.Write(OpCode::CallNative, -1);
+	chunk.WriteLong(index, -1);
+	chunk.Write(static_cast<uint8_t>(native.arguments.size()), -1);
+	chunk.Write(native.results, -1);
+	chunk.Write(OpCode::JumpToCallStackAddress, -1);
+	return start;
 }
\ No newline at end of file
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <map>
+#include <set>
+#include <unordered_map>
 
 #include "chunk.h"
 #include "compiler.h"
+#include "native.h"
 
 enum class BuildResult
 {
@@ -12,18 +15,56 @@ enum class BuildResult
 	LinkerError
 };
 
+// how much the linker optimizes the linked chunk. each level does everything the one before it does.
+// None keeps every call frame, so backtraces show the whole call chain.
+// Basic turns calls in tail position into jumps, inlines small functions, fuses superinstructions and specializes operations on proven types.
+// Full also runs the peephole pass, see Peephole.
+enum class OptimizationLevel
+{
+	None,
+	Basic,
+	Full
+};
+
+// maps global variable names to the dense slots the vm stores them in.
+// slots stay stable across links so the REPL keeps its variables between lines.
+class GlobalSlots
+{
+public:
+	bool Resolve(const std::string& name, uint16_t& slot);
+	const std::string& Name(uint16_t slot) const;
+	size_t Size() const;
+	void Clear();
+
+private:
+	std::map<std::string, uint16_t> slots;
+	std::vector<std::string> names;
+};
+
 class Linker
 {
 public:
 	Linker(const std::string& source);
 	Linker(const std::map<std::string, std::string>& sources);
 
-	BuildResult Link(Chunk& chunk);
+	BuildResult Link(Chunk& chunk, GlobalSlots& globals, const NativeRegistry& natives, OptimizationLevel level = OptimizationLevel::Full);
+
+	// functions with bodies up to this many bytes are inlined where they are called
+	static constexpr size_t INLINE_MAX = 32;
 
 private:
 	Compiler compiler;
 	std::map<std::string, size_t> locs;
 
-	bool MakeSymbol(std::map<std::string, Chunk>* symbols, const std::string& name, OpCode opcode);
-	bool MakeSymbol(std::map<std::string, Chunk>* symbols, const std::string& name, Value value);
+	void Inline(std::map<std::string, std::map<std::string, Chunk>>* symbols);
+	bool Inlinable(const std::string& name, const Chunk& chunk) const;
+	static bool InlineCalls(Chunk& chunk, const std::map<std::string, const Chunk*>& bodies);
+	static std::set<std::string> Reachable(const std::map<std::string, std::map<std::string, Chunk>>& symbols, const Chunk& main);
+	static const std::string* Callee(const Chunk& chunk, size_t offset);
+
+#ifndef EXCLUDE_RAYLIB
+	static const std::unordered_map<std::string, Chunk>& RaylibSymbols();
+#endif
+	static bool MakeSymbol(std::unordered_map<std::string, Chunk>* symbols, const std::string& name, Value value);
+	static size_t AppendNative(Chunk& chunk, uint16_t index, const Native& native);
 };
\ No newline at end of file
@@ -6,10 +6,60 @@
 
 int main(int argc, char** argv)
 {
-	if (argc >= 2)
+	Backend backend = Backend::Stack;
+	int first = 1;
+	if (argc >= 2 && std::string(argv[1]) == "--registers")
+	{
+		backend = Backend::Register;
+		first = 2;
+	}
+	else if (argc >= 2 && std::string(argv[1]) == "--jit")
+	{
+		backend = Backend::Jit;
+		first = 2;
+	}
+	else if (argc >= 2 && std::string(argv[1]) == "--tracing")
+	{
+		backend = Backend::Tracing;
+		first = 2;
+	}
+
+	OptimizationLevel level = OptimizationLevel::Full;
+	if (argc > first && std::string(argv[first]) == "-O0")
+	{
+		level = OptimizationLevel::None;
+		first++;
+	}
+	else if (argc > first && std::string(argv[first]) == "-O1")
+	{
+		level = OptimizationLevel::Basic;
+		first++;
+	}
+	else if (argc > first && std::string(argv[first]) == "-O2")
+	{
+		first++;
+	}
+
+	// --compile saves the linked program as an image instead of running it, --strip leaves the names out of it.
+	// a single file that is an image is run as one.
+	std::string output;
+	bool meta = true;
+	if (argc > first + 1 && std::string(argv[first]) == "--compile")
+	{
+		output = argv[first + 1];
+		first += 2;
+		if (argc > first && std::string(argv[first]) == "--strip")
+		{
+			meta = false;
+			first++;
+		}
+	}
+
+	if (argc > first)
 	{
 		std::map<std::string, std::string> sources;
-		for (size_t i = 1; i < argc; i++)
+		bool image = argc == first + 1 && output.empty() && Image::Probe(argv[first]);
+		for (size_t i = first; i < argc && !image; i++)
 		{
 			std::ifstream file(argv[i]);
 			if (file.good())
@@ -24,11 +74,11 @@ int main(int argc, char** argv)
 				return -1;
 			}
 		}
-		VM* vm = new VM();
+		VM* vm = new VM(backend);
 
 		std::cerr << '\n';
 
-		InterpretResult result = vm->Interpret(sources);
+		InterpretResult result = image ? vm->InterpretImage(argv[first]) : output.empty() ? vm->Interpret(sources, level) : vm->Compile(sources, output, level, meta);
 
 		switch (result)
 		{
@@ -55,7 +105,7 @@ int main(int argc, char** argv)
 	}
 	else
 	{
-		VM* vm = new VM();
+		VM* vm = new VM(backend);
 		for (;;)
 		{
 			std::string line;
@@ -87,7 +137,7 @@ int main(int argc, char** argv)
 
 			if (code.empty()) { break; }
 
-			switch (vm->Interpret(code))
+			switch (vm->Interpret(code, level))
 			{
 			case InterpretResult::Ok:
 				break;
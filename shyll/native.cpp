@@ -0,0 +1,51 @@
+#include <iostream>
+
+#include "native.h"
+
+bool NativeRegistry::Bind(const std::string& name, Native native)
+{
+	if (indices.find(name) != indices.end())
+	{
+		std::cerr << "Native '" << name << "' already exists\n";
+		return false;
+	}
+	if (native.arguments.size() > ARGUMENTS_MAX || native.results > RESULTS_MAX || natives.size() >= UINT16_MAX)
+	{
+		std::cerr << "Native '" << name << "' cannot be bound\n";
+		return false;
+	}
+	indices[name] = static_cast<uint16_t>(natives.size());
+	names.push_back(name);
+	natives.push_back(std::move(native));
+	return true;
+}
+
+bool NativeRegistry::Find(const std::string& name, uint16_t& index) const
+{
+	auto it = indices.find(name);
+	if (it == indices.end()) { return false; }
+	index = it->second;
+	return true;
+}
+
+const Native& NativeRegistry::Get(uint16_t index) const
+{
+	return natives[index];
+}
+
+const std::string& NativeRegistry::Name(uint16_t index) const
+{
+	return names[index];
+}
+
+bool NativeRegistry::Accepts(NativeType type, const Value& value)
+{
+	switch (type)
+	{
+	case NativeType::Bool: return value.Get<bool>().has_value();
+	case NativeType::Long: return value.Get<long>().has_value();
+	case NativeType::Double: return value.Get<double>().has_value();
+	case NativeType::String: return value.Get<std::string>() != nullptr;
+	default: return true;
+	}
+}
\ No newline at end of file
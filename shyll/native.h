@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "value.h"
+
+// what a native function takes an argument as. Any lets every value through.
+enum class NativeType : uint8_t
+{
+	Any,
+	Bool,
+	Long,
+	Double,
+	String
+};
+
+// gets its arguments in the order they were pushed, already checked against the declared types, and writes its
+// results into results in the order they are pushed. false with error set if it fails.
+using NativeFunction = std::function<bool(const Value* arguments, Value* results, std::string& error)>;
+
+struct Native
+{
+	std::vector<NativeType> arguments;
+	uint8_t results;
+	NativeFunction function;
+};
+
+// host functions scripts call by name like their own functions. the linker turns a call to one into a CallNative
+// of its index, so every native is reached through that one opcode instead of an opcode of its own.
+class NativeRegistry
+{
+public:
+	// false if the name is already bound or the native takes or returns too many values
+	bool Bind(const std::string& name, Native native);
+	bool Find(const std::string& name, uint16_t& index) const;
+	const Native& Get(uint16_t index) const;
+	const std::string& Name(uint16_t index) const;
+
+	static bool Accepts(NativeType type, const Value& value);
+
+	static constexpr size_t ARGUMENTS_MAX = UINT8_MAX;
+	static constexpr size_t RESULTS_MAX = 4;
+
+private:
+	std::vector<Native> natives;
+	std::vector<std::string> names;
+	std::unordered_map<std::string, uint16_t> indices;
+};
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include "optimizer.h"
+
+Optimizer::Optimizer(Chunk& chunk) : chunk(chunk)
+{
+}
+
+void Optimizer::FuseSuperinstructions()
+{
+	FindJumpTargets();
+
+	for (size_t offset = 0; offset < chunk.Size();)
+	{
+		size_t span;
+		if ((span = FuseGlobalArithConstant(offset)) ||
+			(span = FuseGlobalsArithStore(offset)) ||
+			(span = FuseCompareGlobalsJumpIfFalse(offset)) ||
+			(span = FuseCompareGlobalConstantJumpIfFalse(offset)))
+		{
+			offset += span;
+		}
+		else
+		{
+			offset += chunk.InstructionSize(offset);
+		}
+	}
+}
+
+void Optimizer::FindJumpTargets()
+{
+	targets.assign(chunk.Size() + 1, false);
+	for (size_t offset = 0; offset < chunk.Size(); offset += chunk.InstructionSize(offset))
+	{
+		if (chunk.JumpOperand(offset))
+		{
+			size_t target = offset + chunk.InstructionSize(offset) + static_cast<int16_t>(chunk.ReadLong(chunk.JumpOperand(offset)));
+			if (target < targets.size()) { targets[target] = true; }
+		}
+		else if (At(offset) == OpCode::PushJumpAddress)
+		{
+			// the call returns to the instruction after the jump that follows this one.
+			if (offset + 4 < targets.size()) { targets[offset + 4] = true; }
+		}
+	}
+}
+
+bool Optimizer::Targeted(size_t start, size_t end) const
+{
+	for (size_t offset = start + 1; offset < end; offset++)
+	{
+		if (targets[offset]) { return true; }
+	}
+	return false;
+}
+
+OpCode Optimizer::At(size_t offset) const
+{
+	return offset < chunk.Size() ? static_cast<OpCode>(chunk.Read(offset)) : OpCode::None;
+}
+
+bool Optimizer::ReadConstantOperand(size_t offset, uint16_t& index, size_t& size) const
+{
+	switch (At(offset))
+	{
+	case OpCode::Constant:
+		index = chunk.Read(offset + 1);
+		size = 2;
+		return true;
+
+	case OpCode::ConstantLong:
+		index = chunk.ReadLong(offset + 1);
+		size = 3;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// LoadGlobal a; Constant k; <arith>; StoreGlobal a
+size_t Optimizer::FuseGlobalArithConstant(size_t offset)
+{
+	uint16_t constant;
+	size_t constantSize;
+	if (At(offset) != OpCode::LoadGlobal || !ReadConstantOperand(offset + 3, constant, constantSize)) { return 0; }
+
+	size_t op = offset + 3 + constantSize;
+	if (!IsArithmetic(At(op)) || At(op + 1) != OpCode::StoreGlobal || chunk.ReadLong(op + 2) != chunk.ReadLong(offset + 1)) { return 0; }
+
+	size_t span = op + 4 - offset;
+	if (Targeted(offset, offset + span)) { return 0; }
+
+	uint16_t slot = chunk.ReadLong(offset + 1);
+	uint8_t arith = chunk.Read(op);
+	chunk.Modify(offset, static_cast<uint8_t>(OpCode::GlobalArithConstant));
+	chunk.Modify(offset + 1, static_cast<uint8_t>(span));
+	chunk.Modify(offset + 2, arith);
+	chunk.ModifyLong(offset + 3, slot);
+	chunk.ModifyLong(offset + 5, constant);
+	return span;
+}
+
+// LoadGlobal a; LoadGlobal b; <arith>; StoreGlobal c
+size_t Optimizer::FuseGlobalsArithStore(size_t offset)
+{
+	if (At(offset) != OpCode::LoadGlobal || At(offset + 3) != OpCode::LoadGlobal || !IsArithmetic(At(offset + 6)) || At(offset + 7) != OpCode::StoreGlobal) { return 0; }
+
+	const size_t span = 10;
+	if (Targeted(offset, offset + span)) { return 0; }
+
+	uint16_t a = chunk.ReadLong(offset + 1);
+	uint16_t b = chunk.ReadLong(offset + 4);
+	uint8_t arith = chunk.Read(offset + 6);
+	uint16_t c = chunk.ReadLong(offset + 8);
+	chunk.Modify(offset, static_cast<uint8_t>(OpCode::GlobalsArithStore));
+	chunk.Modify(offset + 1, static_cast<uint8_t>(span));
+	chunk.Modify(offset + 2, arith);
+	chunk.ModifyLong(offset + 3, a);
+	chunk.ModifyLong(offset + 5, b);
+	chunk.ModifyLong(offset + 7, c);
+	return span;
+}
+
+// LoadGlobal a; LoadGlobal b; <comparison>; JumpIfFalse
+size_t Optimizer::FuseCompareGlobalsJumpIfFalse(size_t offset)
+{
+	if (At(offset) != OpCode::LoadGlobal || At(offset + 3) != OpCode::LoadGlobal || !IsComparison(At(offset + 6)) || At(offset + 7) != OpCode::JumpIfFalse) { return 0; }
+
+	const size_t span = 10;
+	if (Targeted(offset, offset + span)) { return 0; }
+
+	uint16_t a = chunk.ReadLong(offset + 1);
+	uint16_t b = chunk.ReadLong(offset + 4);
+	uint8_t comparison = chunk.Read(offset + 6);
+	uint16_t jump = chunk.ReadLong(offset + 8);
+	chunk.Modify(offset, static_cast<uint8_t>(OpCode::CompareGlobalsJumpIfFalse));
+	chunk.Modify(offset + 1, static_cast<uint8_t>(span));
+	chunk.Modify(offset + 2, comparison);
+	chunk.ModifyLong(offset + 3, a);
+	chunk.ModifyLong(offset + 5, b);
+	chunk.ModifyLong(offset + 7, jump);
+	return span;
+}
+
+// LoadGlobal a; Constant k; <comparison>; JumpIfFalse
+size_t Optimizer::FuseCompareGlobalConstantJumpIfFalse(size_t offset)
+{
+	uint16_t constant;
+	size_t constantSize;
+	if (At(offset) != OpCode::LoadGlobal || !ReadConstantOperand(offset + 3, constant, constantSize)) { return 0; }
+
+	size_t op = offset + 3 + constantSize;
+	if (!IsComparison(At(op)) || At(op + 1) != OpCode::JumpIfFalse) { return 0; }
+
+	size_t span = op + 4 - offset;
+	if (Targeted(offset, offset + span)) { return 0; }
+
+	uint16_t slot = chunk.ReadLong(offset + 1);
+	uint8_t comparison = chunk.Read(op);
+	uint16_t jump = chunk.ReadLong(op + 2);
+	chunk.Modify(offset, static_cast<uint8_t>(OpCode::CompareGlobalConstantJumpIfFalse));
+	chunk.Modify(offset + 1, static_cast<uint8_t>(span));
+	chunk.Modify(offset + 2, comparison);
+	chunk.ModifyLong(offset + 3, slot);
+	chunk.ModifyLong(offset + 5, constant);
+	chunk.ModifyLong(offset + 7, jump);
+	return span;
+}
+
+bool Optimizer::IsArithmetic(OpCode op)
+{
+	return op == OpCode::Add || op == OpCode::Subtract || op == OpCode::Multiply || op == OpCode::Divide;
+}
+
+bool Optimizer::IsComparison(OpCode op)
+{
+	return op == OpCode::LessThan || op == OpCode::LessThanEqual || op == OpCode::GreaterThan || op == OpCode::GreaterThanEqual || op == OpCode::Equal || op == OpCode::NotEqual;
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+#include "chunk.h"
+
+// rewrites common opcode sequences of a linked chunk into superinstructions.
+// a fused instruction is written over the first bytes of the sequence it replaces and records the sequence length,
+// so offsets, jumps and line info stay valid without moving any code.
+class Optimizer
+{
+public:
+	Optimizer(Chunk& chunk);
+
+	void FuseSuperinstructions();
+
+	static bool IsArithmetic(OpCode op);
+	static bool IsComparison(OpCode op);
+
+private:
+	Chunk& chunk;
+	std::vector<bool> targets;
+
+	void FindJumpTargets();
+	bool Targeted(size_t start, size_t end) const;
+
+	OpCode At(size_t offset) const;
+	bool ReadConstantOperand(size_t offset, uint16_t& index, size_t& size) const;
+
+	size_t FuseGlobalArithConstant(size_t offset);
+	size_t FuseGlobalsArithStore(size_t offset);
+	size_t FuseCompareGlobalsJumpIfFalse(size_t offset);
+	size_t FuseCompareGlobalConstantJumpIfFalse(size_t offset);
+};
\ No newline at end of file
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <climits>
+
+#include "peephole.h"
+
+Peephole::Peephole(Chunk& chunk) : chunk(chunk)
+{
+}
+
+void Peephole::Optimize()
+{
+	while (Pass()) { }
+}
+
+bool Peephole::Pass()
+{
+	FindJumpTargets();
+	FindDepths();
+
+	Chunk result;
+	// where each instruction of chunk ended up in result. a removed instruction maps to whatever came after it.
+	std::vector<size_t> moved(chunk.Size() + 1, 0);
+	// jumps written to result, as (offset in result, target in chunk)
+	std::vector<std::pair<size_t, size_t>> jumps;
+	bool changed = false;
+
+	auto constant = [&](const Value& value, int line)
+	{
+		result.AddConstant(value, line, OpCode::Constant, OpCode::ConstantLong);
+	};
+
+	for (size_t offset = 0; offset < chunk.Size();)
+	{
+		moved[offset] = result.Size();
+		OpCode op = At(offset);
+		size_t next = Next(offset);
+		// the rest of a sequence is only folded into its first instruction when nothing jumps into the middle of it
+		bool alone = next < chunk.Size() && !targets[next];
+
+		if (op == OpCode::None)
+		{
+			offset = next;
+			changed = true;
+			continue;
+		}
+
+		Value a;
+		if (ReadConstant(offset, a) && alone)
+		{
+			OpCode second = At(next);
+			size_t after = Next(next);
+			Value b;
+			if (ReadConstant(next, b) && after < chunk.Size() && !targets[after] && IsBinary(At(after)) && Foldable(At(after), a, b))
+			{
+				constant(BinaryOperation(At(after), a, b), chunk.ReadLine(after));
+				moved[next] = moved[after] = moved[offset];
+				offset = Next(after);
+				changed = true;
+				continue;
+			}
+			if (IsUnary(second) && UnaryOperation(second, a).Valid())
+			{
+				constant(UnaryOperation(second, a), chunk.ReadLine(next));
+				moved[next] = moved[offset];
+				offset = after;
+				changed = true;
+				continue;
+			}
+			if (second == OpCode::Pop || (second == OpCode::JumpIfFalse && a.Get<bool>()))
+			{
+				// a false condition always jumps and a true one never does
+				if (second == OpCode::JumpIfFalse && !*a.Get<bool>())
+				{
+					jumps.emplace_back(result.Write(OpCode::Jump, chunk.ReadLine(next)), ThreadJump(next));
+					result.WriteLong(0, chunk.ReadLine(next));
+				}
+				moved[next] = moved[offset];
+				offset = after;
+				changed = true;
+				continue;
+			}
+		}
+
+		// only when there is a value to duplicate, since the duplicate is what reports an empty stack
+		if (op == OpCode::Duplicate && alone && At(next) == OpCode::Pop && depths[offset] >= 1)
+		{
+			moved[next] = moved[offset];
+			offset = Next(next);
+			changed = true;
+			continue;
+		}
+
+		if (chunk.JumpOperand(offset))
+		{
+			size_t target = ThreadJump(offset);
+			changed |= target != JumpTarget(offset);
+			// the jump of a call has to stay right after its PushJumpAddress, which returns past it
+			if (op == OpCode::Jump && target == next && !calls[offset])
+			{
+				offset = next;
+				changed = true;
+				continue;
+			}
+			jumps.emplace_back(result.Size(), target);
+		}
+
+		if (ReadConstant(offset, a))
+		{
+			result.AddConstant(a, chunk.ReadLine(offset), OpCode::Constant, OpCode::ConstantLong);
+			result.CopyRelocations(chunk, offset, next, moved[offset]);
+		}
+		else
+		{
+			result.Append(chunk, offset, next);
+		}
+		offset = next;
+	}
+	moved[chunk.Size()] = result.Size();
+
+	for (const std::pair<size_t, size_t>& jump : jumps)
+	{
+		result.ModifyLong(result.JumpOperand(jump.first), static_cast<uint16_t>(moved[jump.second] - jump.first - result.InstructionSize(jump.first)));
+	}
+	if (changed) { chunk = result; }
+	return changed;
+}
+
+// jump targets and return addresses, which have to stay where an instruction starts, and the jumps of calls.
+void Peephole::FindJumpTargets()
+{
+	targets.assign(chunk.Size() + 1, false);
+	calls.assign(chunk.Size() + 1, false);
+	targets[0] = true;
+	for (size_t offset = 0; offset < chunk.Size(); offset = Next(offset))
+	{
+		if (chunk.JumpOperand(offset))
+		{
+			size_t target = JumpTarget(offset);
+			if (target < targets.size()) { targets[target] = true; }
+		}
+		else if (At(offset) == OpCode::PushJumpAddress)
+		{
+			calls[offset + 1] = true;
+			if (offset + 4 < targets.size()) { targets[offset + 4] = true; }
+		}
+	}
+}
+
+// nothing is known where code can be entered from elsewhere or after a call. past that, an instruction that carries on
+// had at least the values it takes, so what it leaves is known from there.
+void Peephole::FindDepths()
+{
+	depths.assign(chunk.Size() + 1, 0);
+	int32_t known = 0;
+	for (size_t offset = 0; offset < chunk.Size(); offset = Next(offset))
+	{
+		if (targets[offset]) { known = 0; }
+		depths[offset] = known;
+
+		int32_t pops;
+		int32_t pushes;
+		known = StackEffect(GenericOperation(At(offset)), pops, pushes) ? std::max(known, pops) - pops + pushes : 0;
+	}
+}
+
+OpCode Peephole::At(size_t offset) const
+{
+	return offset < chunk.Size() ? static_cast<OpCode>(chunk.Read(offset)) : OpCode::None;
+}
+
+size_t Peephole::Next(size_t offset) const
+{
+	return offset + chunk.InstructionSize(offset);
+}
+
+bool Peephole::ReadConstant(size_t offset, Value& value) const
+{
+	switch (At(offset))
+	{
+	case OpCode::Constant:
+		value = chunk.ReadConstant(chunk.Read(offset + 1));
+		return true;
+
+	case OpCode::ConstantLong:
+		value = chunk.ReadConstant(chunk.ReadLong(offset + 1));
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+size_t Peephole::JumpTarget(size_t offset) const
+{
+	return Next(offset) + static_cast<int16_t>(chunk.ReadLong(chunk.JumpOperand(offset)));
+}
+
+// follows a chain of unconditional jumps from the jump at offset to where it finally lands.
+size_t Peephole::ThreadJump(size_t offset) const
+{
+	static constexpr size_t MAX_HOPS = 16;
+
+	size_t target = JumpTarget(offset);
+	for (size_t hops = 0; hops < MAX_HOPS && target < chunk.Size() && At(target) == OpCode::Jump; hops++)
+	{
+		size_t further = JumpTarget(target);
+		if (further == target) { break; }
+		target = further;
+	}
+	return target;
+}
+
+// the vm traps on these rather than failing with an error, and that has to keep happening when the program runs.
+bool Peephole::Foldable(OpCode op, const Value& a, const Value& b)
+{
+	if (op == OpCode::Divide && a.Get<long>() && b.Get<long>())
+	{
+		long divisor = *b.Get<long>();
+		if (divisor == 0 || (divisor == -1 && *a.Get<long>() == LONG_MIN)) { return false; }
+	}
+	return BinaryOperation(op, a, b).Valid();
+}
+
+bool Peephole::IsBinary(OpCode op)
+{
+	switch (op)
+	{
+	case OpCode::Add:
+	case OpCode::Subtract:
+	case OpCode::Multiply:
+	case OpCode::Divide:
+	case OpCode::Exponent:
+	case OpCode::LessThan:
+	case OpCode::LessThanEqual:
+	case OpCode::GreaterThan:
+	case OpCode::GreaterThanEqual:
+	case OpCode::Equal:
+	case OpCode::NotEqual:
+	case OpCode::LogicalAnd:
+	case OpCode::LogicalOr:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+bool Peephole::IsUnary(OpCode op)
+{
+	switch (op)
+	{
+	case OpCode::AsDouble:
+	case OpCode::AsLong:
+	case OpCode::AsString:
+	case OpCode::Negate:
+	case OpCode::LogicalNot:
+		return true;
+
+	default:
+		return false;
+	}
+}
\ No newline at end of file
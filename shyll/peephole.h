@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+#include "chunk.h"
+
+// simplifies a linked chunk before superinstructions are fused into it.
+// literal expressions are folded into a single constant, pushes that are popped straight away and branches on
+// literal conditions are dropped, jumps to jumps go to the final target and None padding is removed.
+// unlike the superinstruction pass this moves code, so the chunk is rebuilt with every jump, line and meta entry
+// carried over to where its instruction ended up. passes repeat until nothing changes, which folds nested expressions.
+class Peephole
+{
+public:
+	Peephole(Chunk& chunk);
+
+	void Optimize();
+
+private:
+	Chunk& chunk;
+	std::vector<bool> targets;
+	std::vector<bool> calls;
+	// the fewest values the stack can hold when each instruction starts, as far as the straight-line code before it shows
+	std::vector<int32_t> depths;
+
+	bool Pass();
+	void FindJumpTargets();
+	void FindDepths();
+
+	OpCode At(size_t offset) const;
+	size_t Next(size_t offset) const;
+	bool ReadConstant(size_t offset, Value& value) const;
+	size_t JumpTarget(size_t offset) const;
+	size_t ThreadJump(size_t offset) const;
+
+	static bool Foldable(OpCode op, const Value& a, const Value& b);
+	static bool IsBinary(OpCode op);
+	static bool IsUnary(OpCode op);
+};
\ No newline at end of file
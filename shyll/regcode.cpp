@@ -0,0 +1,592 @@
+#include <iomanip>
+#include <iostream>
+
+#include "regcode.h"
+
+void RegisterCode::Translate(const Chunk& chunk)
+{
+	this->chunk = &chunk;
+	code.clear();
+	jumps.clear();
+	reach = 0;
+	entries.assign(chunk.Size() + 1, NO_ENTRY);
+
+	std::vector<bool> leaders;
+	FindLeaders(leaders);
+
+	bool open = false;
+	for (size_t offset = 0; offset < chunk.Size();)
+	{
+		size_t next = offset + chunk.InstructionSize(offset);
+		if (leaders[offset] || !open)
+		{
+			if (open)
+			{
+				// falling into the next block, so the real stack has to match what the block expects.
+				Flush();
+				Emit(RegOp::Sync, OpCode::None, static_cast<uint32_t>(offset)).depth = depth;
+			}
+			entries[offset] = static_cast<uint32_t>(code.size());
+			BeginBlock();
+			open = true;
+		}
+
+		TranslateInstruction(offset, next);
+		switch (static_cast<OpCode>(chunk.Read(offset)))
+		{
+		case OpCode::Jump:
+		case OpCode::JumpIfFalse:
+		case OpCode::JumpToCallStackAddress:
+		case OpCode::Return:
+		case OpCode::CompareGlobalsJumpIfFalse:
+		case OpCode::CompareGlobalConstantJumpIfFalse:
+		case OpCode::ForPrep:
+		case OpCode::ForLoop:
+			open = false;
+			break;
+
+		default:
+			break;
+		}
+
+		offset = next;
+	}
+
+	if (open)
+	{
+		Flush();
+	}
+	// running off the end of the code is an error, same as in the stack vm.
+	entries[chunk.Size()] = static_cast<uint32_t>(code.size());
+	Emit(RegOp::End, OpCode::None, static_cast<uint32_t>(chunk.Size()));
+
+	for (auto& [index, target] : jumps)
+	{
+		code[index].target = target < entries.size() ? entries[target] : entries[chunk.Size()];
+	}
+}
+
+const RegInstruction* RegisterCode::Code() const
+{
+	return code.data();
+}
+
+const RegInstruction* RegisterCode::Entry(size_t offset) const
+{
+	if (offset >= entries.size() || entries[offset] == NO_ENTRY) { return nullptr; }
+	return code.data() + entries[offset];
+}
+
+size_t RegisterCode::Size() const
+{
+	return code.size();
+}
+
+size_t RegisterCode::Reach() const
+{
+	return reach;
+}
+
+void RegisterCode::FindLeaders(std::vector<bool>& leaders) const
+{
+	leaders.assign(chunk->Size() + 1, false);
+	leaders[0] = true;
+	for (size_t offset = 0; offset < chunk->Size(); offset += chunk->InstructionSize(offset))
+	{
+		size_t next = offset + chunk->InstructionSize(offset);
+		size_t target;
+		switch (static_cast<OpCode>(chunk->Read(offset)))
+		{
+		case OpCode::Jump:
+		case OpCode::JumpIfFalse:
+			target = next + static_cast<int16_t>(chunk->ReadLong(offset + 1));
+			if (target < leaders.size()) { leaders[target] = true; }
+			leaders[next] = true;
+			break;
+
+		case OpCode::CompareGlobalsJumpIfFalse:
+		case OpCode::CompareGlobalConstantJumpIfFalse:
+			target = next + static_cast<int16_t>(chunk->ReadLong(offset + 7));
+			if (target < leaders.size()) { leaders[target] = true; }
+			leaders[next] = true;
+			break;
+
+		case OpCode::ForPrep:
+		case OpCode::ForLoop:
+			target = next + static_cast<int16_t>(chunk->ReadLong(offset + 5));
+			if (target < leaders.size()) { leaders[target] = true; }
+			leaders[next] = true;
+			break;
+
+		case OpCode::PushJumpAddress:
+			if (offset + 4 < leaders.size()) { leaders[offset + 4] = true; }
+			break;
+
+		case OpCode::JumpToCallStackAddress:
+		case OpCode::Return:
+			leaders[next] = true;
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+void RegisterCode::TranslateInstruction(size_t offset, size_t next)
+{
+	OpCode op = GenericOperation(static_cast<OpCode>(chunk->Read(offset)));
+	uint32_t ip = static_cast<uint32_t>(next);
+
+	switch (op)
+	{
+	case OpCode::None:
+		break;
+
+	case OpCode::Constant:
+		Push(Constant(chunk->Read(offset + 1)));
+		break;
+
+	case OpCode::ConstantLong:
+		Push(Constant(chunk->ReadLong(offset + 1)));
+		break;
+
+	case OpCode::LoadGlobal:
+		Push(Global(chunk->ReadLong(offset + 1), ip));
+		break;
+
+	case OpCode::StoreGlobal:
+		Store(chunk->ReadLong(offset + 1), ip);
+		break;
+
+	case OpCode::CreateGlobal:
+	case OpCode::DelGlobal:
+		// pending loads must see the variable as it was before this.
+		MaterializeGlobals(0);
+		Emit(op == OpCode::CreateGlobal ? RegOp::CreateGlobal : RegOp::DelGlobal, op, ip).a = Global(chunk->ReadLong(offset + 1), ip);
+		break;
+
+	case OpCode::Duplicate:
+		if (!operands.empty() && operands.back().kind != Operand::Kind::Register)
+		{
+			Push(operands.back());
+		}
+		else
+		{
+			RegInstruction& instruction = Emit(RegOp::Move, op, ip);
+			instruction.a = Peek(instruction);
+			instruction.dst = Result();
+		}
+		break;
+
+	case OpCode::Pop:
+		if (!operands.empty() && operands.back().kind == Operand::Kind::Constant)
+		{
+			operands.pop_back();
+			depth--;
+		}
+		else if (!operands.empty() && operands.back().kind == Operand::Kind::Register)
+		{
+			operands.pop_back();
+			depth--;
+			lastResult = SIZE_MAX;
+		}
+		else
+		{
+			// a discarded load still fails on an undeclared variable, and popping an empty stack still fails.
+			MaterializeGlobals(1);
+			RegInstruction& instruction = Emit(RegOp::Check, op, ip);
+			instruction.a = Pop(instruction);
+		}
+		break;
+
+	case OpCode::AsDouble:
+	case OpCode::AsLong:
+	case OpCode::AsString:
+	case OpCode::Negate:
+	case OpCode::LogicalNot:
+	{
+		MaterializeGlobals(1);
+		RegInstruction& instruction = Emit(RegOp::Unary, op, ip);
+		instruction.a = Pop(instruction);
+		instruction.dst = Result();
+		break;
+	}
+
+	case OpCode::Add:
+	case OpCode::Subtract:
+	case OpCode::Multiply:
+	case OpCode::Divide:
+	case OpCode::Exponent:
+	case OpCode::LessThan:
+	case OpCode::LessThanEqual:
+	case OpCode::GreaterThan:
+	case OpCode::GreaterThanEqual:
+	case OpCode::Equal:
+	case OpCode::NotEqual:
+	case OpCode::LogicalAnd:
+	case OpCode::LogicalOr:
+	{
+		MaterializeGlobals(2);
+		RegInstruction& instruction = Emit(RegOp::Binary, op, ip);
+		instruction.b = Pop(instruction);
+		instruction.a = Pop(instruction);
+		instruction.dst = Result();
+		break;
+	}
+
+	case OpCode::Print:
+	case OpCode::PrintLn:
+	{
+		MaterializeGlobals(1);
+		RegInstruction& instruction = Emit(op == OpCode::Print ? RegOp::Print : RegOp::PrintLn, op, ip);
+		instruction.a = Pop(instruction);
+		break;
+	}
+
+	case OpCode::Trace:
+	{
+		MaterializeGlobals(1);
+		RegInstruction& instruction = Emit(RegOp::Trace, op, ip);
+		instruction.a = Peek(instruction);
+		break;
+	}
+
+	case OpCode::ShowTraceLog:
+	case OpCode::ClearTraceLog:
+		MaterializeGlobals(0);
+		Emit(op == OpCode::ShowTraceLog ? RegOp::ShowTraceLog : RegOp::ClearTraceLog, op, ip);
+		break;
+
+	case OpCode::Jump:
+		Flush();
+		EmitJump(RegOp::Jump, op, ip, next + static_cast<int16_t>(chunk->ReadLong(offset + 1)));
+		break;
+
+	case OpCode::JumpIfFalse:
+	{
+		MaterializeGlobals(1);
+		// the condition is taken off first so flushing the rest of the block cannot overwrite it.
+		RegInstruction branch{ };
+		branch.a = Pop(branch);
+		Flush();
+		EmitJump(RegOp::JumpIfFalse, op, ip, next + static_cast<int16_t>(chunk->ReadLong(offset + 1)));
+		code.back().a = branch.a;
+		code.back().need = branch.need;
+		break;
+	}
+
+	case OpCode::PushJumpAddress:
+		// the frame shows up in error messages, so pending loads have to fail before it is pushed.
+		MaterializeGlobals(0);
+		Emit(RegOp::PushJumpAddress, op, ip).target = static_cast<uint32_t>(offset + 4);
+		break;
+
+	case OpCode::JumpToCallStackAddress:
+		Flush();
+		Emit(RegOp::JumpToCallStackAddress, op, ip).depth = depth;
+		break;
+
+	case OpCode::Return:
+		Flush();
+		Emit(RegOp::Return, op, ip);
+		break;
+
+	case OpCode::GlobalArithConstant:
+	{
+		uint8_t span = chunk->Read(offset + 1);
+		uint16_t slot = chunk->ReadLong(offset + 3);
+		MaterializeGlobals(0);
+		RegInstruction& instruction = Emit(RegOp::Binary, GenericOperation(static_cast<OpCode>(chunk->Read(offset + 2))), static_cast<uint32_t>(offset + span - 3));
+		instruction.a = Global(slot, static_cast<uint32_t>(offset + 3));
+		instruction.b = Constant(chunk->ReadLong(offset + 5));
+		instruction.dst = Global(slot, ip);
+		instruction.storeIp = ip;
+		break;
+	}
+
+	case OpCode::GlobalsArithStore:
+	{
+		MaterializeGlobals(0);
+		RegInstruction& instruction = Emit(RegOp::Binary, GenericOperation(static_cast<OpCode>(chunk->Read(offset + 2))), static_cast<uint32_t>(offset + 7));
+		instruction.a = Global(chunk->ReadLong(offset + 3), static_cast<uint32_t>(offset + 3));
+		instruction.b = Global(chunk->ReadLong(offset + 5), static_cast<uint32_t>(offset + 6));
+		instruction.dst = Global(chunk->ReadLong(offset + 7), ip);
+		instruction.storeIp = ip;
+		break;
+	}
+
+	case OpCode::CompareGlobalsJumpIfFalse:
+	{
+		Flush();
+		EmitJump(RegOp::BinaryJumpIfFalse, GenericOperation(static_cast<OpCode>(chunk->Read(offset + 2))), static_cast<uint32_t>(offset + 7),
+			next + static_cast<int16_t>(chunk->ReadLong(offset + 7)));
+		code.back().a = Global(chunk->ReadLong(offset + 3), static_cast<uint32_t>(offset + 3));
+		code.back().b = Global(chunk->ReadLong(offset + 5), static_cast<uint32_t>(offset + 6));
+		break;
+	}
+
+	case OpCode::CompareGlobalConstantJumpIfFalse:
+	{
+		uint8_t span = chunk->Read(offset + 1);
+		Flush();
+		EmitJump(RegOp::BinaryJumpIfFalse, GenericOperation(static_cast<OpCode>(chunk->Read(offset + 2))), static_cast<uint32_t>(offset + span - 3),
+			next + static_cast<int16_t>(chunk->ReadLong(offset + 7)));
+		code.back().a = Global(chunk->ReadLong(offset + 3), static_cast<uint32_t>(offset + 3));
+		code.back().b = Constant(chunk->ReadLong(offset + 5));
+		break;
+	}
+
+	case OpCode::ForPrep:
+	{
+		// stored like the start and then the limit, and tested like a loop head comparing the two
+		uint16_t counter = chunk->ReadLong(offset + 1);
+		uint16_t limit = chunk->ReadLong(offset + 3);
+		Store(counter, ip);
+		Store(limit, ip);
+		Flush();
+		EmitJump(RegOp::BinaryJumpIfFalse, OpCode::GreaterThan, ip, next + static_cast<int16_t>(chunk->ReadLong(offset + 5)));
+		code.back().a = Global(limit, ip);
+		code.back().b = Global(counter, ip);
+		break;
+	}
+
+	case OpCode::ForLoop:
+		Flush();
+		EmitJump(RegOp::ForLoop, op, ip, next + static_cast<int16_t>(chunk->ReadLong(offset + 5)));
+		code.back().a = Global(chunk->ReadLong(offset + 1), ip);
+		code.back().b = Global(chunk->ReadLong(offset + 3), ip);
+		break;
+
+	default:
+		// everything else works on the real stack, so bring it up to date and start over from the new stack top.
+		Flush();
+		Emit(RegOp::Native, op, ip).depth = depth;
+		if (op == OpCode::CallNative) { code.back().target = chunk->ReadLong(offset + 1); }
+		BeginBlock();
+		break;
+	}
+}
+
+void RegisterCode::BeginBlock()
+{
+	operands.clear();
+	depth = 0;
+	checked = 0;
+	lastResult = SIZE_MAX;
+}
+
+RegInstruction& RegisterCode::Emit(RegOp op, OpCode source, uint32_t ip)
+{
+	RegInstruction instruction{ };
+	instruction.op = op;
+	instruction.source = source;
+	instruction.ip = ip;
+	instruction.storeIp = ip;
+	code.push_back(instruction);
+	return code.back();
+}
+
+void RegisterCode::EmitJump(RegOp op, OpCode source, uint32_t ip, size_t target)
+{
+	jumps.emplace_back(code.size(), target);
+	Emit(op, source, ip).depth = depth;
+}
+
+void RegisterCode::Store(uint16_t slot, uint32_t ip)
+{
+	MaterializeGlobals(1);
+	Operand global = Global(slot, ip);
+	if (!operands.empty() && operands.back().kind == Operand::Kind::Register && lastResult == code.size() - 1 &&
+		code.back().dst.index == operands.back().index)
+	{
+		// the value was computed by the previous instruction, so write it straight into the global.
+		code.back().dst = global;
+		code.back().storeIp = ip;
+		operands.pop_back();
+		depth--;
+	}
+	else
+	{
+		RegInstruction& instruction = Emit(RegOp::Move, OpCode::StoreGlobal, ip);
+		instruction.a = Pop(instruction);
+		instruction.dst = global;
+	}
+}
+
+void RegisterCode::Push(const Operand& operand)
+{
+	operands.push_back(operand);
+	depth++;
+	if (depth > reach) { reach = depth; }
+}
+
+Operand RegisterCode::Pop(RegInstruction& instruction)
+{
+	Operand operand = Peek(instruction);
+	if (!operands.empty()) { operands.pop_back(); }
+	depth--;
+	return operand;
+}
+
+Operand RegisterCode::Peek(RegInstruction& instruction)
+{
+	if (!operands.empty()) { return operands.back(); }
+
+	// the value was on the stack before this block started, so it might not exist.
+	if (depth - 1 < checked)
+	{
+		checked = depth - 1;
+		instruction.need = checked;
+	}
+	return Register(depth - 1);
+}
+
+Operand RegisterCode::Result()
+{
+	Operand result = Register(depth);
+	Push(result);
+	lastResult = code.size() - 1;
+	return result;
+}
+
+void RegisterCode::MaterializeGlobals(size_t keep)
+{
+	// loads that are still pending are done in order before anything that can fail or has side effects,
+	// so an undeclared variable is reported at its own load.
+	for (size_t i = 0; i + keep < operands.size(); i++)
+	{
+		if (operands[i].kind == Operand::Kind::Global)
+		{
+			Operand dst = Register(depth - static_cast<int32_t>(operands.size() - i));
+			RegInstruction& instruction = Emit(RegOp::Move, OpCode::LoadGlobal, operands[i].ip);
+			instruction.a = operands[i];
+			instruction.dst = dst;
+			operands[i] = dst;
+		}
+	}
+}
+
+void RegisterCode::Flush()
+{
+	MaterializeGlobals(0);
+	for (size_t i = 0; i < operands.size(); i++)
+	{
+		if (operands[i].kind == Operand::Kind::Constant)
+		{
+			Operand dst = Register(depth - static_cast<int32_t>(operands.size() - i));
+			RegInstruction& instruction = Emit(RegOp::Move, OpCode::Constant, 0);
+			instruction.a = operands[i];
+			instruction.dst = dst;
+			operands[i] = dst;
+		}
+	}
+}
+
+Operand RegisterCode::Register(int32_t index)
+{
+	return Operand{ Operand::Kind::Register, index, 0 };
+}
+
+Operand RegisterCode::Constant(uint16_t index)
+{
+	return Operand{ Operand::Kind::Constant, index, 0 };
+}
+
+Operand RegisterCode::Global(uint16_t slot, uint32_t ip)
+{
+	return Operand{ Operand::Kind::Global, slot, ip };
+}
+
+void RegisterCode::Disassemble() const
+{
+	static const char* names[] =
+	{
+		"MOVE", "UNARY", "BINARY", "BINARY_JUMP_IF_FALSE", "FOR_LOOP", "CHECK", "PRINT", "PRINTLN", "TRACE", "SHOW_TRACE_LOG", "CLEAR_TRACE_LOG",
+		"CREATE_GLOBAL", "DEL_GLOBAL", "SYNC", "JUMP", "JUMP_IF_FALSE", "PUSH_JUMP_ADDRESS", "JUMP_TO_CALL_STACK_ADDRESS", "NATIVE", "RETURN", "END"
+	};
+
+	std::cerr << "== registers ==\n";
+	for (size_t i = 0; i < code.size(); i++)
+	{
+		const RegInstruction& instruction = code[i];
+		std::cerr << std::setfill('0') << std::setw(4) << std::right << i << ' ' << std::setfill(' ') << std::setw(4) << chunk->ReadLine(instruction.ip > 0 ? instruction.ip - 1 : 0) << ' '
+			<< std::setw(26) << std::left << names[static_cast<uint8_t>(instruction.op)];
+
+		switch (instruction.op)
+		{
+		case RegOp::Unary:
+		case RegOp::Binary:
+		case RegOp::BinaryJumpIfFalse:
+			std::cerr << ' ' << OperationName(instruction.source);
+			break;
+
+		default:
+			break;
+		}
+
+		if (instruction.dst.kind != Operand::Kind::None)
+		{
+			DisassembleOperand(instruction.dst);
+			std::cerr << " <-";
+		}
+		if (instruction.a.kind != Operand::Kind::None) { DisassembleOperand(instruction.a); }
+		if (instruction.b.kind != Operand::Kind::None) { DisassembleOperand(instruction.b); }
+
+		switch (instruction.op)
+		{
+		case RegOp::BinaryJumpIfFalse:
+		case RegOp::ForLoop:
+		case RegOp::Jump:
+		case RegOp::JumpIfFalse:
+			std::cerr << " -> " << std::setfill('0') << std::setw(4) << std::right << instruction.target;
+			break;
+
+		case RegOp::PushJumpAddress:
+			std::cerr << " return " << std::setfill('0') << std::setw(4) << std::right << instruction.target;
+			break;
+
+		default:
+			break;
+		}
+
+		switch (instruction.op)
+		{
+		case RegOp::Sync:
+		case RegOp::Jump:
+		case RegOp::JumpIfFalse:
+		case RegOp::BinaryJumpIfFalse:
+		case RegOp::ForLoop:
+		case RegOp::JumpToCallStackAddress:
+		case RegOp::Native:
+			std::cerr << " depth " << instruction.depth;
+			break;
+
+		default:
+			break;
+		}
+		if (instruction.need < 0) { std::cerr << " needs " << -instruction.need; }
+		std::cerr << '\n';
+	}
+}
+
+void RegisterCode::DisassembleOperand(const Operand& operand)
+{
+	switch (operand.kind)
+	{
+	case Operand::Kind::Register:
+		std::cerr << " r" << operand.index;
+		break;
+
+	case Operand::Kind::Constant:
+		std::cerr << " k" << operand.index;
+		break;
+
+	case Operand::Kind::Global:
+		std::cerr << " g" << operand.index;
+		break;
+
+	default:
+		break;
+	}
+}
\ No newline at end of file
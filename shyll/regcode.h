@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "chunk.h"
+
+enum class RegOp : uint8_t
+{
+	Move,
+	Unary,
+	Binary,
+	BinaryJumpIfFalse,
+	ForLoop,
+	Check,
+	Print,
+	PrintLn,
+	Trace,
+	ShowTraceLog,
+	ClearTraceLog,
+	CreateGlobal,
+	DelGlobal,
+	Sync,
+	Jump,
+	JumpIfFalse,
+	PushJumpAddress,
+	JumpToCallStackAddress,
+	Native,
+	Return,
+	End
+};
+
+struct Operand
+{
+	enum class Kind : uint8_t
+	{
+		None,
+		Register,
+		Constant,
+		Global
+	};
+
+	Kind kind;
+	// registers are stack slots counted from the stack top at block entry, so they can be negative.
+	int32_t index;
+	// for globals, the offset just past the load that produced the operand. a failed read reports this line.
+	uint32_t ip;
+};
+
+struct RegInstruction
+{
+	RegOp op;
+	// the stack opcode this was translated from. Unary and Binary evaluate it.
+	OpCode source;
+	Operand dst;
+	Operand a;
+	Operand b;
+	// lowest register read from below the block entry that has not been checked yet, 0 if none.
+	int32_t need;
+	// stack depth relative to the block entry, for instructions that bring the real stack top up to date.
+	int32_t depth;
+	// instruction index for jumps, stack offset for PushJumpAddress, native index for a CallNative.
+	uint32_t target;
+	// offset just past the source instruction, and just past the store when a result is written into a global.
+	uint32_t ip;
+	uint32_t storeIp;
+};
+
+// three-address code translated from a linked stack chunk.
+// each basic block simulates the operand stack at translation time, so stack positions become registers
+// and constants and globals are read where they live instead of being pushed first.
+// the real stack top is only brought up to date where a block ends, which keeps call frames and errors unchanged.
+class RegisterCode
+{
+public:
+	void Translate(const Chunk& chunk);
+
+	const RegInstruction* Code() const;
+	// the instruction a block starting at this stack offset begins with. return addresses always start a block.
+	const RegInstruction* Entry(size_t offset) const;
+	size_t Size() const;
+	// the most registers any block uses above the stack top it started with
+	size_t Reach() const;
+
+	void Disassemble() const;
+
+	static constexpr uint32_t NO_ENTRY = UINT32_MAX;
+
+private:
+	const Chunk* chunk;
+	std::vector<RegInstruction> code;
+	std::vector<uint32_t> entries;
+	std::vector<std::pair<size_t, size_t>> jumps;
+	int32_t reach;
+
+	// translation state of the current block
+	std::vector<Operand> operands;
+	int32_t depth;
+	int32_t checked;
+	size_t lastResult;
+
+	void FindLeaders(std::vector<bool>& leaders) const;
+	void TranslateInstruction(size_t offset, size_t next);
+	void BeginBlock();
+
+	RegInstruction& Emit(RegOp op, OpCode source, uint32_t ip);
+	void EmitJump(RegOp op, OpCode source, uint32_t ip, size_t target);
+	void Store(uint16_t slot, uint32_t ip);
+	void Push(const Operand& operand);
+	Operand Pop(RegInstruction& instruction);
+	Operand Peek(RegInstruction& instruction);
+	Operand Result();
+
+	void MaterializeGlobals(size_t keep);
+	void Flush();
+
+	static Operand Register(int32_t index);
+	static Operand Constant(uint16_t index);
+	static Operand Global(uint16_t slot, uint32_t ip);
+	static void DisassembleOperand(const Operand& operand);
+};
\ No newline at end of file
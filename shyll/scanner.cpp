@@ -59,6 +59,8 @@ Token Scanner::ScanToken()
 		break;
 
 	case ':':
+		// '::' starts a function that is never inlined
+		Match(':');
 		return MakeToken(Token::Type::FunctionHeader);
 
 	case '@':
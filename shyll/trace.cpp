@@ -0,0 +1,1006 @@
+#include "trace.h"
+#include "assembler.h"
+#include "vm.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+	Value Box(Tracer::Type type, uint64_t bits)
+	{
+		switch (type)
+		{
+		case Tracer::Type::Long:
+			return Value(static_cast<long>(static_cast<int64_t>(bits)));
+
+		case Tracer::Type::Double:
+		{
+			double val;
+			std::memcpy(&val, &bits, sizeof(double));
+			return Value(val);
+		}
+
+		default:
+			return Value(bits != 0);
+		}
+	}
+
+	uint64_t Unbox(Tracer::Type type, const Value& value)
+	{
+		switch (type)
+		{
+		case Tracer::Type::Long:
+			return static_cast<uint64_t>(static_cast<int64_t>(*value.Get<long>()));
+
+		case Tracer::Type::Double:
+		{
+			double val = value.UncheckedDouble();
+			uint64_t bits;
+			std::memcpy(&bits, &val, sizeof(double));
+			return bits;
+		}
+
+		default:
+			return *value.Get<bool>() ? 1 : 0;
+		}
+	}
+}
+
+#ifdef JIT_SUPPORTED
+namespace
+{
+	// slots holds the variables followed by whatever an exit leaves on the stack.
+	// rax, rcx and rdx are scratch, as are xmm0 and xmm1. everything else holds variables and temporaries.
+	constexpr Reg SLOTS = RBP;
+	constexpr Reg GPRS[] = { RBX, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+	constexpr Reg SAVED[] = { RBX, RBP, RSI, RDI, R12, R13, R14, R15 };
+#ifdef _WIN32
+	// xmm6 and up belong to the caller on windows
+	constexpr uint8_t LAST_XMM = 5;
+#else
+	constexpr uint8_t LAST_XMM = 15;
+#endif
+
+	class TraceCompiler
+	{
+	public:
+		Assembler a;
+
+		TraceCompiler(const Chunk& chunk, Tracer::Trace& trace) : chunk(chunk), trace(trace), failed(false), current(0), fused(false)
+		{
+		}
+
+		bool Compile(const std::vector<Tracer::Recorded>& recorded);
+
+	private:
+		enum class Kind : uint8_t
+		{
+			Temp,
+			Variable,
+			Constant
+		};
+
+		// a value on the simulated stack. temps own the register in index, variables name their variable there.
+		struct Entry
+		{
+			Kind kind;
+			Tracer::Type type;
+			int index;
+			uint64_t bits;
+		};
+
+		struct PendingExit
+		{
+			size_t label;
+			std::vector<Entry> stack;
+		};
+
+		const Chunk& chunk;
+		Tracer::Trace& trace;
+		std::vector<Entry> stack;
+		std::vector<int> registers;
+		std::vector<Reg> freeGprs;
+		std::vector<uint8_t> freeXmms;
+		std::vector<PendingExit> exits;
+		bool failed;
+		// the instruction being compiled, which a failed check inside it restarts from
+		size_t current;
+		bool fused;
+
+		bool CompileInstruction(const Tracer::Recorded& instruction);
+
+		bool PushConstant(const Value& value);
+		bool PushVariable(uint16_t slot);
+		bool Store(uint16_t slot);
+		bool Duplicate();
+		bool Binary(OpCode op);
+		bool Unary(OpCode op);
+		bool Guard(size_t recordedNext, size_t fallthrough, size_t target);
+		size_t NewExit(size_t ip, const std::vector<Entry>& snapshot);
+
+		bool LongBinary(OpCode op, const Entry& lhs, const Entry& rhs);
+		bool DoubleBinary(OpCode op, const Entry& lhs, const Entry& rhs);
+		bool BoolBinary(OpCode op, const Entry& lhs, const Entry& rhs);
+		void PushFlag(Condition condition, const Entry& lhs, const Entry& rhs);
+
+		static bool IsXmm(Tracer::Type type);
+		int Allocate(Tracer::Type type);
+		void Free(const Entry& entry);
+		int VariableIndex(uint16_t slot) const;
+		int RegisterOf(const Entry& entry) const;
+		Reg Gpr(const Entry& entry, Reg scratch);
+		uint8_t Xmm(const Entry& entry, uint8_t scratch);
+		Reg TakeGpr(const Entry& entry);
+		uint8_t TakeXmm(const Entry& entry);
+		void Move(Tracer::Type type, int dst, const Entry& entry);
+		void StoreSlot(size_t slot, const Entry& entry);
+		void WrapLong(Reg reg);
+		Entry Pop();
+	};
+
+	bool TraceCompiler::Compile(const std::vector<Tracer::Recorded>& recorded)
+	{
+		freeGprs.assign(std::begin(GPRS), std::end(GPRS));
+		for (uint8_t xmm = 2; xmm <= LAST_XMM; xmm++)
+		{
+			freeXmms.push_back(xmm);
+		}
+		for (const Tracer::Variable& variable : trace.variables)
+		{
+			registers.push_back(Allocate(variable.type));
+		}
+		if (failed) { return false; }
+
+		// uint32_t trace(uint64_t* slots)
+		for (Reg reg : SAVED)
+		{
+			a.Push(reg);
+		}
+		a.Mov(SLOTS, ARG0);
+		for (size_t i = 0; i < trace.variables.size(); i++)
+		{
+			if (IsXmm(trace.variables[i].type))
+			{
+				a.Load(RAX, SLOTS, static_cast<int32_t>(i * sizeof(uint64_t)));
+				a.MovToXmm(static_cast<uint8_t>(registers[i]), RAX);
+			}
+			else
+			{
+				a.Load(static_cast<Reg>(registers[i]), SLOTS, static_cast<int32_t>(i * sizeof(uint64_t)));
+			}
+		}
+
+		size_t loop = a.NewLabel();
+		a.Bind(loop);
+		for (const Tracer::Recorded& instruction : recorded)
+		{
+			if (!CompileInstruction(instruction) || failed) { return false; }
+		}
+		// the recording ends back at the header, so the stack has to be where it started for the trace to loop
+		if (!stack.empty()) { return false; }
+		a.Jump(loop);
+
+		size_t depth = 0;
+		for (size_t i = 0; i < exits.size(); i++)
+		{
+			a.Bind(exits[i].label);
+			for (size_t j = 0; j < trace.variables.size(); j++)
+			{
+				if (trace.variables[j].written)
+				{
+					StoreSlot(j, Entry{ Kind::Variable, trace.variables[j].type, static_cast<int>(j), 0 });
+				}
+			}
+			for (size_t j = 0; j < exits[i].stack.size(); j++)
+			{
+				StoreSlot(trace.variables.size() + j, exits[i].stack[j]);
+			}
+			depth = std::max(depth, exits[i].stack.size());
+
+			a.MovImm32(RAX, static_cast<uint32_t>(i));
+			for (size_t j = std::size(SAVED); j > 0; j--)
+			{
+				a.Pop(SAVED[j - 1]);
+			}
+			a.Ret();
+		}
+		trace.slots = trace.variables.size() + depth;
+
+		return !failed;
+	}
+
+	bool TraceCompiler::CompileInstruction(const Tracer::Recorded& instruction)
+	{
+		size_t offset = instruction.offset;
+		size_t next = offset + chunk.InstructionSize(offset);
+		OpCode op = GenericOperation(static_cast<OpCode>(chunk.Read(offset)));
+		current = offset;
+		fused = op == OpCode::GlobalArithConstant || op == OpCode::GlobalsArithStore
+			|| op == OpCode::CompareGlobalsJumpIfFalse || op == OpCode::CompareGlobalConstantJumpIfFalse || op == OpCode::ForLoop;
+
+		switch (op)
+		{
+		case OpCode::None:
+		case OpCode::Jump:
+			// forward jumps are followed by the recording, and the backward one closes the loop
+			return true;
+
+		case OpCode::Constant:
+			return PushConstant(chunk.ReadConstant(chunk.Read(offset + 1)));
+
+		case OpCode::ConstantLong:
+			return PushConstant(chunk.ReadConstant(chunk.ReadLong(offset + 1)));
+
+		case OpCode::LoadGlobal:
+			return PushVariable(chunk.ReadLong(offset + 1));
+
+		case OpCode::StoreGlobal:
+			return Store(chunk.ReadLong(offset + 1));
+
+		case OpCode::Pop:
+			if (stack.empty()) { return false; }
+			Free(Pop());
+			return true;
+
+		case OpCode::Duplicate:
+			return Duplicate();
+
+		case OpCode::Negate:
+		case OpCode::LogicalNot:
+			return Unary(op);
+
+		case OpCode::JumpIfFalse:
+			return Guard(instruction.next, next, next + static_cast<int16_t>(chunk.ReadLong(offset + 1)));
+
+		case OpCode::GlobalArithConstant:
+			return PushVariable(chunk.ReadLong(offset + 3))
+				&& PushConstant(chunk.ReadConstant(chunk.ReadLong(offset + 5)))
+				&& Binary(GenericOperation(static_cast<OpCode>(chunk.Read(offset + 2))))
+				&& Store(chunk.ReadLong(offset + 3));
+
+		case OpCode::GlobalsArithStore:
+			return PushVariable(chunk.ReadLong(offset + 3))
+				&& PushVariable(chunk.ReadLong(offset + 5))
+				&& Binary(GenericOperation(static_cast<OpCode>(chunk.Read(offset + 2))))
+				&& Store(chunk.ReadLong(offset + 7));
+
+		case OpCode::CompareGlobalsJumpIfFalse:
+			return PushVariable(chunk.ReadLong(offset + 3))
+				&& PushVariable(chunk.ReadLong(offset + 5))
+				&& Binary(GenericOperation(static_cast<OpCode>(chunk.Read(offset + 2))))
+				&& Guard(instruction.next, next, next + static_cast<int16_t>(chunk.ReadLong(offset + 7)));
+
+		case OpCode::CompareGlobalConstantJumpIfFalse:
+			return PushVariable(chunk.ReadLong(offset + 3))
+				&& PushConstant(chunk.ReadConstant(chunk.ReadLong(offset + 5)))
+				&& Binary(GenericOperation(static_cast<OpCode>(chunk.Read(offset + 2))))
+				&& Guard(instruction.next, next, next + static_cast<int16_t>(chunk.ReadLong(offset + 7)));
+
+		case OpCode::ForLoop:
+		{
+			// the loop repeats on a true test, so for the guard the jump back is the fall through
+			uint16_t counter = chunk.ReadLong(offset + 1);
+			return PushVariable(counter)
+				&& PushConstant(Value(1L))
+				&& Binary(OpCode::Add)
+				&& Store(counter)
+				&& PushVariable(chunk.ReadLong(offset + 3))
+				&& PushVariable(counter)
+				&& Binary(OpCode::GreaterThan)
+				&& Guard(instruction.next, next + static_cast<int16_t>(chunk.ReadLong(offset + 5)), next);
+		}
+
+		default:
+			return Binary(op);
+		}
+	}
+
+	bool TraceCompiler::PushConstant(const Value& value)
+	{
+		Tracer::Type type;
+		if (value.IsDouble()) { type = Tracer::Type::Double; }
+		else if (value.Get<long>()) { type = Tracer::Type::Long; }
+		else if (value.Get<bool>()) { type = Tracer::Type::Bool; }
+		else { return false; }
+
+		stack.push_back(Entry{ Kind::Constant, type, 0, Unbox(type, value) });
+		return true;
+	}
+
+	bool TraceCompiler::PushVariable(uint16_t slot)
+	{
+		int index = VariableIndex(slot);
+		if (index < 0) { return false; }
+		stack.push_back(Entry{ Kind::Variable, trace.variables[index].type, index, 0 });
+		return true;
+	}
+
+	bool TraceCompiler::Store(uint16_t slot)
+	{
+		int index = VariableIndex(slot);
+		if (stack.empty() || index < 0) { return false; }
+		Entry value = Pop();
+		Tracer::Variable& variable = trace.variables[index];
+		if (value.type != variable.type) { return false; }
+
+		// anything still on the stack that was loaded from this variable keeps the value it had then
+		for (Entry& entry : stack)
+		{
+			if (entry.kind == Kind::Variable && entry.index == index)
+			{
+				int copy = Allocate(entry.type);
+				Move(entry.type, copy, entry);
+				entry = Entry{ Kind::Temp, entry.type, copy, 0 };
+			}
+		}
+
+		Move(variable.type, registers[index], value);
+		Free(value);
+		variable.written = true;
+		return true;
+	}
+
+	bool TraceCompiler::Duplicate()
+	{
+		if (stack.empty()) { return false; }
+		Entry top = stack.back();
+		if (top.kind == Kind::Temp)
+		{
+			int copy = Allocate(top.type);
+			Move(top.type, copy, top);
+			top.index = copy;
+		}
+		stack.push_back(top);
+		return true;
+	}
+
+	bool TraceCompiler::Binary(OpCode op)
+	{
+		switch (op)
+		{
+		case OpCode::Add:
+		case OpCode::Subtract:
+		case OpCode::Multiply:
+		case OpCode::Divide:
+		case OpCode::LessThan:
+		case OpCode::LessThanEqual:
+		case OpCode::GreaterThan:
+		case OpCode::GreaterThanEqual:
+		case OpCode::Equal:
+		case OpCode::NotEqual:
+		case OpCode::LogicalAnd:
+		case OpCode::LogicalOr:
+			break;
+
+		default:
+			return false;
+		}
+
+		if (stack.size() < 2) { return false; }
+		Entry rhs = Pop();
+		Entry lhs = Pop();
+		// mixed operands convert in the interpreter, traces only handle matching types
+		if (lhs.type != rhs.type) { return false; }
+
+		switch (lhs.type)
+		{
+		case Tracer::Type::Long:
+			return LongBinary(op, lhs, rhs);
+
+		case Tracer::Type::Double:
+			return DoubleBinary(op, lhs, rhs);
+
+		default:
+			return BoolBinary(op, lhs, rhs);
+		}
+	}
+
+	bool TraceCompiler::LongBinary(OpCode op, const Entry& lhs, const Entry& rhs)
+	{
+		switch (op)
+		{
+		case OpCode::Add:
+		case OpCode::Subtract:
+		case OpCode::Multiply:
+		{
+			Reg result = TakeGpr(lhs);
+			Reg other = Gpr(rhs, RCX);
+			if (op == OpCode::Multiply)
+			{
+				a.Imul(result, other);
+			}
+			else
+			{
+				a.Alu(op == OpCode::Add ? ADD : SUB, result, other);
+			}
+			WrapLong(result);
+			Free(rhs);
+			stack.push_back(Entry{ Kind::Temp, Tracer::Type::Long, result, 0 });
+			return true;
+		}
+
+		case OpCode::LessThan:
+		case OpCode::LessThanEqual:
+		case OpCode::GreaterThan:
+		case OpCode::GreaterThanEqual:
+		case OpCode::Equal:
+		case OpCode::NotEqual:
+		{
+			Condition condition;
+			switch (op)
+			{
+			case OpCode::LessThan: condition = LESS; break;
+			case OpCode::LessThanEqual: condition = LESS_EQUAL; break;
+			case OpCode::GreaterThan: condition = GREATER; break;
+			case OpCode::GreaterThanEqual: condition = GREATER_EQUAL; break;
+			case OpCode::Equal: condition = EQUAL; break;
+			default: condition = NOT_EQUAL; break;
+			}
+			a.Alu(CMP, Gpr(lhs, RAX), Gpr(rhs, RCX));
+			PushFlag(condition, lhs, rhs);
+			return true;
+		}
+
+		case OpCode::Divide:
+		{
+			// dividing by zero, or the smallest long by -1, goes back to the interpreter to fail the way it does
+			Reg divisor = Gpr(rhs, RCX);
+			if (rhs.kind == Kind::Constant)
+			{
+				if (rhs.bits == 0 || rhs.bits == static_cast<uint64_t>(-1)) { return false; }
+			}
+			else
+			{
+				std::vector<Entry> snapshot = stack;
+				if (!fused)
+				{
+					snapshot.push_back(lhs);
+					snapshot.push_back(rhs);
+				}
+				size_t exit = NewExit(current, snapshot);
+				a.Alu(TEST, divisor, divisor);
+				a.JumpIf(EQUAL, exit);
+				a.CmpImm(divisor, -1);
+				a.JumpIf(EQUAL, exit);
+			}
+			Move(Tracer::Type::Long, RAX, lhs);
+			a.Idiv(divisor);
+			Free(lhs);
+			Free(rhs);
+			int result = Allocate(Tracer::Type::Long);
+			a.Mov(static_cast<Reg>(result), RAX);
+			stack.push_back(Entry{ Kind::Temp, Tracer::Type::Long, result, 0 });
+			return true;
+		}
+
+		default:
+			return false;
+		}
+	}
+
+	bool TraceCompiler::DoubleBinary(OpCode op, const Entry& lhs, const Entry& rhs)
+	{
+		SseOp arithmetic;
+		switch (op)
+		{
+		case OpCode::Add: arithmetic = ADDSD; break;
+		case OpCode::Subtract: arithmetic = SUBSD; break;
+		case OpCode::Multiply: arithmetic = MULSD; break;
+		case OpCode::Divide: arithmetic = DIVSD; break;
+
+		case OpCode::LessThan:
+		case OpCode::LessThanEqual:
+		case OpCode::GreaterThan:
+		case OpCode::GreaterThanEqual:
+		{
+			// ucomisd sets above and above-or-equal only for ordered operands, so NaNs compare false
+			uint8_t left = Xmm(lhs, 0);
+			uint8_t right = Xmm(rhs, 1);
+			bool swap = op == OpCode::LessThan || op == OpCode::LessThanEqual;
+			a.Sse(0x66, UCOMISD, swap ? right : left, swap ? left : right);
+			PushFlag(op == OpCode::LessThan || op == OpCode::GreaterThan ? ABOVE : ABOVE_EQUAL, lhs, rhs);
+			return true;
+		}
+
+		case OpCode::Equal:
+		case OpCode::NotEqual:
+			a.Sse(0x66, UCOMISD, Xmm(lhs, 0), Xmm(rhs, 1));
+			a.Set(op == OpCode::Equal ? NOT_PARITY : PARITY, RCX);
+			a.Set(op == OpCode::Equal ? EQUAL : NOT_EQUAL, RAX);
+			a.Alu(op == OpCode::Equal ? AND : OR, RAX, RCX);
+			PushFlag(op == OpCode::Equal ? EQUAL : NOT_EQUAL, lhs, rhs);
+			return true;
+
+		default:
+			return false;
+		}
+
+		uint8_t result = TakeXmm(lhs);
+		a.Sse(0xF2, arithmetic, result, Xmm(rhs, 1));
+		Free(rhs);
+		stack.push_back(Entry{ Kind::Temp, Tracer::Type::Double, result, 0 });
+		return true;
+	}
+
+	bool TraceCompiler::BoolBinary(OpCode op, const Entry& lhs, const Entry& rhs)
+	{
+		switch (op)
+		{
+		case OpCode::Equal:
+		case OpCode::NotEqual:
+			a.Alu(CMP, Gpr(lhs, RAX), Gpr(rhs, RCX));
+			PushFlag(op == OpCode::Equal ? EQUAL : NOT_EQUAL, lhs, rhs);
+			return true;
+
+		case OpCode::LogicalAnd:
+		case OpCode::LogicalOr:
+		{
+			Reg result = TakeGpr(lhs);
+			a.Alu(op == OpCode::LogicalAnd ? AND : OR, result, Gpr(rhs, RCX));
+			Free(rhs);
+			stack.push_back(Entry{ Kind::Temp, Tracer::Type::Bool, result, 0 });
+			return true;
+		}
+
+		default:
+			return false;
+		}
+	}
+
+	// pushes the flag as a bool. double equality has already combined its flags into rax, which is left alone here.
+	void TraceCompiler::PushFlag(Condition condition, const Entry& lhs, const Entry& rhs)
+	{
+		bool combined = lhs.type == Tracer::Type::Double && (condition == EQUAL || condition == NOT_EQUAL);
+		if (!combined)
+		{
+			a.Set(condition, RAX);
+		}
+		Free(lhs);
+		Free(rhs);
+		int result = Allocate(Tracer::Type::Bool);
+		if (failed) { return; }
+		a.Mov(static_cast<Reg>(result), RAX);
+		stack.push_back(Entry{ Kind::Temp, Tracer::Type::Bool, result, 0 });
+	}
+
+	bool TraceCompiler::Unary(OpCode op)
+	{
+		if (stack.empty()) { return false; }
+		Entry value = Pop();
+
+		if (op == OpCode::Negate && value.type == Tracer::Type::Long)
+		{
+			Reg result = TakeGpr(value);
+			a.Neg(result);
+			WrapLong(result);
+			stack.push_back(Entry{ Kind::Temp, Tracer::Type::Long, result, 0 });
+		}
+		else if (op == OpCode::Negate && value.type == Tracer::Type::Double)
+		{
+			uint8_t result = TakeXmm(value);
+			a.MovImm(RAX, 0x8000000000000000);
+			a.MovToXmm(0, RAX);
+			a.Sse(0x66, XORPD, result, 0);
+			stack.push_back(Entry{ Kind::Temp, Tracer::Type::Double, result, 0 });
+		}
+		else if (op == OpCode::LogicalNot && value.type == Tracer::Type::Bool)
+		{
+			Reg result = TakeGpr(value);
+			a.XorImm(result, 1);
+			stack.push_back(Entry{ Kind::Temp, Tracer::Type::Bool, result, 0 });
+		}
+		else
+		{
+			return false;
+		}
+		return true;
+	}
+
+	bool TraceCompiler::Guard(size_t recordedNext, size_t fallthrough, size_t target)
+	{
+		if (stack.empty()) { return false; }
+		Entry condition = Pop();
+		if (condition.type != Tracer::Type::Bool) { return false; }
+
+		if (target != fallthrough)
+		{
+			bool jumped = recordedNext != fallthrough;
+			if (condition.kind == Kind::Constant)
+			{
+				// a constant condition always goes the recorded way
+				if ((condition.bits != 0) == jumped) { return false; }
+			}
+			else
+			{
+				Reg reg = Gpr(condition, RAX);
+				a.Alu(TEST, reg, reg);
+				a.JumpIf(jumped ? NOT_EQUAL : EQUAL, NewExit(jumped ? fallthrough : target, stack));
+			}
+		}
+
+		Free(condition);
+		return true;
+	}
+
+	// an exit resumes the interpreter at ip with snapshot pushed onto its stack
+	size_t TraceCompiler::NewExit(size_t ip, const std::vector<Entry>& snapshot)
+	{
+		std::vector<Tracer::Type> types;
+		for (const Entry& entry : snapshot)
+		{
+			types.push_back(entry.type);
+		}
+		trace.exits.push_back(Tracer::Exit{ ip, std::move(types) });
+		exits.push_back(PendingExit{ a.NewLabel(), snapshot });
+		return exits.back().label;
+	}
+
+	bool TraceCompiler::IsXmm(Tracer::Type type)
+	{
+		return type == Tracer::Type::Double;
+	}
+
+	int TraceCompiler::Allocate(Tracer::Type type)
+	{
+		if (IsXmm(type))
+		{
+			if (freeXmms.empty())
+			{
+				failed = true;
+				return 0;
+			}
+			uint8_t xmm = freeXmms.back();
+			freeXmms.pop_back();
+			return xmm;
+		}
+		else
+		{
+			if (freeGprs.empty())
+			{
+				failed = true;
+				return RAX;
+			}
+			Reg reg = freeGprs.back();
+			freeGprs.pop_back();
+			return reg;
+		}
+	}
+
+	void TraceCompiler::Free(const Entry& entry)
+	{
+		if (entry.kind != Kind::Temp) { return; }
+		if (IsXmm(entry.type))
+		{
+			freeXmms.push_back(static_cast<uint8_t>(entry.index));
+		}
+		else
+		{
+			freeGprs.push_back(static_cast<Reg>(entry.index));
+		}
+	}
+
+	int TraceCompiler::VariableIndex(uint16_t slot) const
+	{
+		for (size_t i = 0; i < trace.variables.size(); i++)
+		{
+			if (trace.variables[i].slot == slot) { return static_cast<int>(i); }
+		}
+		return -1;
+	}
+
+	int TraceCompiler::RegisterOf(const Entry& entry) const
+	{
+		return entry.kind == Kind::Variable ? registers[entry.index] : entry.index;
+	}
+
+	Reg TraceCompiler::Gpr(const Entry& entry, Reg scratch)
+	{
+		if (entry.kind != Kind::Constant) { return static_cast<Reg>(RegisterOf(entry)); }
+		a.MovImm(scratch, entry.bits);
+		return scratch;
+	}
+
+	uint8_t TraceCompiler::Xmm(const Entry& entry, uint8_t scratch)
+	{
+		if (entry.kind != Kind::Constant) { return static_cast<uint8_t>(RegisterOf(entry)); }
+		a.MovImm(RAX, entry.bits);
+		a.MovToXmm(scratch, RAX);
+		return scratch;
+	}
+
+	Reg TraceCompiler::TakeGpr(const Entry& entry)
+	{
+		if (entry.kind == Kind::Temp) { return static_cast<Reg>(entry.index); }
+		Reg reg = static_cast<Reg>(Allocate(entry.type));
+		Move(entry.type, reg, entry);
+		return reg;
+	}
+
+	uint8_t TraceCompiler::TakeXmm(const Entry& entry)
+	{
+		if (entry.kind == Kind::Temp) { return static_cast<uint8_t>(entry.index); }
+		uint8_t xmm = static_cast<uint8_t>(Allocate(entry.type));
+		Move(entry.type, xmm, entry);
+		return xmm;
+	}
+
+	void TraceCompiler::Move(Tracer::Type type, int dst, const Entry& entry)
+	{
+		if (entry.kind != Kind::Constant && RegisterOf(entry) == dst) { return; }
+		if (IsXmm(type))
+		{
+			if (entry.kind == Kind::Constant)
+			{
+				a.MovImm(RAX, entry.bits);
+				a.MovToXmm(static_cast<uint8_t>(dst), RAX);
+			}
+			else
+			{
+				a.Sse(0xF2, MOVSD, static_cast<uint8_t>(dst), static_cast<uint8_t>(RegisterOf(entry)));
+			}
+		}
+		else if (entry.kind == Kind::Constant)
+		{
+			a.MovImm(static_cast<Reg>(dst), entry.bits);
+		}
+		else
+		{
+			a.Mov(static_cast<Reg>(dst), static_cast<Reg>(RegisterOf(entry)));
+		}
+	}
+
+	void TraceCompiler::StoreSlot(size_t slot, const Entry& entry)
+	{
+		Reg reg;
+		if (IsXmm(entry.type) && entry.kind != Kind::Constant)
+		{
+			a.MovFromXmm(RAX, static_cast<uint8_t>(RegisterOf(entry)));
+			reg = RAX;
+		}
+		else
+		{
+			reg = Gpr(entry, RAX);
+		}
+		a.Store(SLOTS, static_cast<int32_t>(slot * sizeof(uint64_t)), reg);
+	}
+
+	// long arithmetic wraps at the width of long, like the interpreter's
+	void TraceCompiler::WrapLong(Reg reg)
+	{
+		if (sizeof(long) < sizeof(int64_t))
+		{
+			a.Movsxd(reg);
+		}
+	}
+
+	TraceCompiler::Entry TraceCompiler::Pop()
+	{
+		Entry entry = stack.back();
+		stack.pop_back();
+		return entry;
+	}
+}
+#endif
+
+Tracer::Tracer()
+{
+}
+
+Tracer::~Tracer()
+{
+	Clear();
+}
+
+void Tracer::Reset(size_t size)
+{
+	Clear();
+	headers.assign(size, Header{ 0, 0, State::Counting });
+}
+
+void Tracer::Clear()
+{
+#ifdef JIT_SUPPORTED
+	for (std::pair<const size_t, Trace>& trace : traces)
+	{
+		Assembler::Free(trace.second.code, trace.second.size);
+	}
+#endif
+	traces.clear();
+}
+
+InterpretResult Tracer::Loop(VM& vm, size_t end)
+{
+#ifndef JIT_SUPPORTED
+	return InterpretResult::Ok;
+#else
+	size_t header = vm.ip;
+	if (header >= headers.size()) { return InterpretResult::Ok; }
+	Header& state = headers[header];
+
+	switch (state.state)
+	{
+	case State::Compiled:
+	{
+		Trace& trace = traces.at(header);
+		// a trace whose globals keep changing type is not worth the guards
+		if (!Execute(vm, trace) && ++trace.misses >= MAX_MISSES)
+		{
+			Assembler::Free(trace.code, trace.size);
+			traces.erase(header);
+			state.state = State::Blacklisted;
+		}
+		return InterpretResult::Ok;
+	}
+
+	case State::Blacklisted:
+		return InterpretResult::Ok;
+
+	default:
+	{
+		if (++state.count < HOT_COUNT) { return InterpretResult::Ok; }
+		state.count = 0;
+		InterpretResult result = Record(vm, header, end);
+		if (state.state == State::Counting && ++state.attempts >= MAX_ATTEMPTS)
+		{
+			state.state = State::Blacklisted;
+		}
+		return result;
+	}
+	}
+#endif
+}
+
+InterpretResult Tracer::Record(VM& vm, size_t header, size_t end)
+{
+	std::vector<Recorded> recorded;
+	std::vector<Variable> variables;
+
+	// the first time a global is touched it still holds what it held at the header, which is what the trace expects
+	auto touch = [&](uint16_t slot)
+	{
+		for (const Variable& variable : variables)
+		{
+			if (variable.slot == slot) { return true; }
+		}
+		Type type;
+		if (!Classify(vm.globals[slot], type)) { return false; }
+		variables.push_back(Variable{ slot, type, false });
+		return true;
+	};
+
+	for (;;)
+	{
+		size_t offset = vm.ip;
+		// leaving the loop or running too long gives up on this recording, the interpreter carries on from here
+		if (offset < header || offset >= end || recorded.size() >= MAX_LENGTH) { return InterpretResult::Ok; }
+
+		const Chunk& chunk = vm.chunk;
+		bool supported = true;
+		switch (GenericOperation(static_cast<OpCode>(chunk.Read(offset))))
+		{
+		case OpCode::LoadGlobal:
+		case OpCode::StoreGlobal:
+			supported = touch(chunk.ReadLong(offset + 1));
+			break;
+
+		case OpCode::GlobalArithConstant:
+		case OpCode::CompareGlobalConstantJumpIfFalse:
+			supported = touch(chunk.ReadLong(offset + 3));
+			break;
+
+		case OpCode::CompareGlobalsJumpIfFalse:
+			supported = touch(chunk.ReadLong(offset + 3)) && touch(chunk.ReadLong(offset + 5));
+			break;
+
+		case OpCode::ForLoop:
+			supported = touch(chunk.ReadLong(offset + 1)) && touch(chunk.ReadLong(offset + 3));
+			break;
+
+		case OpCode::GlobalsArithStore:
+			supported = touch(chunk.ReadLong(offset + 3)) && touch(chunk.ReadLong(offset + 5)) && touch(chunk.ReadLong(offset + 7));
+			break;
+
+		case OpCode::None:
+		case OpCode::Constant:
+		case OpCode::ConstantLong:
+		case OpCode::Pop:
+		case OpCode::Duplicate:
+		case OpCode::Negate:
+		case OpCode::LogicalNot:
+		case OpCode::Add:
+		case OpCode::Subtract:
+		case OpCode::Multiply:
+		case OpCode::Divide:
+		case OpCode::LessThan:
+		case OpCode::LessThanEqual:
+		case OpCode::GreaterThan:
+		case OpCode::GreaterThanEqual:
+		case OpCode::Equal:
+		case OpCode::NotEqual:
+		case OpCode::LogicalAnd:
+		case OpCode::LogicalOr:
+		case OpCode::Jump:
+		case OpCode::JumpIfFalse:
+			break;
+
+		default:
+			supported = false;
+			break;
+		}
+		if (!supported) { return InterpretResult::Ok; }
+
+		InterpretResult result = vm.Step();
+		if (result != InterpretResult::Ok) { return result; }
+		recorded.push_back(Recorded{ offset, vm.ip });
+
+		if (vm.ip == header) { break; }
+		// only innermost loops are traced, an inner loop gets its own trace
+		if (vm.ip < offset) { return InterpretResult::Ok; }
+	}
+
+	Trace trace{ nullptr, 0, {}, {}, 0, 0 };
+	if (Compile(vm, recorded, std::move(variables), trace))
+	{
+#ifndef NDEBUG
+		std::cerr << "trace at " << header << ": " << recorded.size() << " instructions, " << trace.exits.size() << " exits\n";
+#endif
+		traces.emplace(header, std::move(trace));
+		headers[header].state = State::Compiled;
+	}
+	return InterpretResult::Ok;
+}
+
+bool Tracer::Compile(const VM& vm, const std::vector<Recorded>& recorded, std::vector<Variable>&& variables, Trace& trace)
+{
+#ifndef JIT_SUPPORTED
+	return false;
+#else
+	trace.variables = std::move(variables);
+	TraceCompiler compiler(vm.chunk, trace);
+	if (!compiler.Compile(recorded)) { return false; }
+	trace.code = compiler.a.Finish(trace.size);
+	return trace.code != nullptr;
+#endif
+}
+
+bool Tracer::Execute(VM& vm, Trace& trace)
+{
+	// whatever an exit leaves has to fit on the stack, otherwise the interpreter runs the loop and reports the overflow
+	if (!vm.Reserve(trace.slots - trace.variables.size())) { return false; }
+	slots.resize(trace.slots);
+	for (size_t i = 0; i < trace.variables.size(); i++)
+	{
+		const Variable& variable = trace.variables[i];
+		const Value& value = vm.globals[variable.slot];
+		Type type;
+		if (!Classify(value, type) || type != variable.type) { return false; }
+		slots[i] = Unbox(type, value);
+	}
+
+	using Entry = uint32_t (*)(uint64_t*);
+	const Exit& exit = trace.exits[reinterpret_cast<Entry>(trace.code)(slots.data())];
+
+	for (size_t i = 0; i < trace.variables.size(); i++)
+	{
+		if (trace.variables[i].written)
+		{
+			vm.globals[trace.variables[i].slot] = Box(trace.variables[i].type, slots[i]);
+		}
+	}
+	for (size_t i = 0; i < exit.stack.size(); i++)
+	{
+		vm.Push(Box(exit.stack[i], slots[trace.variables.size() + i]));
+	}
+	vm.ip = exit.ip;
+	return true;
+}
+
+bool Tracer::Classify(const Value& value, Type& type)
+{
+	if (value.IsDouble()) { type = Type::Double; }
+	else if (value.Get<long>()) { type = Type::Long; }
+	else if (value.Get<bool>()) { type = Type::Bool; }
+	else { return false; }
+	return true;
+}
\ No newline at end of file
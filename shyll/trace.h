@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk.h"
+#include "jit.h"
+
+class VM;
+enum class InterpretResult;
+
+// tracing jit for the loops while and do compile into.
+// the target of a backward jump or ForLoop is a loop header. once a header has been reached often enough, one
+// iteration is recorded by stepping the interpreter, noting the types of the globals it touches and which way each
+// branch went.
+// the recording compiles to a native loop over unboxed globals kept in registers, where each branch becomes a guard.
+// a guard that fails is a side exit: the globals and anything left on the stack are written back and the
+// interpreter continues from the instruction the trace did not follow.
+class Tracer
+{
+public:
+	Tracer();
+	~Tracer();
+
+	Tracer(const Tracer&) = delete;
+	Tracer& operator=(const Tracer&) = delete;
+
+	void Reset(size_t size);
+	// called with ip at a loop header closed by the jump that ends at end.
+	// runs, records or skips the trace there and leaves ip where the interpreter continues.
+	InterpretResult Loop(VM& vm, size_t end);
+
+	static constexpr uint16_t HOT_COUNT = 64;
+	static constexpr uint8_t MAX_ATTEMPTS = 4;
+	static constexpr size_t MAX_LENGTH = 512;
+	static constexpr size_t MAX_MISSES = 64;
+
+	enum class Type : uint8_t
+	{
+		Long,
+		Double,
+		Bool
+	};
+
+	struct Variable
+	{
+		uint16_t slot;
+		Type type;
+		bool written;
+	};
+
+	struct Exit
+	{
+		size_t ip;
+		// types of the values the exit pushes, stored after the variables
+		std::vector<Type> stack;
+	};
+
+	struct Trace
+	{
+		uint8_t* code;
+		size_t size;
+		std::vector<Variable> variables;
+		std::vector<Exit> exits;
+		size_t slots;
+		size_t misses;
+	};
+
+	struct Recorded
+	{
+		size_t offset;
+		// where the interpreter went next, which tells which way a branch was taken
+		size_t next;
+	};
+
+private:
+	enum class State : uint8_t
+	{
+		Counting,
+		Compiled,
+		Blacklisted
+	};
+
+	struct Header
+	{
+		uint16_t count;
+		uint8_t attempts;
+		State state;
+	};
+
+	std::vector<Header> headers;
+	std::unordered_map<size_t, Trace> traces;
+	std::vector<uint64_t> slots;
+
+	InterpretResult Record(VM& vm, size_t header, size_t end);
+	bool Compile(const VM& vm, const std::vector<Recorded>& recorded, std::vector<Variable>&& variables, Trace& trace);
+	bool Execute(VM& vm, Trace& trace);
+	void Clear();
+
+	static bool Classify(const Value& value, Type& type);
+};
\ No newline at end of file
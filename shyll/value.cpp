@@ -1,31 +1,102 @@
 #include "value.h"
 
-Value::Value() : internal()
+Value::Value(const std::string& val)
 {
+	if (!FindInterned(val)) { MakeString(std::string(val)); }
 }
 
-Value::Value(double val) : internal(val)
+Value::Value(std::string&& val)
 {
+	if (!FindInterned(val)) { MakeString(std::move(val)); }
 }
 
-Value::Value(long val) : internal(val)
+bool Value::FindInterned(std::string_view val)
 {
+	if (val.length() > INTERN_MAX_LENGTH) { return false; }
+
+	auto it = InternTable().find(val);
+	if (it == InternTable().end()) { return false; }
+
+	Box(Tag::String, reinterpret_cast<uintptr_t>(static_cast<Object*>(it->second)));
+	Retain();
+	return true;
+}
+
+void Value::MakeString(std::string&& val)
+{
+	StringObject* object = new StringObject{ { 1 }, val.length() <= INTERN_MAX_LENGTH, std::move(val) };
+	if (object->interned)
+	{
+		InternTable().emplace(object->chars, object);
+	}
+	Box(Tag::String, reinterpret_cast<uintptr_t>(static_cast<Object*>(object)));
+}
+
+std::unordered_map<std::string_view, Value::StringObject*>& Value::InternTable()
+{
+	// never destroyed, so strings that outlive static destruction can still unregister themselves.
+	static std::unordered_map<std::string_view, StringObject*>* table = new std::unordered_map<std::string_view, StringObject*>();
+	return *table;
+}
+
+void Value::Free()
+{
+	if (GetTag() == Tag::String)
+	{
+		StringObject* object = static_cast<StringObject*>(GetObject());
+		if (object->interned) { InternTable().erase(object->chars); }
+		delete object;
+	}
+	else
+	{
+		delete static_cast<LongObject*>(GetObject());
+	}
 }
 
-Value::Value(const std::string& val) : internal(val)
+bool Value::SameString(const Value& val) const
 {
+	const StringObject* a = static_cast<const StringObject*>(GetObject());
+	const StringObject* b = static_cast<const StringObject*>(val.GetObject());
+	if (a == b) { return true; }
+	if (a->interned && b->interned) { return false; }
+	return a->chars == b->chars;
 }
 
-Value::Value(bool val) : internal(val)
+// heap values hash their contents, everything else is fully described by its bits
+size_t Value::Hash::operator()(const Value& value) const
 {
+	switch (value.GetTag())
+	{
+	case Tag::String:
+		return std::hash<std::string>()(*value.Get<std::string>());
+
+	case Tag::BoxedLong:
+		return std::hash<long>()(*value.Get<long>());
+
+	default:
+		return std::hash<uint64_t>()(value.bits);
+	}
 }
 
-const bool Value::Valid() const
+bool Value::Identical::operator()(const Value& a, const Value& b) const
 {
-	return internal.has_value();
+	if (a.bits == b.bits) { return true; }
+	if (a.GetTag() != b.GetTag()) { return false; }
+
+	switch (a.GetTag())
+	{
+	case Tag::String:
+		return a.SameString(b);
+
+	case Tag::BoxedLong:
+		return *a.Get<long>() == *b.Get<long>();
+
+	default:
+		return false;
+	}
 }
 
-const Value Value::operator+(const Value& val) const
+Value Value::operator+(const Value& val) const
 {
 	if (Get<double>())
 	{
@@ -86,7 +157,7 @@ const Value Value::operator+(const Value& val) const
 	return Value();
 }
 
-const Value Value::operator-(const Value& val) const
+Value Value::operator-(const Value& val) const
 {
 	if (Get<double>() && val.Get<double>()) { return Value(*Get<double>() - *val.Get<double>()); }
 	if (Get<long>() && val.Get<long>()) { return Value(*Get<long>() - *val.Get<long>()); }
@@ -95,7 +166,7 @@ const Value Value::operator-(const Value& val) const
 	return Value();
 }
 
-const Value Value::operator*(const Value& val) const
+Value Value::operator*(const Value& val) const
 {
 	if (Get<double>() && val.Get<double>()) { return Value(*Get<double>() * *val.Get<double>()); }
 	if (Get<long>() && val.Get<long>()) { return Value(*Get<long>() * *val.Get<long>()); }
@@ -104,7 +175,7 @@ const Value Value::operator*(const Value& val) const
 	return Value();
 }
 
-const Value Value::operator/(const Value& val) const
+Value Value::operator/(const Value& val) const
 {
 	if (Get<double>() && val.Get<double>()) { return Value(*Get<double>() / *val.Get<double>()); }
 	if (Get<long>() && val.Get<long>()) { return Value(*Get<long>() / *val.Get<long>()); }
@@ -113,7 +184,7 @@ const Value Value::operator/(const Value& val) const
 	return Value();
 }
 
-const Value Value::operator<(const Value& val) const
+Value Value::operator<(const Value& val) const
 {
 	if (Get<double>() && val.Get<double>()) { return *Get<double>() < *val.Get<double>(); }
 	if (Get<long>() && val.Get<long>()) { return *Get<long>() < *val.Get<long>(); }
@@ -122,7 +193,7 @@ const Value Value::operator<(const Value& val) const
 	return Value();
 }
 
-const Value Value::operator<=(const Value& val) const
+Value Value::operator<=(const Value& val) const
 {
 	if (Get<double>() && val.Get<double>()) { return *Get<double>() <= *val.Get<double>(); }
 	if (Get<long>() && val.Get<long>()) { return *Get<long>() <= *val.Get<long>(); }
@@ -131,7 +202,7 @@ const Value Value::operator<=(const Value& val) const
 	return Value();
 }
 
-const Value Value::operator>(const Value& val) const
+Value Value::operator>(const Value& val) const
 {
 	if (Get<double>() && val.Get<double>()) { return *Get<double>() > *val.Get<double>(); }
 	if (Get<long>() && val.Get<long>()) { return *Get<long>() > *val.Get<long>(); }
@@ -140,7 +211,7 @@ const Value Value::operator>(const Value& val) const
 	return Value();
 }
 
-const Value Value::operator>=(const Value& val) const
+Value Value::operator>=(const Value& val) const
 {
 	if (Get<double>() && val.Get<double>()) { return *Get<double>() >= *val.Get<double>(); }
 	if (Get<long>() && val.Get<long>()) { return *Get<long>() >= *val.Get<long>(); }
@@ -149,44 +220,44 @@ const Value Value::operator>=(const Value& val) const
 	return Value();
 }
 
-const Value Value::operator==(const Value& val) const
+Value Value::operator==(const Value& val) const
 {
 	if (Get<double>() && val.Get<double>()) { return *Get<double>() == *val.Get<double>(); }
-	if (Get<std::string>() && val.Get<std::string>()) { return *Get<std::string>() == *val.Get<std::string>(); }
+	if (Get<std::string>() && val.Get<std::string>()) { return SameString(val); }
 	if (Get<bool>() && val.Get<bool>()) { return *Get<bool>() == *val.Get<bool>(); }
 	if (Get<long>() && val.Get<long>()) { return *Get<long>() == *val.Get<long>(); }
 	return Value();
 }
 
-const Value Value::operator!=(const Value& val) const
+Value Value::operator!=(const Value& val) const
 {
 	if (Get<double>() && val.Get<double>()) { return *Get<double>() != *val.Get<double>(); }
-	if (Get<std::string>() && val.Get<std::string>()) { return *Get<std::string>() != *val.Get<std::string>(); }
+	if (Get<std::string>() && val.Get<std::string>()) { return !SameString(val); }
 	if (Get<bool>() && val.Get<bool>()) { return *Get<bool>() != *val.Get<bool>(); }
 	if (Get<long>() && val.Get<long>()) { return *Get<long>() != *val.Get<long>(); }
 	return Value();
 }
 
-const Value Value::operator&&(const Value& val) const
+Value Value::operator&&(const Value& val) const
 {
 	if (Get<bool>() && val.Get<bool>()) { return *Get<bool>() && *val.Get<bool>(); }
 	return Value();
 }
 
-const Value Value::operator||(const Value& val) const
+Value Value::operator||(const Value& val) const
 {
 	if (Get<bool>() && val.Get<bool>()) { return *Get<bool>() || *val.Get<bool>(); }
 	return Value();
 }
 
-const Value Value::operator-() const
+Value Value::operator-() const
 {
 	if (Get<long>()) { return -*Get<long>(); }
 	else if (Get<double>()) { return -*Get<double>(); }
 	else { return Value(); }
 }
 
-const Value Value::operator!() const
+Value Value::operator!() const
 {
 	if (Get<bool>()) { return !*Get<bool>(); }
 	return Value();
@@ -194,22 +265,22 @@ const Value Value::operator!() const
 
 std::ostream& operator<<(std::ostream& stream, const Value& value)
 {
-	if (value.internal.has_value())
+	switch (value.GetTag())
 	{
-		switch (value.internal.value().index())
-		{
-		case 0:
-			return stream << std::get<double>(value.internal.value());
+	case Value::Tag::Double:
+		return stream << *value.Get<double>();
 
-		case 1:
-			return stream << std::get<std::string>(value.internal.value());
+	case Value::Tag::String:
+		return stream << *value.Get<std::string>();
 
-		case 2:
-			return stream << (std::get<bool>(value.internal.value()) ? "true" : "false");
+	case Value::Tag::Bool:
+		return stream << (*value.Get<bool>() ? "true" : "false");
 
-		case 3:
-			return stream << std::get<long>(value.internal.value());
-		}
+	case Value::Tag::Long:
+	case Value::Tag::BoxedLong:
+		return stream << *value.Get<long>();
+
+	default:
+		return stream;
 	}
-	return stream;
-}
+}
\ No newline at end of file
@@ -1,54 +1,283 @@
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <optional>
 #include <string>
-#include <variant>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
 
+// a value is a single NaN-boxed 64-bit word.
+// any bit pattern outside the boxed range is a double. boxed values carry a 3-bit tag and a 48-bit payload,
+// which holds bools and longs inline and a pointer for anything that lives on the heap.
+// heap objects are immutable and reference counted, so copying a value never copies its payload.
 class Value
 {
 public:
-	Value();
-	Value(double val);
-	Value(long val);
+	Value() : bits(INVALID)
+	{
+	}
+
+	Value(double val)
+	{
+		std::memcpy(&bits, &val, sizeof(double));
+		if (val != val)
+		{
+			// negative NaNs keep their sign as a signalling NaN, which stays outside the boxed range.
+			bits = (bits >> 63) ? NEGATIVE_NAN : CANONICAL_NAN;
+		}
+	}
+
+	Value(long val)
+	{
+		int64_t wide = val;
+		if (static_cast<int64_t>(static_cast<uint64_t>(wide) << 16) >> 16 == wide)
+		{
+			Box(Tag::Long, static_cast<uint64_t>(wide));
+		}
+		else
+		{
+			Box(Tag::BoxedLong, reinterpret_cast<uintptr_t>(static_cast<Object*>(new LongObject{ { 1 }, val })));
+		}
+	}
+
 	Value(const std::string& val);
-	Value(bool val);
+	Value(std::string&& val);
+
+	Value(bool val)
+	{
+		Box(Tag::Bool, val ? 1 : 0);
+	}
+
+	Value(const Value& val) : bits(val.bits)
+	{
+		if (IsHeap()) { Retain(); }
+	}
+
+	Value(Value&& val) noexcept : bits(val.bits)
+	{
+		val.bits = INVALID;
+	}
+
+	~Value()
+	{
+		if (IsHeap()) { Release(); }
+	}
+
+	Value& operator=(const Value& val)
+	{
+		if (this != &val)
+		{
+			if (IsHeap()) { Release(); }
+			bits = val.bits;
+			if (IsHeap()) { Retain(); }
+		}
+		return *this;
+	}
+
+	Value& operator=(Value&& val) noexcept
+	{
+		if (this != &val)
+		{
+			if (IsHeap()) { Release(); }
+			bits = val.bits;
+			val.bits = INVALID;
+		}
+		return *this;
+	}
 
 	friend std::ostream& operator<<(std::ostream& stream, const Value& value);
+	// the jit embeds constants and tests tags on raw bits.
+	friend class Jit;
 
+	// strings are returned as a pointer into the heap object, everything else by value.
 	template <typename T>
-	const T* Get() const
+	std::conditional_t<std::is_same_v<T, std::string>, const std::string*, std::optional<T>> Get() const
 	{
-		if (internal.has_value())
+		if constexpr (std::is_same_v<T, double>)
+		{
+			if (IsBoxed()) { return std::nullopt; }
+			double val;
+			std::memcpy(&val, &bits, sizeof(double));
+			return val;
+		}
+		else if constexpr (std::is_same_v<T, long>)
+		{
+			switch (GetTag())
+			{
+			case Tag::Long:
+				return static_cast<long>(static_cast<int64_t>(bits << 16) >> 16);
+
+			case Tag::BoxedLong:
+				return static_cast<const LongObject*>(GetObject())->value;
+
+			default:
+				return std::nullopt;
+			}
+		}
+		else if constexpr (std::is_same_v<T, bool>)
 		{
-			return std::get_if<T>(&internal.value());
+			if (GetTag() != Tag::Bool) { return std::nullopt; }
+			return (bits & PAYLOAD_MASK) != 0;
 		}
 		else
 		{
-			return nullptr;
+			static_assert(std::is_same_v<T, std::string>, "Value does not hold this type");
+			if (GetTag() != Tag::String) { return nullptr; }
+			return &static_cast<const StringObject*>(GetObject())->chars;
 		}
 	}
 
-	const bool Valid() const;
+	const bool Valid() const
+	{
+		return bits != INVALID;
+	}
 
-	const Value operator+(const Value& val) const;
-	const Value operator-(const Value& val) const;
-	const Value operator*(const Value& val) const;
-	const Value operator/(const Value& val) const;
-	const Value operator<(const Value& val) const;
-	const Value operator<=(const Value& val) const;
-	const Value operator>(const Value& val) const;
-	const Value operator>=(const Value& val) const;
-	const Value operator==(const Value& val) const;
-	const Value operator!=(const Value& val) const;
-	const Value operator&&(const Value& val) const;
-	const Value operator||(const Value& val) const;
+	// unchecked accessors for the vm's quickened instructions, which test the type first.
+	// only longs stored inline count here, wider ones take the generic path.
+	bool IsDouble() const
+	{
+		return !IsBoxed();
+	}
 
-	const Value operator-() const;
-	const Value operator!() const;
+	bool IsInlineLong() const
+	{
+		return (bits >> TAG_SHIFT) == ((BOX_MASK >> TAG_SHIFT) | static_cast<uint64_t>(Tag::Long));
+	}
+
+	double UncheckedDouble() const
+	{
+		double val;
+		std::memcpy(&val, &bits, sizeof(double));
+		return val;
+	}
+
+	long UncheckedLong() const
+	{
+		return static_cast<long>(static_cast<int64_t>(bits << 16) >> 16);
+	}
+
+	// for longs whose type was proven before running, which are still boxed when too wide to store inline.
+	long ProvenLong() const
+	{
+		return IsInlineLong() ? UncheckedLong() : static_cast<const LongObject*>(GetObject())->value;
+	}
+
+	Value operator+(const Value& val) const;
+	Value operator-(const Value& val) const;
+	Value operator*(const Value& val) const;
+	Value operator/(const Value& val) const;
+	Value operator<(const Value& val) const;
+	Value operator<=(const Value& val) const;
+	Value operator>(const Value& val) const;
+	Value operator>=(const Value& val) const;
+	Value operator==(const Value& val) const;
+	Value operator!=(const Value& val) const;
+	Value operator&&(const Value& val) const;
+	Value operator||(const Value& val) const;
+
+	Value operator-() const;
+	Value operator!() const;
+
+	// hashing and equality on type and payload, for keying hash tables on values.
+	// unlike operator== these never match a long with a double, and doubles match by their bits.
+	struct Hash
+	{
+		size_t operator()(const Value& value) const;
+	};
+
+	struct Identical
+	{
+		bool operator()(const Value& a, const Value& b) const;
+	};
+
+	// strings up to this length are interned, so equal short strings share one object.
+	static constexpr size_t INTERN_MAX_LENGTH = 40;
 
 private:
-	typedef std::variant<double, std::string, bool, long> ValueVariant;
+	struct Object
+	{
+		size_t refCount;
+	};
+
+	struct StringObject : Object
+	{
+		bool interned;
+		std::string chars;
+	};
+
+	struct LongObject : Object
+	{
+		long value;
+	};
+
+	// tags for boxed values. tags with the heap bit set own a pointer.
+	// Double is never stored, it is what GetTag reports for an unboxed word.
+	enum class Tag : uint64_t
+	{
+		Invalid = 0,
+		Bool = 1,
+		Long = 2,
+		String = 4,
+		BoxedLong = 5,
+		Double = 8
+	};
+
+	// sign bit, exponent and quiet bit all set. real NaNs are canonicalized so they never land in this range.
+	static constexpr uint64_t BOX_MASK = 0xFFF8000000000000;
+	static constexpr uint64_t TAG_MASK = 0x0007000000000000;
+	static constexpr uint64_t HEAP_BIT = 0x0004000000000000;
+	static constexpr uint64_t PAYLOAD_MASK = 0x0000FFFFFFFFFFFF;
+	static constexpr uint64_t CANONICAL_NAN = 0x7FF8000000000000;
+	static constexpr uint64_t NEGATIVE_NAN = 0xFFF0000000000001;
+	static constexpr uint64_t INVALID = BOX_MASK;
+	static constexpr int TAG_SHIFT = 48;
+
+	uint64_t bits;
+
+	bool IsBoxed() const
+	{
+		return (bits & BOX_MASK) == BOX_MASK;
+	}
+
+	Tag GetTag() const
+	{
+		return IsBoxed() ? static_cast<Tag>((bits & TAG_MASK) >> TAG_SHIFT) : Tag::Double;
+	}
+
+	bool IsHeap() const
+	{
+		return (bits & (BOX_MASK | HEAP_BIT)) == (BOX_MASK | HEAP_BIT);
+	}
+
+	Object* GetObject() const
+	{
+		return reinterpret_cast<Object*>(static_cast<uintptr_t>(bits & PAYLOAD_MASK));
+	}
+
+	void Retain()
+	{
+		GetObject()->refCount++;
+	}
+
+	void Release()
+	{
+		if (--GetObject()->refCount == 0) { Free(); }
+		bits = INVALID;
+	}
+
+	void Box(Tag tag, uint64_t payload)
+	{
+		bits = BOX_MASK | (static_cast<uint64_t>(tag) << TAG_SHIFT) | (payload & PAYLOAD_MASK);
+	}
+
+	static std::unordered_map<std::string_view, StringObject*>& InternTable();
 
-	std::optional<ValueVariant> internal;
-};
\ No newline at end of file
+	bool FindInterned(std::string_view val);
+	void MakeString(std::string&& val);
+	void Free();
+	bool SameString(const Value& val) const;
+};
+static_assert(sizeof(Value) == sizeof(uint64_t), "Value must stay a single 64-bit word");
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include "verifier.h"
+
+#include <algorithm>
+
+Verifier::Verifier(const Chunk& chunk, size_t stackMax) : chunk(chunk), stackMax(stackMax), depth(0)
+{
+}
+
+bool Verifier::Verify()
+{
+	using namespace std::string_literals;
+
+	functions.clear();
+	error = ""s;
+	depth = 0;
+
+	if (!FindInstructions()) { return false; }
+
+	Summary main;
+	if (!Analyze(0, true, main)) { return false; }
+	if (main.highest > static_cast<int32_t>(stackMax))
+	{
+		return Fail(0, "Stack can grow to "s + std::to_string(main.highest) + " values, more than the "s + std::to_string(stackMax) + " it holds"s);
+	}
+	depth = main.highest;
+	return true;
+}
+
+const std::string& Verifier::Error() const
+{
+	return error;
+}
+
+size_t Verifier::Depth() const
+{
+	return depth;
+}
+
+// superinstructions cover the bytes of the sequence they replaced, so stepping by instruction size skips those.
+bool Verifier::FindInstructions()
+{
+	starts.assign(chunk.Size(), false);
+	for (size_t offset = 0; offset < chunk.Size();)
+	{
+		size_t size = chunk.InstructionSize(offset);
+		if (size == 0 || offset + size > chunk.Size())
+		{
+			return Fail(offset, "Truncated instruction");
+		}
+		starts[offset] = true;
+		offset += size;
+	}
+	return chunk.Size() > 0 || Fail(0, "Empty chunk");
+}
+
+bool Verifier::Analyze(size_t entry, bool main, Summary& summary)
+{
+	using namespace std::string_literals;
+
+	summary = Summary{ 0, 0, NO_RETURN, false };
+
+	std::map<size_t, int32_t> depths;
+	std::vector<size_t> work;
+
+	auto flow = [&](size_t from, size_t to, int32_t depth)
+	{
+		if (to >= chunk.Size() || !starts[to])
+		{
+			return Fail(from, "Jump or fall through to "s + std::to_string(to) + ", which is not an instruction"s);
+		}
+		auto it = depths.find(to);
+		if (it == depths.end())
+		{
+			depths.emplace(to, depth);
+			work.push_back(to);
+		}
+		else if (it->second != depth)
+		{
+			return Fail(to, "Stack depth differs between paths reaching this instruction"s);
+		}
+		return true;
+	};
+
+	auto reach = [&](size_t offset, int32_t lowest, int32_t highest)
+	{
+		// main is entered with an empty stack, so its relative depths are absolute
+		if (main && lowest < 0) { return Fail(offset, "Stack underflow"s); }
+		summary.lowest = std::min(summary.lowest, lowest);
+		summary.highest = std::max(summary.highest, highest);
+		return true;
+	};
+
+	depths.emplace(entry, 0);
+	work.push_back(entry);
+
+	while (!work.empty())
+	{
+		size_t offset = work.back();
+		work.pop_back();
+		int32_t depth = depths[offset];
+		size_t next = offset + chunk.InstructionSize(offset);
+		OpCode op = GenericOperation(static_cast<OpCode>(chunk.Read(offset)));
+
+		switch (op)
+		{
+		case OpCode::Return:
+			break;
+
+		case OpCode::JumpToCallStackAddress:
+			// in main the call stack is empty, which the vm still reports at runtime
+			if (main) { break; }
+			if (summary.returned == NO_RETURN)
+			{
+				summary.returned = depth;
+			}
+			else if (summary.returned != depth)
+			{
+				return Fail(offset, "Function returns with different stack depths"s);
+			}
+			break;
+
+		case OpCode::PushJumpAddress:
+		{
+			if (next + 3 > chunk.Size() || static_cast<OpCode>(chunk.Read(next)) != OpCode::Jump)
+			{
+				return Fail(offset, "Call without a jump to the function"s);
+			}
+			size_t target = next + 3 + static_cast<int16_t>(chunk.ReadLong(next + 1));
+			if (target >= chunk.Size() || !starts[target])
+			{
+				return Fail(offset, "Call to "s + std::to_string(target) + ", which is not an instruction"s);
+			}
+			const Summary* callee;
+			if (!Summarize(target, callee)) { return false; }
+			if (!reach(offset, depth + callee->lowest, depth + callee->highest)) { return false; }
+			if (callee->returned != NO_RETURN && !flow(offset, next + 3, depth + callee->returned)) { return false; }
+			break;
+		}
+
+		case OpCode::CallNative:
+		{
+			// the native's counts are written after its index
+			int32_t pops = chunk.Read(offset + 3);
+			int32_t after = depth - pops + chunk.Read(offset + 4);
+			if (!reach(offset, depth - pops, std::max(depth, after))) { return false; }
+			if (!flow(offset, next, after)) { return false; }
+			break;
+		}
+
+		default:
+		{
+			int32_t pops;
+			int32_t pushes;
+			if (!StackEffect(op, pops, pushes))
+			{
+				return Fail(offset, "Unknown instruction"s);
+			}
+			int32_t after = depth - pops + pushes;
+			if (!reach(offset, depth - pops, std::max(depth, after))) { return false; }
+
+			size_t operand = chunk.JumpOperand(offset);
+			if (operand && !flow(offset, next + static_cast<int16_t>(chunk.ReadLong(operand)), after)) { return false; }
+			if (op != OpCode::Jump && !flow(offset, next, after)) { return false; }
+			break;
+		}
+		}
+	}
+
+	summary.done = true;
+	return true;
+}
+
+// a function reached again while it is still being summarized is recursive, which has no fixed stack bound.
+bool Verifier::Summarize(size_t entry, const Summary*& summary)
+{
+	auto it = functions.find(entry);
+	if (it != functions.end())
+	{
+		if (!it->second.done) { return Fail(entry, "Recursive call"); }
+		summary = &it->second;
+		return true;
+	}
+
+	functions[entry] = Summary{ 0, 0, NO_RETURN, false };
+	Summary result;
+	if (!Analyze(entry, false, result)) { return false; }
+	summary = &(functions[entry] = result);
+	return true;
+}
+
+bool Verifier::Fail(size_t offset, const std::string& message)
+{
+	using namespace std::string_literals;
+
+	error = message + " at offset "s + std::to_string(offset);
+	if (offset < chunk.Size()) { error += " (line "s + std::to_string(chunk.ReadLine(offset)) + ")"s; }
+	return false;
+}
\ No newline at end of file
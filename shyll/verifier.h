@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "chunk.h"
+
+// proves that a linked chunk never reads below the bottom of the operand stack, never grows it past its size,
+// and only jumps or falls through to the start of an instruction inside the chunk.
+// the stack depth at every reachable instruction is found by walking the control flow graph. each function is
+// summarized once by how far below and above its entry depth it goes and the depth it returns with, which is then
+// applied at every call. chunks it cannot prove, such as recursive ones or loops that change the depth, are not
+// wrong, they just have to keep the per-instruction checks.
+class Verifier
+{
+public:
+	Verifier(const Chunk& chunk, size_t stackMax);
+
+	bool Verify();
+	const std::string& Error() const;
+	// the most values the chunk can have on the stack at once, after it was verified
+	size_t Depth() const;
+
+private:
+	struct Summary
+	{
+		// relative to the depth the function was entered with
+		int32_t lowest;
+		int32_t highest;
+		int32_t returned;
+		bool done;
+	};
+
+	static constexpr int32_t NO_RETURN = INT32_MIN;
+
+	const Chunk& chunk;
+	size_t stackMax;
+	size_t depth;
+	std::vector<bool> starts;
+	std::map<size_t, Summary> functions;
+	std::string error;
+
+	bool FindInstructions();
+	bool Analyze(size_t entry, bool main, Summary& summary);
+	bool Summarize(size_t entry, const Summary*& summary);
+	bool Fail(size_t offset, const std::string& message);
+};
\ No newline at end of file
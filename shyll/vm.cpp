@@ -1,23 +1,168 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <iterator>
 
 #include "vm.h"
 #include "linker.h"
+#include "verifier.h"
 
 #ifndef EXCLUDE_RAYLIB
 #include "..\lib\raylib\src\raylib.h"
 #endif
 
+namespace
+{
+	// the specialization of a generic arithmetic or comparison opcode for these operands, or op itself if there is none.
+	OpCode Quicken(OpCode op, const Value& a, const Value& b)
+	{
+		bool longs = a.IsInlineLong() && b.IsInlineLong();
+		if (!longs && !(a.IsDouble() && b.IsDouble())) { return op; }
+
+		switch (op)
+		{
+		case OpCode::Add: return longs ? OpCode::AddLong : OpCode::AddDouble;
+		case OpCode::Subtract: return longs ? OpCode::SubtractLong : OpCode::SubtractDouble;
+		case OpCode::Multiply: return longs ? OpCode::MultiplyLong : OpCode::MultiplyDouble;
+		case OpCode::Divide: return longs ? OpCode::DivideLong : OpCode::DivideDouble;
+		case OpCode::LessThan: return longs ? OpCode::LessThanLong : OpCode::LessThanDouble;
+		case OpCode::LessThanEqual: return longs ? OpCode::LessThanEqualLong : OpCode::LessThanEqualDouble;
+		case OpCode::GreaterThan: return longs ? OpCode::GreaterThanLong : OpCode::GreaterThanDouble;
+		case OpCode::GreaterThanEqual: return longs ? OpCode::GreaterThanEqualLong : OpCode::GreaterThanEqualDouble;
+		case OpCode::Equal: return longs ? OpCode::EqualLong : OpCode::EqualDouble;
+		case OpCode::NotEqual: return longs ? OpCode::NotEqualLong : OpCode::NotEqualDouble;
+		default: return op;
+		}
+	}
+
+	// evaluates a generic or quickened operation. if a quickened guard fails or a generic operation can be specialized,
+	// op is changed to the opcode that fits these operands so the caller can write it back into the code.
+	Value QuickOperation(OpCode& op, const Value& a, const Value& b)
+	{
+		switch (op)
+		{
+		case OpCode::AddLong:
+			if (a.IsInlineLong() && b.IsInlineLong()) { return Value(a.UncheckedLong() + b.UncheckedLong()); }
+			break;
+
+		case OpCode::AddDouble:
+			if (a.IsDouble() && b.IsDouble()) { return Value(a.UncheckedDouble() + b.UncheckedDouble()); }
+			break;
+
+		case OpCode::SubtractLong:
+			if (a.IsInlineLong() && b.IsInlineLong()) { return Value(a.UncheckedLong() - b.UncheckedLong()); }
+			break;
+
+		case OpCode::SubtractDouble:
+			if (a.IsDouble() && b.IsDouble()) { return Value(a.UncheckedDouble() - b.UncheckedDouble()); }
+			break;
+
+		case OpCode::MultiplyLong:
+			if (a.IsInlineLong() && b.IsInlineLong()) { return Value(a.UncheckedLong() * b.UncheckedLong()); }
+			break;
+
+		case OpCode::MultiplyDouble:
+			if (a.IsDouble() && b.IsDouble()) { return Value(a.UncheckedDouble() * b.UncheckedDouble()); }
+			break;
+
+		case OpCode::DivideLong:
+			if (a.IsInlineLong() && b.IsInlineLong()) { return Value(a.UncheckedLong() / b.UncheckedLong()); }
+			break;
+
+		case OpCode::DivideDouble:
+			if (a.IsDouble() && b.IsDouble()) { return Value(a.UncheckedDouble() / b.UncheckedDouble()); }
+			break;
+
+		case OpCode::LessThanLong:
+			if (a.IsInlineLong() && b.IsInlineLong()) { return Value(a.UncheckedLong() < b.UncheckedLong()); }
+			break;
+
+		case OpCode::LessThanDouble:
+			if (a.IsDouble() && b.IsDouble()) { return Value(a.UncheckedDouble() < b.UncheckedDouble()); }
+			break;
+
+		case OpCode::LessThanEqualLong:
+			if (a.IsInlineLong() && b.IsInlineLong()) { return Value(a.UncheckedLong() <= b.UncheckedLong()); }
+			break;
+
+		case OpCode::LessThanEqualDouble:
+			if (a.IsDouble() && b.IsDouble()) { return Value(a.UncheckedDouble() <= b.UncheckedDouble()); }
+			break;
+
+		case OpCode::GreaterThanLong:
+			if (a.IsInlineLong() && b.IsInlineLong()) { return Value(a.UncheckedLong() > b.UncheckedLong()); }
+			break;
+
+		case OpCode::GreaterThanDouble:
+			if (a.IsDouble() && b.IsDouble()) { return Value(a.UncheckedDouble() > b.UncheckedDouble()); }
+			break;
+
+		case OpCode::GreaterThanEqualLong:
+			if (a.IsInlineLong() && b.IsInlineLong()) { return Value(a.UncheckedLong() >= b.UncheckedLong()); }
+			break;
+
+		case OpCode::GreaterThanEqualDouble:
+			if (a.IsDouble() && b.IsDouble()) { return Value(a.UncheckedDouble() >= b.UncheckedDouble()); }
+			break;
+
+		case OpCode::EqualLong:
+			if (a.IsInlineLong() && b.IsInlineLong()) { return Value(a.UncheckedLong() == b.UncheckedLong()); }
+			break;
+
+		case OpCode::EqualDouble:
+			if (a.IsDouble() && b.IsDouble()) { return Value(a.UncheckedDouble() == b.UncheckedDouble()); }
+			break;
+
+		case OpCode::NotEqualLong:
+			if (a.IsInlineLong() && b.IsInlineLong()) { return Value(a.UncheckedLong() != b.UncheckedLong()); }
+			break;
+
+		case OpCode::NotEqualDouble:
+			if (a.IsDouble() && b.IsDouble()) { return Value(a.UncheckedDouble() != b.UncheckedDouble()); }
+			break;
+
+		default:
+			break;
+		}
+
+		OpCode generic = GenericOperation(op);
+		op = Quicken(generic, a, b);
+		return BinaryOperation(generic, a, b);
+	}
+}
+
+// threaded dispatch needs the labels-as-values extension. define EXCLUDE_COMPUTED_GOTO to force the portable switch.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(EXCLUDE_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+
 #ifndef EXCLUDE_RAYLIB
-VM::VM() : ip(0), stack{ }, stackTop(stack), traceLog(""), error(""), windowActive(false), isDrawing(false)
+VM::VM(Backend backend) : backend(backend), verified(false), ip(0), traceLog(""), error(""), callDepth(0), callCapacity(CALL_STACK_INITIAL), windowActive(false), isDrawing(false)
 #else
-VM::VM() : ip(0), stack{ }, stackTop(stack), traceLog(""), error("")
+VM::VM(Backend backend) : backend(backend), verified(false), ip(0), traceLog(""), error(""), callDepth(0), callCapacity(CALL_STACK_INITIAL)
 #endif
 {
+#ifdef FIXED_STACK
+	stack = fixedStack;
+	callStack = fixedCallStack;
+#else
+	stack = new Value[STACK_INITIAL];
+	callStack = new size_t[CALL_STACK_INITIAL];
+#endif
+	stackTop = stack;
+	stackEnd = stack + STACK_INITIAL;
+#ifndef EXCLUDE_RAYLIB
+	BindRaylib();
+#endif
 }
 
 VM::~VM()
 {
-	while (stackTop > stack) { (--stackTop)->~Value(); }
+	while (stackTop > stack) { *--stackTop = Value(); }
+#ifndef FIXED_STACK
+	delete[] stack;
+	delete[] callStack;
+#endif
 #ifndef EXCLUDE_RAYLIB
 	if (windowActive)
 	{
@@ -26,58 +171,349 @@ VM::~VM()
 #endif
 }
 
-InterpretResult VM::Interpret(const std::string& source)
+InterpretResult VM::Interpret(const std::string& source, OptimizationLevel level)
 {
-	return Interpret(std::map<std::string, std::string>{ std::pair<std::string, std::string>{ "REPL", source } });
+	return Interpret(std::map<std::string, std::string>{ std::pair<std::string, std::string>{ "REPL", source } }, level);
 }
 
-InterpretResult VM::Interpret(const std::map<std::string, std::string>& sources)
+InterpretResult VM::Interpret(const std::map<std::string, std::string>& sources, OptimizationLevel level)
 {
-	using namespace std::string_literals;
+	Prepare();
+
+	switch (Linker(sources).Link(chunk, globalSlots, natives, level))
+	{
+	case BuildResult::CompilerError:
+		return InterpretResult::CompileError;
 
-	while (stackTop > stack) { (--stackTop)->~Value(); }
-	callStack.clear();
+	case BuildResult::LinkerError:
+		return InterpretResult::LinkerError;
+	}
 
-	ip = 0;
-	traceLog = ""s;
-	error = ""s;
+	return Start();
+}
 
-	switch (Linker(sources).Link(chunk))
+// links into a chunk of its own, so whatever the vm ran before is left as it was
+InterpretResult VM::Compile(const std::map<std::string, std::string>& sources, const std::string& path, OptimizationLevel level, bool meta)
+{
+	Chunk linked;
+	GlobalSlots slots;
+	switch (Linker(sources).Link(linked, slots, natives, level))
 	{
 	case BuildResult::CompilerError:
 		return InterpretResult::CompileError;
 
 	case BuildResult::LinkerError:
 		return InterpretResult::LinkerError;
+
+	default:
+		break;
+	}
+
+	return Image::Write(path, linked, slots, natives, meta) ? InterpretResult::Ok : InterpretResult::LinkerError;
+}
+
+// an image brings its own globals, so the ones from earlier runs are dropped
+InterpretResult VM::InterpretImage(const std::string& path)
+{
+	Prepare();
+
+	if (!image.Load(path, chunk, globalSlots, natives)) { return InterpretResult::LinkerError; }
+	globals.clear();
+	declared.clear();
+
+#ifndef NDEBUG
+	std::cerr << '\n';
+	chunk.Disassemble("code");
+#endif
+
+	return Start();
+}
+
+void VM::Prepare()
+{
+	using namespace std::string_literals;
+
+	while (stackTop > stack) { *--stackTop = Value(); }
+	callDepth = 0;
+
+	ip = 0;
+	traceLog = ""s;
+	error = ""s;
+}
+
+InterpretResult VM::Start()
+{
+	globals.resize(globalSlots.Size());
+	declared.resize(globalSlots.Size());
+
+	// a verified chunk gets all the stack it can use up front, so its pushes need no bounds check
+	Verifier verifier(chunk, STACK_MAX);
+	verified = verifier.Verify() && Reserve(verifier.Depth());
+#ifndef NDEBUG
+	if (!verified)
+	{
+		std::cerr << "Not verified, running with checks: " << verifier.Error() << '\n';
 	}
+#endif
 
 #ifndef EXCLUDE_RAYLIB
 	SetTraceLogLevel(LOG_NONE);
 #endif
 
-	uint8_t instruction;
-	for (;;)
+	if (backend == Backend::Tracing)
 	{
-		if (ip >= chunk.Size())
-		{
-			return InterpretResult::RuntimeError;
-		}
+		tracer.Reset(chunk.Size());
+	}
+	else if (backend == Backend::Register)
+	{
+		registers.Translate(chunk);
+#ifndef NDEBUG
+		registers.Disassemble();
+#endif
+	}
+
+#ifndef PROFILE_OPCODES
+	return RunBackend();
+#else
+	profileLength = 0;
+	instructionCount = 0;
+	moveCount = 0;
+	InterpretResult result = RunBackend();
+	ReportProfile();
+	return result;
+#endif
+}
+
+InterpretResult VM::RunBackend()
+{
+	switch (backend)
+	{
+	case Backend::Register:
+		return RunRegisters();
+
+	case Backend::Jit:
+		return RunJit();
+
+	default:
+		return verified ? Run<false, true>() : Run<false, false>();
+	}
+}
+
+InterpretResult VM::Step()
+{
+	return Run<true>();
+}
+
+InterpretResult VM::RunJit()
+{
+	if (!jit.Compile(*this))
+	{
+		return Run<false>();
+	}
+
+	InterpretResult result = jit.Run();
+#ifndef EXCLUDE_RAYLIB
+	if (result == InterpretResult::Ok && windowActive)
+	{
+		CloseWindow();
+	}
+#endif
+	return result;
+}
+
+// with singleStep set this returns Ok after the instruction at ip, so the jit can hand single instructions back to these handlers.
+// with unchecked set the stack depth and ip checks are compiled out, since the verifier has already proven them.
+template <bool singleStep, bool unchecked>
+InterpretResult VM::Run()
+{
+	using namespace std::string_literals;
+
+	const uint8_t* code = chunk.Code();
+	uint8_t instruction;
+
+#define READ_BYTE() (code[ip++])
+#define READ_LONG() (ip += 2, static_cast<uint16_t>((code[ip - 2] << 8) | code[ip - 1]))
+// a verified chunk had its whole stack reserved before it started
+#define RESERVE(count) \
+do \
+{ \
+	if (!unchecked && !Reserve(count)) \
+	{ \
+		error = "Stack overflow"s; \
+		return InterpretResult::RuntimeError; \
+	} \
+} while (false)
 
-		instruction = chunk.Read(ip);
 #ifndef NDEBUG
-		std::cerr << "\n          ";
-		for (Value* slot = stack; slot < stackTop; slot++)
-		{
-			std::cerr << "[ " << *slot << " ]";
-		}
-		std::cerr << '\n';
-		chunk.DisassembleInstruction(ip, 0);
-		std::cerr << '\n';
+#define TRACE_INSTRUCTION() \
+do \
+{ \
+	std::cerr << "\n          "; \
+	for (Value* slot = stack; slot < stackTop; slot++) \
+	{ \
+		std::cerr << "[ " << *slot << " ]"; \
+	} \
+	std::cerr << '\n'; \
+	chunk.DisassembleInstruction(ip, 0); \
+	std::cerr << '\n'; \
+} while (false)
+#else
+#define TRACE_INSTRUCTION() do { } while (false)
+#endif
+
+#ifdef PROFILE_OPCODES
+#define PROFILE_INSTRUCTION() Profile(ip)
+#else
+#define PROFILE_INSTRUCTION() do { } while (false)
 #endif
-		ip++;
+
+#define FETCH() \
+do \
+{ \
+	if (!unchecked && ip >= chunk.Size()) \
+	{ \
+		return InterpretResult::RuntimeError; \
+	} \
+	TRACE_INSTRUCTION(); \
+	PROFILE_INSTRUCTION(); \
+	instruction = READ_BYTE(); \
+} while (false)
+
+#ifdef COMPUTED_GOTO
+	// each handler jumps straight to the next one instead of going back through the switch,
+	// which gives every handler its own indirect branch. the switch is only used to enter the first handler.
+	// a single step never dispatches through the table, but its labels still have to be taken to count as used.
+	void* dispatchTable[UINT8_MAX + 1];
+	if constexpr (!singleStep)
+	{
+		std::fill(std::begin(dispatchTable), std::end(dispatchTable), &&op_Unknown);
+	}
+	else
+	{
+		(void)&&op_Unknown;
+	}
+
+#define DISPATCH_ENTRY(op) \
+	if constexpr (singleStep) { (void)&&op_##op; } \
+	else { dispatchTable[static_cast<uint8_t>(OpCode::op)] = &&op_##op; }
+	DISPATCH_ENTRY(Return);
+	DISPATCH_ENTRY(None);
+	DISPATCH_ENTRY(AsDouble);
+	DISPATCH_ENTRY(AsLong);
+	DISPATCH_ENTRY(AsString);
+	DISPATCH_ENTRY(Constant);
+	DISPATCH_ENTRY(ConstantLong);
+	DISPATCH_ENTRY(StoreGlobal);
+	DISPATCH_ENTRY(LoadGlobal);
+	DISPATCH_ENTRY(DelGlobal);
+	DISPATCH_ENTRY(CreateGlobal);
+	DISPATCH_ENTRY(Exponent);
+	DISPATCH_ENTRY(Negate);
+	DISPATCH_ENTRY(LogicalNot);
+	DISPATCH_ENTRY(Duplicate);
+	DISPATCH_ENTRY(Pop);
+	DISPATCH_ENTRY(Add);
+	DISPATCH_ENTRY(Subtract);
+	DISPATCH_ENTRY(Multiply);
+	DISPATCH_ENTRY(Divide);
+	DISPATCH_ENTRY(LessThan);
+	DISPATCH_ENTRY(LessThanEqual);
+	DISPATCH_ENTRY(GreaterThan);
+	DISPATCH_ENTRY(GreaterThanEqual);
+	DISPATCH_ENTRY(Equal);
+	DISPATCH_ENTRY(NotEqual);
+	DISPATCH_ENTRY(LogicalAnd);
+	DISPATCH_ENTRY(LogicalOr);
+	DISPATCH_ENTRY(Print);
+	DISPATCH_ENTRY(PrintLn);
+	DISPATCH_ENTRY(Trace);
+	DISPATCH_ENTRY(ShowTraceLog);
+	DISPATCH_ENTRY(ClearTraceLog);
+	DISPATCH_ENTRY(Jump);
+	DISPATCH_ENTRY(JumpIfFalse);
+	DISPATCH_ENTRY(JumpToCallStackAddress);
+	DISPATCH_ENTRY(PushJumpAddress);
+	DISPATCH_ENTRY(ForPrep);
+	DISPATCH_ENTRY(ForLoop);
+	DISPATCH_ENTRY(CallNative);
+	DISPATCH_ENTRY(GlobalArithConstant);
+	DISPATCH_ENTRY(GlobalsArithStore);
+	DISPATCH_ENTRY(CompareGlobalsJumpIfFalse);
+	DISPATCH_ENTRY(CompareGlobalConstantJumpIfFalse);
+	DISPATCH_ENTRY(AddLong);
+	DISPATCH_ENTRY(AddDouble);
+	DISPATCH_ENTRY(SubtractLong);
+	DISPATCH_ENTRY(SubtractDouble);
+	DISPATCH_ENTRY(MultiplyLong);
+	DISPATCH_ENTRY(MultiplyDouble);
+	DISPATCH_ENTRY(DivideLong);
+	DISPATCH_ENTRY(DivideDouble);
+	DISPATCH_ENTRY(LessThanLong);
+	DISPATCH_ENTRY(LessThanDouble);
+	DISPATCH_ENTRY(LessThanEqualLong);
+	DISPATCH_ENTRY(LessThanEqualDouble);
+	DISPATCH_ENTRY(GreaterThanLong);
+	DISPATCH_ENTRY(GreaterThanDouble);
+	DISPATCH_ENTRY(GreaterThanEqualLong);
+	DISPATCH_ENTRY(GreaterThanEqualDouble);
+	DISPATCH_ENTRY(EqualLong);
+	DISPATCH_ENTRY(EqualDouble);
+	DISPATCH_ENTRY(NotEqualLong);
+	DISPATCH_ENTRY(NotEqualDouble);
+	DISPATCH_ENTRY(AddLongLong);
+	DISPATCH_ENTRY(AddDoubleDouble);
+	DISPATCH_ENTRY(SubtractLongLong);
+	DISPATCH_ENTRY(SubtractDoubleDouble);
+	DISPATCH_ENTRY(MultiplyLongLong);
+	DISPATCH_ENTRY(MultiplyDoubleDouble);
+	DISPATCH_ENTRY(DivideLongLong);
+	DISPATCH_ENTRY(DivideDoubleDouble);
+	DISPATCH_ENTRY(LessThanLongLong);
+	DISPATCH_ENTRY(LessThanDoubleDouble);
+	DISPATCH_ENTRY(LessThanEqualLongLong);
+	DISPATCH_ENTRY(LessThanEqualDoubleDouble);
+	DISPATCH_ENTRY(GreaterThanLongLong);
+	DISPATCH_ENTRY(GreaterThanDoubleDouble);
+	DISPATCH_ENTRY(GreaterThanEqualLongLong);
+	DISPATCH_ENTRY(GreaterThanEqualDoubleDouble);
+	DISPATCH_ENTRY(EqualLongLong);
+	DISPATCH_ENTRY(EqualDoubleDouble);
+	DISPATCH_ENTRY(NotEqualLongLong);
+	DISPATCH_ENTRY(NotEqualDoubleDouble);
+#undef DISPATCH_ENTRY
+
+#define VM_CASE(op) case OpCode::op: op_##op
+#define VM_DEFAULT default: op_Unknown
+#define VM_NEXT() \
+do \
+{ \
+	if constexpr (singleStep) \
+	{ \
+		return InterpretResult::Ok; \
+	} \
+	else \
+	{ \
+		FETCH(); \
+		goto *dispatchTable[instruction]; \
+	} \
+} while (false)
+#else
+#define VM_CASE(op) case OpCode::op
+#define VM_DEFAULT default
+#define VM_NEXT() \
+if constexpr (singleStep) \
+{ \
+	return InterpretResult::Ok; \
+} \
+else break
+#endif
+
+	for (;;)
+	{
+		FETCH();
 		switch (static_cast<OpCode>(instruction))
 		{
-		case OpCode::Return:
+		VM_CASE(Return):
 #ifndef EXCLUDE_RAYLIB
 			if (windowActive)
 			{
@@ -86,22 +522,21 @@ InterpretResult VM::Interpret(const std::map<std::string, std::string>& sources)
 #endif
 			return InterpretResult::Ok;
 
-		case OpCode::None:
-			break;
+		VM_CASE(None):
+			VM_NEXT();
 
-		case OpCode::AsDouble:
+		VM_CASE(AsDouble):
 		{
-			if (stackTop - stack < 1)
+			if (!unchecked && stackTop - stack < 1)
 			{
 				error = "No value on stack to convert to double"s;
 				return InterpretResult::RuntimeError;
 			}
 			if (!stackTop[-1].Get<double>())
 			{
-				Value val = Pop();
-				if (val.Get<long>())
+				if (stackTop[-1].Get<long>())
 				{
-					Push(static_cast<double>(*val.Get<long>()));
+					stackTop[-1] = Value(static_cast<double>(*stackTop[-1].Get<long>()));
 				}
 				else
 				{
@@ -109,22 +544,21 @@ InterpretResult VM::Interpret(const std::map<std::string, std::string>& sources)
 					return InterpretResult::RuntimeError;
 				}
 			}
-			break;
+			VM_NEXT();
 		}
 
-		case OpCode::AsLong:
+		VM_CASE(AsLong):
 		{
-			if (stackTop - stack < 1)
+			if (!unchecked && stackTop - stack < 1)
 			{
 				error = "No value on stack to convert to long"s;
 				return InterpretResult::RuntimeError;
 			}
 			if (!stackTop[-1].Get<long>())
 			{
-				Value val = Pop();
-				if (val.Get<double>())
+				if (stackTop[-1].Get<double>())
 				{
-					Push(static_cast<long>(*val.Get<double>()));
+					stackTop[-1] = Value(static_cast<long>(*stackTop[-1].Get<double>()));
 				}
 				else
 				{
@@ -132,166 +566,103 @@ InterpretResult VM::Interpret(const std::map<std::string, std::string>& sources)
 					return InterpretResult::RuntimeError;
 				}
 			}
-			break;
+			VM_NEXT();
 		}
 
-		case OpCode::AsString:
+		VM_CASE(AsString):
 		{
-			if (stackTop - stack < 1)
+			if (!unchecked && stackTop - stack < 1)
 			{
 				error = "No value on stack to convert to double"s;
 				return InterpretResult::RuntimeError;
 			}
 			if (!stackTop[-1].Get<std::string>())
 			{
-				Push(Pop() + Value(""s));
-			}
-			break;
-		}
-
-		case OpCode::Constant:
-		{
-			Value constant = chunk.ReadConstant(chunk.Read(ip++));
-			if (!Push(constant))
-			{
-				error = Value("Invalid constant pushed to stack: '"s) + constant + "'"s;
-				return InterpretResult::RuntimeError;
+				stackTop[-1] = stackTop[-1] + Value(""s);
 			}
-			break;
+			VM_NEXT();
 		}
 
-		case OpCode::ConstantLong:
+		VM_CASE(Constant):
 		{
-			Value constant = chunk.ReadConstant(chunk.ReadLong(ip)); ip += 2;
-			if (!Push(constant))
+			RESERVE(1);
+			if (!Push(chunk.ReadConstant(READ_BYTE())))
 			{
-				error = Value("Invalid constant pushed to stack: '"s) + constant + "'"s;
+				error = Value("Invalid constant pushed to stack: '"s) + stackTop[-1] + "'"s;
 				return InterpretResult::RuntimeError;
 			}
-			break;
+			VM_NEXT();
 		}
 
-		case OpCode::Store:
+		VM_CASE(ConstantLong):
 		{
-			std::string loc = *chunk.ReadConstant(chunk.Read(ip++)).Get<std::string>();
-			if (stackTop - stack < 1)
-			{
-				error = "Not enough values on stack to store into variable '" + loc + '\'';
-				return InterpretResult::RuntimeError;
-			}
-			if (globals.find(loc) != globals.end())
-			{
-				globals[loc] = Pop();
-			}
-			else
+			RESERVE(1);
+			if (!Push(chunk.ReadConstant(READ_LONG())))
 			{
-				error = "Undeclared variable '" + loc + '\'';
+				error = Value("Invalid constant pushed to stack: '"s) + stackTop[-1] + "'"s;
 				return InterpretResult::RuntimeError;
 			}
-			break;
+			VM_NEXT();
 		}
 
-		case OpCode::StoreLong:
+		VM_CASE(StoreGlobal):
 		{
-			std::string loc = *chunk.ReadConstant(chunk.ReadLong(ip)).Get<std::string>(); ip += 2;
-			if (stackTop - stack < 1)
-			{
-				error = "Not enough values on stack to store into variable '" + loc + '\'';
-				return InterpretResult::RuntimeError;
-			}
-			if (globals.find(loc) != globals.end())
+			uint16_t slot = READ_LONG();
+			if (!unchecked && stackTop - stack < 1)
 			{
-				globals[loc] = Pop();
-			}
-			else
-			{
-				error = "Undeclared variable '" + loc + '\'';
+				error = "Not enough values on stack to store into variable '" + globalSlots.Name(slot) + '\'';
 				return InterpretResult::RuntimeError;
 			}
-			break;
-		}
-
-		case OpCode::Load:
-		{
-			std::string loc = *chunk.ReadConstant(chunk.Read(ip++)).Get<std::string>();
-			if (globals.find(loc) != globals.end())
+			if (declared[slot])
 			{
-				if (!Push(Value(globals[loc])))
-				{
-					error = "Invalid value in variable '" + loc + '\'';
-					return InterpretResult::RuntimeError;
-				}
+				globals[slot] = Pop();
 			}
 			else
 			{
-				error = "Undeclared variable '" + loc + '\'';
+				error = "Undeclared variable '" + globalSlots.Name(slot) + '\'';
 				return InterpretResult::RuntimeError;
 			}
-			break;
+			VM_NEXT();
 		}
 
-		case OpCode::LoadLong:
+		VM_CASE(LoadGlobal):
 		{
-			std::string loc = *chunk.ReadConstant(chunk.ReadLong(ip)).Get<std::string>(); ip += 2;
-			if (globals.find(loc) != globals.end())
+			uint16_t slot = READ_LONG();
+			RESERVE(1);
+			if (declared[slot])
 			{
-				if (!Push(Value(globals[loc])))
+				if (!Push(globals[slot]))
 				{
-					error = "Invalid value in variable '" + loc + '\'';
+					error = "Invalid value in variable '" + globalSlots.Name(slot) + '\'';
 					return InterpretResult::RuntimeError;
 				}
 			}
 			else
 			{
-				error = "Undeclared variable '" + loc + '\'';
+				error = "Undeclared variable '" + globalSlots.Name(slot) + '\'';
 				return InterpretResult::RuntimeError;
 			}
-			break;
-		}
-
-		case OpCode::Del:
-		{
-			std::string loc = *chunk.ReadConstant(chunk.Read(ip++)).Get<std::string>();
-			if (globals.find(loc) != globals.end())
-			{
-				globals.erase(loc);
-			}
-			break;
-		}
-
-		case OpCode::DelLong:
-		{
-			std::string loc = *chunk.ReadConstant(chunk.ReadLong(ip)).Get<std::string>(); ip += 2;
-			if (globals.find(loc) == globals.end())
-			{
-				globals.erase(loc);
-			}
-			break;
+			VM_NEXT();
 		}
 
-		case OpCode::Create:
+		VM_CASE(DelGlobal):
 		{
-			std::string loc = *chunk.ReadConstant(chunk.Read(ip++)).Get<std::string>();
-			if (globals.find(loc) == globals.end())
-			{
-				globals.insert(std::pair<std::string, Value>(loc, Value()));
-			}
-			break;
+			uint16_t slot = READ_LONG();
+			declared[slot] = false;
+			globals[slot] = Value();
+			VM_NEXT();
 		}
 
-		case OpCode::CreateLong:
+		VM_CASE(CreateGlobal):
 		{
-			std::string loc = *chunk.ReadConstant(chunk.ReadLong(ip)).Get<std::string>(); ip += 2;
-			if (globals.find(loc) != globals.end())
-			{
-				globals.insert(std::pair<std::string, Value>(loc, Value()));
-			}
-			break;
+			uint16_t slot = READ_LONG();
+			declared[slot] = true;
+			VM_NEXT();
 		}
 
-		case OpCode::Exponent:
+		VM_CASE(Exponent):
 		{
-			if (stackTop - stack < 2)
+			if (!unchecked && stackTop - stack < 2)
 			{
 				error = "Not enough values on stack to perform operation 'exponent'"s;
 				return InterpretResult::RuntimeError;
@@ -301,14 +672,13 @@ InterpretResult VM::Interpret(const std::map<std::string, std::string>& sources)
 				error = "Invalid arguments for operation 'exponent'"s;
 				return InterpretResult::RuntimeError;
 			}
-			double exponent = *Pop().Get<double>();
-			double base = *Pop().Get<double>();
-			Push(std::pow(base, exponent));
-			break;
+			stackTop[-2] = Value(std::pow(*stackTop[-2].Get<double>(), *stackTop[-1].Get<double>()));
+			Drop(1);
+			VM_NEXT();
 		}
 
-		case OpCode::Negate:
-			if (stackTop - stack < 1)
+		VM_CASE(Negate):
+			if (!unchecked && stackTop - stack < 1)
 			{
 				error = "No value on stack to numerically negate"s;
 				return InterpretResult::RuntimeError;
@@ -318,11 +688,11 @@ InterpretResult VM::Interpret(const std::map<std::string, std::string>& sources)
 				error = "Invalid argument for numerical negation"s;
 				return InterpretResult::RuntimeError;
 			}
-			Push(-Pop());
-			break;
+			stackTop[-1] = -stackTop[-1];
+			VM_NEXT();
 
-		case OpCode::LogicalNot:
-			if (stackTop - stack < 1)
+		VM_CASE(LogicalNot):
+			if (!unchecked && stackTop - stack < 1)
 			{
 				error = "No value on stack to logically negate"s;
 				return InterpretResult::RuntimeError;
@@ -332,994 +702,1384 @@ InterpretResult VM::Interpret(const std::map<std::string, std::string>& sources)
 				error = "Invalid argument for logical negation"s;
 				return InterpretResult::RuntimeError;
 			}
-			Push(!Pop());
-			break;
+			stackTop[-1] = !stackTop[-1];
+			VM_NEXT();
 
-		case OpCode::Duplicate:
-			if (stackTop - stack < 1)
+		VM_CASE(Duplicate):
+			if (!unchecked && stackTop - stack < 1)
 			{
 				error = "No value on stack to duplicate"s;
 				return InterpretResult::RuntimeError;
 			}
+			RESERVE(1);
 			// since stackTop refers to the next open stack slot, stackTop[-1] refers to the top stack item.
-			Push(Value(stackTop[-1]));
-			break;
+			Push(stackTop[-1]);
+			VM_NEXT();
 
-		case OpCode::Pop:
-			if (stackTop - stack < 1)
+		VM_CASE(Pop):
+			if (!unchecked && stackTop - stack < 1)
 			{
 				error = "No value on stack to pop"s;
 				return InterpretResult::RuntimeError;
 			}
-			stackTop[-1].~Value();
-			stackTop--;
-			break;
+			Drop(1);
+			VM_NEXT();
 
 #define BINARY_OP(op, opname) \
 do \
 { \
-	if (stackTop - stack < 2) \
+	if (!unchecked && stackTop - stack < 2) \
 	{ \
 		error = "Not enough values on stack to perform operation '"s + opname + "'"s; \
 		return InterpretResult::RuntimeError; \
 	} \
-	Value b = Pop(); \
-	Value a = Pop(); \
-	if (!Push(a op b)) \
+	Value result = stackTop[-2] op stackTop[-1]; \
+	if (!result.Valid()) \
 	{ \
 		error = "Invalid arguments for operation '"s + opname + "'"s; \
 		return InterpretResult::RuntimeError; \
 	} \
+	Drop(1); \
+	stackTop[-1] = std::move(result); \
 } while (false)
 
-		case OpCode::Add:
-			BINARY_OP(+, "add");
-			break;
-
-		case OpCode::Subtract:
-			BINARY_OP(-, "sub");
-			break;
+// arithmetic and comparisons rewrite themselves into the specialized opcode for the operand types they see.
+#define QUICKENING_BINARY_OP(opcode) \
+do \
+{ \
+	if (!unchecked && stackTop - stack < 2) \
+	{ \
+		error = "Not enough values on stack to perform operation '"s + OperationName(opcode) + "'"s; \
+		return InterpretResult::RuntimeError; \
+	} \
+	OpCode quick = opcode; \
+	Value result = QuickOperation(quick, stackTop[-2], stackTop[-1]); \
+	if (quick != opcode) { chunk.Modify(ip - 1, static_cast<uint8_t>(quick)); } \
+	if (!result.Valid()) \
+	{ \
+		error = "Invalid arguments for operation '"s + OperationName(opcode) + "'"s; \
+		return InterpretResult::RuntimeError; \
+	} \
+	Drop(1); \
+	stackTop[-1] = std::move(result); \
+} while (false)
 
-		case OpCode::Multiply:
-			BINARY_OP(*, "mul");
-			break;
+// the operands are inline longs or doubles and own nothing, so the slot left above the stack top needs no clearing.
+#define QUICK_BINARY_OP(opcode, test, get, op) \
+do \
+{ \
+	if ((unchecked || stackTop - stack >= 2) && stackTop[-2].test() && stackTop[-1].test()) \
+	{ \
+		stackTop[-2] = Value(stackTop[-2].get() op stackTop[-1].get()); \
+		stackTop--; \
+	} \
+	else \
+	{ \
+		QUICKENING_BINARY_OP(OpCode::opcode); \
+	} \
+} while (false)
 
-		case OpCode::Divide:
-			BINARY_OP(/, "div");
-			break;
+		VM_CASE(Add):
+			QUICKENING_BINARY_OP(OpCode::Add);
+			VM_NEXT();
 
-		case OpCode::LessThan:
-			BINARY_OP(<, "lt");
-			break;
+		VM_CASE(Subtract):
+			QUICKENING_BINARY_OP(OpCode::Subtract);
+			VM_NEXT();
 
-		case OpCode::LessThanEqual:
-			BINARY_OP(<=, "lte");
-			break;
+		VM_CASE(Multiply):
+			QUICKENING_BINARY_OP(OpCode::Multiply);
+			VM_NEXT();
 
-		case OpCode::GreaterThan:
-			BINARY_OP(>, "gt");
-			break;
+		VM_CASE(Divide):
+			QUICKENING_BINARY_OP(OpCode::Divide);
+			VM_NEXT();
 
-		case OpCode::GreaterThanEqual:
-			BINARY_OP(>=, "gte");
-			break;
+		VM_CASE(LessThan):
+			QUICKENING_BINARY_OP(OpCode::LessThan);
+			VM_NEXT();
 
-		case OpCode::Equal:
-			BINARY_OP(==, "eq");
-			break;
+		VM_CASE(LessThanEqual):
+			QUICKENING_BINARY_OP(OpCode::LessThanEqual);
+			VM_NEXT();
 
-		case OpCode::NotEqual:
-			BINARY_OP(!=, "neq");
-			break;
+		VM_CASE(GreaterThan):
+			QUICKENING_BINARY_OP(OpCode::GreaterThan);
+			VM_NEXT();
+
+		VM_CASE(GreaterThanEqual):
+			QUICKENING_BINARY_OP(OpCode::GreaterThanEqual);
+			VM_NEXT();
+
+		VM_CASE(Equal):
+			QUICKENING_BINARY_OP(OpCode::Equal);
+			VM_NEXT();
 
-		case OpCode::LogicalAnd:
+		VM_CASE(NotEqual):
+			QUICKENING_BINARY_OP(OpCode::NotEqual);
+			VM_NEXT();
+
+		VM_CASE(LogicalAnd):
 			BINARY_OP(&&, "and");
-			break;
+			VM_NEXT();
 
-		case OpCode::LogicalOr:
+		VM_CASE(LogicalOr):
 			BINARY_OP(||, "or");
-			break;
+			VM_NEXT();
+
+		VM_CASE(AddLong):
+			QUICK_BINARY_OP(AddLong, IsInlineLong, UncheckedLong, +);
+			VM_NEXT();
+
+		VM_CASE(AddDouble):
+			QUICK_BINARY_OP(AddDouble, IsDouble, UncheckedDouble, +);
+			VM_NEXT();
+
+		VM_CASE(SubtractLong):
+			QUICK_BINARY_OP(SubtractLong, IsInlineLong, UncheckedLong, -);
+			VM_NEXT();
+
+		VM_CASE(SubtractDouble):
+			QUICK_BINARY_OP(SubtractDouble, IsDouble, UncheckedDouble, -);
+			VM_NEXT();
+
+		VM_CASE(MultiplyLong):
+			QUICK_BINARY_OP(MultiplyLong, IsInlineLong, UncheckedLong, *);
+			VM_NEXT();
+
+		VM_CASE(MultiplyDouble):
+			QUICK_BINARY_OP(MultiplyDouble, IsDouble, UncheckedDouble, *);
+			VM_NEXT();
+
+		VM_CASE(DivideLong):
+			QUICK_BINARY_OP(DivideLong, IsInlineLong, UncheckedLong, /);
+			VM_NEXT();
+
+		VM_CASE(DivideDouble):
+			QUICK_BINARY_OP(DivideDouble, IsDouble, UncheckedDouble, /);
+			VM_NEXT();
+
+		VM_CASE(LessThanLong):
+			QUICK_BINARY_OP(LessThanLong, IsInlineLong, UncheckedLong, <);
+			VM_NEXT();
+
+		VM_CASE(LessThanDouble):
+			QUICK_BINARY_OP(LessThanDouble, IsDouble, UncheckedDouble, <);
+			VM_NEXT();
+
+		VM_CASE(LessThanEqualLong):
+			QUICK_BINARY_OP(LessThanEqualLong, IsInlineLong, UncheckedLong, <=);
+			VM_NEXT();
+
+		VM_CASE(LessThanEqualDouble):
+			QUICK_BINARY_OP(LessThanEqualDouble, IsDouble, UncheckedDouble, <=);
+			VM_NEXT();
+
+		VM_CASE(GreaterThanLong):
+			QUICK_BINARY_OP(GreaterThanLong, IsInlineLong, UncheckedLong, >);
+			VM_NEXT();
+
+		VM_CASE(GreaterThanDouble):
+			QUICK_BINARY_OP(GreaterThanDouble, IsDouble, UncheckedDouble, >);
+			VM_NEXT();
+
+		VM_CASE(GreaterThanEqualLong):
+			QUICK_BINARY_OP(GreaterThanEqualLong, IsInlineLong, UncheckedLong, >=);
+			VM_NEXT();
+
+		VM_CASE(GreaterThanEqualDouble):
+			QUICK_BINARY_OP(GreaterThanEqualDouble, IsDouble, UncheckedDouble, >=);
+			VM_NEXT();
+
+		VM_CASE(EqualLong):
+			QUICK_BINARY_OP(EqualLong, IsInlineLong, UncheckedLong, ==);
+			VM_NEXT();
+
+		VM_CASE(EqualDouble):
+			QUICK_BINARY_OP(EqualDouble, IsDouble, UncheckedDouble, ==);
+			VM_NEXT();
+
+		VM_CASE(NotEqualLong):
+			QUICK_BINARY_OP(NotEqualLong, IsInlineLong, UncheckedLong, !=);
+			VM_NEXT();
+
+		VM_CASE(NotEqualDouble):
+			QUICK_BINARY_OP(NotEqualDouble, IsDouble, UncheckedDouble, !=);
+			VM_NEXT();
+
+// the type inference pass only writes these where both operands were pushed on every path with the proven type.
+// a long operand can still be boxed, so the slot above the result is cleared rather than just popped.
+#define SPECIALIZED_LONG_OP(op) \
+do \
+{ \
+	stackTop[-2] = Value(stackTop[-2].ProvenLong() op stackTop[-1].ProvenLong()); \
+	*--stackTop = Value(); \
+} while (false)
+
+#define SPECIALIZED_DOUBLE_OP(op) \
+do \
+{ \
+	stackTop[-2] = Value(stackTop[-2].UncheckedDouble() op stackTop[-1].UncheckedDouble()); \
+	stackTop--; \
+} while (false)
+
+		VM_CASE(AddLongLong):
+			SPECIALIZED_LONG_OP(+);
+			VM_NEXT();
+
+		VM_CASE(AddDoubleDouble):
+			SPECIALIZED_DOUBLE_OP(+);
+			VM_NEXT();
+
+		VM_CASE(SubtractLongLong):
+			SPECIALIZED_LONG_OP(-);
+			VM_NEXT();
+
+		VM_CASE(SubtractDoubleDouble):
+			SPECIALIZED_DOUBLE_OP(-);
+			VM_NEXT();
+
+		VM_CASE(MultiplyLongLong):
+			SPECIALIZED_LONG_OP(*);
+			VM_NEXT();
+
+		VM_CASE(MultiplyDoubleDouble):
+			SPECIALIZED_DOUBLE_OP(*);
+			VM_NEXT();
+
+		VM_CASE(DivideLongLong):
+			SPECIALIZED_LONG_OP(/);
+			VM_NEXT();
+
+		VM_CASE(DivideDoubleDouble):
+			SPECIALIZED_DOUBLE_OP(/);
+			VM_NEXT();
+
+		VM_CASE(LessThanLongLong):
+			SPECIALIZED_LONG_OP(<);
+			VM_NEXT();
+
+		VM_CASE(LessThanDoubleDouble):
+			SPECIALIZED_DOUBLE_OP(<);
+			VM_NEXT();
+
+		VM_CASE(LessThanEqualLongLong):
+			SPECIALIZED_LONG_OP(<=);
+			VM_NEXT();
+
+		VM_CASE(LessThanEqualDoubleDouble):
+			SPECIALIZED_DOUBLE_OP(<=);
+			VM_NEXT();
+
+		VM_CASE(GreaterThanLongLong):
+			SPECIALIZED_LONG_OP(>);
+			VM_NEXT();
+
+		VM_CASE(GreaterThanDoubleDouble):
+			SPECIALIZED_DOUBLE_OP(>);
+			VM_NEXT();
+
+		VM_CASE(GreaterThanEqualLongLong):
+			SPECIALIZED_LONG_OP(>=);
+			VM_NEXT();
+
+		VM_CASE(GreaterThanEqualDoubleDouble):
+			SPECIALIZED_DOUBLE_OP(>=);
+			VM_NEXT();
+
+		VM_CASE(EqualLongLong):
+			SPECIALIZED_LONG_OP(==);
+			VM_NEXT();
 
+		VM_CASE(EqualDoubleDouble):
+			SPECIALIZED_DOUBLE_OP(==);
+			VM_NEXT();
+
+		VM_CASE(NotEqualLongLong):
+			SPECIALIZED_LONG_OP(!=);
+			VM_NEXT();
+
+		VM_CASE(NotEqualDoubleDouble):
+			SPECIALIZED_DOUBLE_OP(!=);
+			VM_NEXT();
+
+#undef SPECIALIZED_DOUBLE_OP
+#undef SPECIALIZED_LONG_OP
+
+#undef QUICK_BINARY_OP
+#undef QUICKENING_BINARY_OP
 #undef BINARY_OP
 
-		case OpCode::Print:
-			if (stackTop - stack < 1)
+		VM_CASE(Print):
+			if (!unchecked && stackTop - stack < 1)
 			{
 				error = "No value on the stack to print"s;
 				return InterpretResult::RuntimeError;
 			}
-			std::cout << Pop();
-			break;
+			std::cout << stackTop[-1];
+			Drop(1);
+			VM_NEXT();
 
-		case OpCode::PrintLn:
-			if (stackTop - stack < 1)
+		VM_CASE(PrintLn):
+			if (!unchecked && stackTop - stack < 1)
 			{
 				error = "No value on the stack to println"s;
 				return InterpretResult::RuntimeError;
 			}
-			std::cout << Pop() << '\n';
-			break;
+			std::cout << stackTop[-1] << '\n';
+			Drop(1);
+			VM_NEXT();
 
-		case OpCode::Trace:
-			if (stackTop - stack < 1)
+		VM_CASE(Trace):
+			if (!unchecked && stackTop - stack < 1)
 			{
 				error = "No value on the stack to trace"s;
 				return InterpretResult::RuntimeError;
 			}
 			traceLog = traceLog + stackTop[-1] + "\n"s;
-			break;
+			VM_NEXT();
 
-		case OpCode::ShowTraceLog:
+		VM_CASE(ShowTraceLog):
 			std::cout << traceLog;
-			break;
+			VM_NEXT();
 
-		case OpCode::ClearTraceLog:
+		VM_CASE(ClearTraceLog):
 			traceLog = ""s;
-			break;
+			VM_NEXT();
 
-		case OpCode::Jump:
+		VM_CASE(Jump):
 		{
-			int16_t offset = static_cast<int16_t>(chunk.ReadLong(ip)); ip += 2;
+			int16_t offset = static_cast<int16_t>(READ_LONG());
 			ip += offset;
-			break;
+			// every while loop is closed by a backward jump, do loops by ForLoop
+			if (!singleStep && offset < 0 && backend == Backend::Tracing)
+			{
+				InterpretResult result = tracer.Loop(*this, ip - offset);
+				if (result != InterpretResult::Ok)
+				{
+					return result;
+				}
+			}
+			VM_NEXT();
 		}
 
-		case OpCode::JumpIfFalse:
+		VM_CASE(JumpIfFalse):
 		{
-			if (stackTop - stack < 1)
+			if (!unchecked && stackTop - stack < 1)
 			{
 				error = "No value on the stack for a conditional statement"s;
 				return InterpretResult::RuntimeError;
 			}
-			int16_t offset = static_cast<int16_t>(chunk.ReadLong(ip)); ip += 2;
-			Value condition = Pop();
-			if (condition.Get<bool>())
+			int16_t offset = static_cast<int16_t>(READ_LONG());
+			if (stackTop[-1].Get<bool>())
 			{
-				if (!*condition.Get<bool>()) { ip += offset; }
+				if (!*stackTop[-1].Get<bool>()) { ip += offset; }
+				Drop(1);
 			}
 			else
 			{
 				error = "Invalid arguments for conditional"s;
 				return InterpretResult::RuntimeError;
 			}
-			Value tmp, tmp2, tmp3;
-			break;
+			VM_NEXT();
 		}
 
-		case OpCode::JumpToCallStackAddress:
-			if (callStack.empty())
+		VM_CASE(JumpToCallStackAddress):
+			if (callDepth == 0)
 			{
 				error = "Call stack is empty, cannot jump"s;
 				return InterpretResult::RuntimeError;
 			}
-			ip = callStack.back();
-			callStack.pop_back();
-			break;
+			ip = callStack[--callDepth];
+			VM_NEXT();
 
-		case OpCode::PushJumpAddress:
-			callStack.push_back(ip + 3);
-			break;
-
-#ifndef EXCLUDE_RAYLIB
-		case OpCode::InitWindow:
-		{
-			if (stackTop - stack < 3)
+		VM_CASE(PushJumpAddress):
+			if (callDepth == callCapacity && !GrowCallStack())
 			{
-				error = "Not enough values on the stack to init window"s;
+				error = "Call stack overflow"s;
 				return InterpretResult::RuntimeError;
 			}
-			if (!stackTop[-1].Get<std::string>() || !stackTop[-2].Get<long>() || !stackTop[-3].Get<long>())
-			{
-				error = "Invalid arguments for init window"s;
-				return InterpretResult::RuntimeError;
-			}
-			std::string title = *Pop().Get<std::string>();
-			long height = *Pop().Get<long>();
-			long width = *Pop().Get<long>();
-			InitWindow(width, height, title.c_str());
-			windowActive = true;
-			break;
-		}
+			callStack[callDepth++] = ip + 3;
+			VM_NEXT();
 
-		case OpCode::WindowShouldClose:
-			if (!windowActive)
+		VM_CASE(ForPrep):
+		{
+			uint16_t counter = READ_LONG();
+			uint16_t limit = READ_LONG();
+			int16_t offset = static_cast<int16_t>(READ_LONG());
+			if (!unchecked && stackTop - stack < 2)
 			{
-				error = "Window not active"s;
+				// the start is stored before the limit, so it is the limit that is missing if there is one value
+				uint16_t missing = stackTop > stack ? limit : counter;
+				if (stackTop > stack) { globals[counter] = Pop(); }
+				error = "Not enough values on stack to store into variable '" + globalSlots.Name(missing) + '\'';
 				return InterpretResult::RuntimeError;
 			}
-			Push(WindowShouldClose());
-			break;
-
-		case OpCode::CloseWindow:
-			if (!windowActive)
+			globals[counter] = Pop();
+			globals[limit] = Pop();
+			std::optional<bool> condition = BinaryOperation(OpCode::GreaterThan, globals[limit], globals[counter]).Get<bool>();
+			if (!condition)
 			{
-				error = "Window not active"s;
+				error = "Invalid arguments for operation '"s + OperationName(OpCode::GreaterThan) + "'"s;
 				return InterpretResult::RuntimeError;
 			}
-			CloseWindow();
-			windowActive = false;
-			break;
+			if (!*condition) { ip += offset; }
+			VM_NEXT();
+		}
 
-		case OpCode::ShowCursor:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
+		VM_CASE(ForLoop):
+		{
+			uint16_t counter = READ_LONG();
+			uint16_t limit = READ_LONG();
+			int16_t offset = static_cast<int16_t>(READ_LONG());
+			bool repeat;
+			if (!LoopStep(counter, limit, repeat)) { return InterpretResult::RuntimeError; }
+			if (repeat)
+			{
+				ip += offset;
+				if (!singleStep && backend == Backend::Tracing)
+				{
+					InterpretResult result = tracer.Loop(*this, ip - offset);
+					if (result != InterpretResult::Ok)
+					{
+						return result;
+					}
+				}
 			}
-			ShowCursor();
-			break;
+			VM_NEXT();
+		}
 
-		case OpCode::HideCursor:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			HideCursor();
-			break;
+		VM_CASE(CallNative):
+		{
+			uint16_t index = READ_LONG();
+			// the counts that follow are there for the verifier, the registry has them too
+			ip += 2;
+			if (!CallNative(index)) { return InterpretResult::RuntimeError; }
+			VM_NEXT();
+		}
 
-		case OpCode::ClearBackground:
+		// superinstructions leave ip where the fused sequence would have if it fails part way through,
+		// so error lines match the unfused code. their operation byte is quickened like a standalone instruction.
+		VM_CASE(GlobalArithConstant):
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!isDrawing)
-			{
-				error = "Not drawing"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 4)
+			size_t start = ip - 1;
+			uint8_t span = READ_BYTE();
+			OpCode op = static_cast<OpCode>(READ_BYTE());
+			uint16_t slot = READ_LONG();
+			const Value& constant = chunk.ReadConstant(READ_LONG());
+			if (!declared[slot] || !globals[slot].Valid())
 			{
-				error = "Not enough values on stack to clear background"s;
+				ip = start + 3;
+				error = (declared[slot] ? "Invalid value in variable '" : "Undeclared variable '") + globalSlots.Name(slot) + '\'';
 				return InterpretResult::RuntimeError;
 			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>() || !stackTop[-3].Get<long>() || !stackTop[-4].Get<long>())
+			OpCode quick = op;
+			Value result = QuickOperation(quick, globals[slot], constant);
+			if (quick != op) { chunk.Modify(start + 2, static_cast<uint8_t>(quick)); }
+			if (!result.Valid())
 			{
-				error = "Invalid arguments for clear background"s;
+				ip = start + span - 3;
+				error = "Invalid arguments for operation '"s + OperationName(op) + "'"s;
 				return InterpretResult::RuntimeError;
 			}
-			long a = *Pop().Get<long>();
-			long b = *Pop().Get<long>();
-			long g = *Pop().Get<long>();
-			long r = *Pop().Get<long>();
-			ClearBackground(Color{ static_cast<unsigned char>(r), static_cast<unsigned char>(g), static_cast<unsigned char>(b), static_cast<unsigned char>(a) });
-			break;
+			globals[slot] = std::move(result);
+			ip = start + span;
+			VM_NEXT();
 		}
 
-		case OpCode::BeginDrawing:
-			if (!windowActive)
+		VM_CASE(GlobalsArithStore):
+		{
+			size_t start = ip - 1;
+			uint8_t span = READ_BYTE();
+			OpCode op = static_cast<OpCode>(READ_BYTE());
+			uint16_t a = READ_LONG();
+			uint16_t b = READ_LONG();
+			uint16_t c = READ_LONG();
+			if (!declared[a] || !globals[a].Valid())
 			{
-				error = "Window not active"s;
+				ip = start + 3;
+				error = (declared[a] ? "Invalid value in variable '" : "Undeclared variable '") + globalSlots.Name(a) + '\'';
 				return InterpretResult::RuntimeError;
 			}
-			if (isDrawing)
+			if (!declared[b] || !globals[b].Valid())
 			{
-				error = "Already drawing"s;
+				ip = start + 6;
+				error = (declared[b] ? "Invalid value in variable '" : "Undeclared variable '") + globalSlots.Name(b) + '\'';
 				return InterpretResult::RuntimeError;
 			}
-			BeginDrawing();
-			isDrawing = true;
-			break;
-
-		case OpCode::EndDrawing:
-			if (!windowActive)
+			OpCode quick = op;
+			Value result = QuickOperation(quick, globals[a], globals[b]);
+			if (quick != op) { chunk.Modify(start + 2, static_cast<uint8_t>(quick)); }
+			if (!result.Valid())
 			{
-				error = "Window not active"s;
+				ip = start + 7;
+				error = "Invalid arguments for operation '"s + OperationName(op) + "'"s;
 				return InterpretResult::RuntimeError;
 			}
-			if (!isDrawing)
+			if (!declared[c])
 			{
-				error = "Not drawing"s;
+				ip = start + span;
+				error = "Undeclared variable '" + globalSlots.Name(c) + '\'';
 				return InterpretResult::RuntimeError;
 			}
-			EndDrawing();
-			isDrawing = false;
-			break;
+			globals[c] = std::move(result);
+			ip = start + span;
+			VM_NEXT();
+		}
 
-		case OpCode::SetTargetFPS:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 1)
+		VM_CASE(CompareGlobalsJumpIfFalse):
+		{
+			size_t start = ip - 1;
+			uint8_t span = READ_BYTE();
+			OpCode op = static_cast<OpCode>(READ_BYTE());
+			uint16_t a = READ_LONG();
+			uint16_t b = READ_LONG();
+			int16_t offset = static_cast<int16_t>(READ_LONG());
+			if (!declared[a] || !globals[a].Valid())
 			{
-				error = "No value on stack to set target fps"s;
+				ip = start + 3;
+				error = (declared[a] ? "Invalid value in variable '" : "Undeclared variable '") + globalSlots.Name(a) + '\'';
 				return InterpretResult::RuntimeError;
 			}
-			if (!stackTop[-1].Get<long>())
+			if (!declared[b] || !globals[b].Valid())
 			{
-				error = "Invalid arguments for set target fps"s;
+				ip = start + 6;
+				error = (declared[b] ? "Invalid value in variable '" : "Undeclared variable '") + globalSlots.Name(b) + '\'';
 				return InterpretResult::RuntimeError;
 			}
-			SetTargetFPS(*Pop().Get<long>());
-			break;
-
-		case OpCode::GetTime:
-			if (!windowActive)
+			OpCode quick = op;
+			std::optional<bool> condition = QuickOperation(quick, globals[a], globals[b]).Get<bool>();
+			if (quick != op) { chunk.Modify(start + 2, static_cast<uint8_t>(quick)); }
+			if (!condition)
 			{
-				error = "Window not active"s;
+				ip = start + 7;
+				error = "Invalid arguments for operation '"s + OperationName(op) + "'"s;
 				return InterpretResult::RuntimeError;
 			}
-			Push(GetTime());
-			break;
+			ip = start + span;
+			if (!*condition) { ip += offset; }
+			VM_NEXT();
+		}
 
-		case OpCode::GetRandomValue:
+		VM_CASE(CompareGlobalConstantJumpIfFalse):
 		{
-			if (!windowActive)
+			size_t start = ip - 1;
+			uint8_t span = READ_BYTE();
+			OpCode op = static_cast<OpCode>(READ_BYTE());
+			uint16_t slot = READ_LONG();
+			const Value& constant = chunk.ReadConstant(READ_LONG());
+			int16_t offset = static_cast<int16_t>(READ_LONG());
+			if (!declared[slot] || !globals[slot].Valid())
 			{
-				error = "Window not active"s;
+				ip = start + 3;
+				error = (declared[slot] ? "Invalid value in variable '" : "Undeclared variable '") + globalSlots.Name(slot) + '\'';
 				return InterpretResult::RuntimeError;
 			}
-			if (stackTop - stack < 2)
+			OpCode quick = op;
+			std::optional<bool> condition = QuickOperation(quick, globals[slot], constant).Get<bool>();
+			if (quick != op) { chunk.Modify(start + 2, static_cast<uint8_t>(quick)); }
+			if (!condition)
 			{
-				error = "Not enough values on stack to get random value"s;
+				ip = start + span - 3;
+				error = "Invalid arguments for operation '"s + OperationName(op) + "'"s;
 				return InterpretResult::RuntimeError;
 			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>())
-			{
-				error = "Invalid arguments for get random value"s;
-				return InterpretResult::RuntimeError;
-			}
-			long max = *Pop().Get<long>();
-			long min = *Pop().Get<long>();
-			Push(static_cast<long>(GetRandomValue(min, max)));
-			break;
+			ip = start + span;
+			if (!*condition) { ip += offset; }
+			VM_NEXT();
 		}
 
-		case OpCode::IsKeyPressed:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 1)
-			{
-				error = "No value on stack to check if key is pressed"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>())
-			{
-				error = "Invalid arguments for is key pressed"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(IsKeyPressed(*Pop().Get<long>()));
-			break;
+		VM_DEFAULT:
+			error = "Unknown instruction"s;
+			return InterpretResult::RuntimeError;
+		}
+	}
 
-		case OpCode::IsKeyDown:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 1)
-			{
-				error = "No value on stack to check if key is down"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>())
-			{
-				error = "Invalid arguments for is key down"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(IsKeyDown(*Pop().Get<long>()));
-			break;
+#undef VM_NEXT
+#undef VM_DEFAULT
+#undef VM_CASE
+#undef FETCH
+#undef PROFILE_INSTRUCTION
+#undef TRACE_INSTRUCTION
+#undef RESERVE
+#undef READ_LONG
+#undef READ_BYTE
+}
 
-		case OpCode::IsKeyReleased:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 1)
-			{
-				error = "No value on stack to check if key is released"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>())
-			{
-				error = "Invalid arguments for is key released"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(IsKeyReleased(*Pop().Get<long>()));
-			break;
+// the increment and test of a do loop, in the order the loads and stores they replaced failed in.
+// loops over longs, which is nearly all of them, skip the generic operations.
+// ip is just past the ForLoop. the test used to run in the loop's header, so when it fails ip follows the jump back to
+// the end of the ForPrep, which carries the header's line.
+inline bool VM::LoopStep(uint16_t counter, uint16_t limit, bool& repeat)
+{
+	using namespace std::string_literals;
 
-		case OpCode::IsKeyUp:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 1)
-			{
-				error = "No value on stack to check if key is up"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>())
-			{
-				error = "Invalid arguments for is key up"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(IsKeyUp(*Pop().Get<long>()));
-			break;
+	Value& count = globals[counter];
+	if (!declared[counter] || !count.Valid())
+	{
+		error = (declared[counter] ? "Invalid value in variable '" : "Undeclared variable '") + globalSlots.Name(counter) + '\'';
+		return false;
+	}
+	if (count.IsInlineLong() && declared[limit] && globals[limit].IsInlineLong())
+	{
+		long next = count.UncheckedLong() + 1;
+		count = Value(next);
+		repeat = globals[limit].UncheckedLong() > next;
+		return true;
+	}
 
-		case OpCode::GetKeyPressed:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(static_cast<long>(GetKeyPressed()));
-			break;
+	Value next = BinaryOperation(OpCode::Add, count, Value(1L));
+	if (!next.Valid())
+	{
+		error = "Invalid arguments for operation '"s + OperationName(OpCode::Add) + "'"s;
+		return false;
+	}
+	count = std::move(next);
+	if (!declared[limit] || !globals[limit].Valid())
+	{
+		ip += static_cast<int16_t>(chunk.ReadLong(ip - 2));
+		error = (declared[limit] ? "Invalid value in variable '" : "Undeclared variable '") + globalSlots.Name(limit) + '\'';
+		return false;
+	}
+	std::optional<bool> condition = BinaryOperation(OpCode::GreaterThan, globals[limit], count).Get<bool>();
+	if (!condition)
+	{
+		ip += static_cast<int16_t>(chunk.ReadLong(ip - 2));
+		error = "Invalid arguments for operation '"s + OperationName(OpCode::GreaterThan) + "'"s;
+		return false;
+	}
+	repeat = *condition;
+	return true;
+}
 
-		case OpCode::SetExitKey:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 1)
-			{
-				error = "No value on stack to set as exit key"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>())
-			{
-				error = "Invalid arguments for set exit key"s;
-				return InterpretResult::RuntimeError;
-			}
-			SetExitKey(*Pop().Get<long>());
-			break;
+// operand access is on every path through the register loop, so it is kept inline.
+inline const Value* VM::ReadOperand(const Operand& operand, Value* base)
+{
+	switch (operand.kind)
+	{
+	case Operand::Kind::Register:
+		return base + operand.index;
 
-		case OpCode::IsMouseButtonPressed:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 1)
-			{
-				error = "No value on stack to check if mouse button is pressed"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>())
-			{
-				error = "Invalid arguments for is mouse button pressed"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(IsMouseButtonPressed(*Pop().Get<long>()));
-			break;
+	case Operand::Kind::Constant:
+		return &chunk.ReadConstant(static_cast<uint16_t>(operand.index));
 
-		case OpCode::IsMouseButtonDown:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 1)
-			{
-				error = "No value on stack to check if mouse button is down"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>())
-			{
-				error = "Invalid arguments for is mouse button down"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(IsMouseButtonDown(*Pop().Get<long>()));
-			break;
+	case Operand::Kind::Global:
+		if (declared[operand.index] && globals[operand.index].Valid())
+		{
+			return &globals[operand.index];
+		}
+		ip = operand.ip;
+		error = (declared[operand.index] ? "Invalid value in variable '" : "Undeclared variable '") + globalSlots.Name(operand.index) + '\'';
+		return nullptr;
+
+	default:
+		ip = operand.ip;
+		error = std::string("Unknown instruction");
+		return nullptr;
+	}
+}
 
-		case OpCode::IsMouseButtonReleased:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 1)
-			{
-				error = "No value on stack to check if mouse button is released"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>())
-			{
-				error = "Invalid arguments for is mouse button released"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(IsMouseButtonReleased(*Pop().Get<long>()));
-			break;
+inline bool VM::WriteOperand(const RegInstruction& instruction, Value* base, Value&& value)
+{
+	if (instruction.dst.kind == Operand::Kind::Register)
+	{
+		base[instruction.dst.index] = std::move(value);
+		return true;
+	}
+	if (!declared[instruction.dst.index])
+	{
+		ip = instruction.storeIp;
+		error = "Undeclared variable '" + globalSlots.Name(instruction.dst.index) + '\'';
+		return false;
+	}
+	globals[instruction.dst.index] = std::move(value);
+	return true;
+}
 
-		case OpCode::IsMouseButtonUp:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 1)
-			{
-				error = "No value on stack to check if mouse button is up"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>())
-			{
-				error = "Invalid arguments for is mouse button up"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(IsMouseButtonUp(*Pop().Get<long>()));
-			break;
+InterpretResult VM::RunRegisters()
+{
+	using namespace std::string_literals;
 
-		case OpCode::GetMouseX:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(static_cast<long>(GetMouseX()));
-			break;
+	const RegInstruction* code = registers.Code();
+	const RegInstruction* instruction = code;
+	// registers are stack slots counted from where the stack top was when the current block started.
+	// every block has room for the most registers any block uses made before it starts.
+	const size_t reach = registers.Reach();
+	if (!Reserve(reach))
+	{
+		error = "Stack overflow"s;
+		return InterpretResult::RuntimeError;
+	}
+	Value* base = stackTop;
 
-		case OpCode::GetMouseY:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(static_cast<long>(GetMouseY()));
-			break;
+#define FAIL(at, message) \
+do \
+{ \
+	ip = (at); \
+	error = (message); \
+	return InterpretResult::RuntimeError; \
+} while (false)
 
-		case OpCode::GetMousePosition:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(static_cast<long>(GetMouseX()));
-			Push(static_cast<long>(GetMouseY()));
-			break;
+#define CHECK_UNDERFLOW() \
+do \
+{ \
+	if ((base - stack) + current->need < 0) \
+	{ \
+		FAIL(current->ip, UnderflowError(*current)); \
+	} \
+} while (false)
+
+#define READ_OPERAND(name, operand) \
+	const Value* name = ReadOperand(operand, base); \
+	if (!name) { return InterpretResult::RuntimeError; }
+
+#define REBASE() \
+do \
+{ \
+	if (!Reserve(reach)) { FAIL(current->ip, "Stack overflow"s); } \
+	base = stackTop; \
+} while (false)
+
+#define SYNC() \
+do \
+{ \
+	stackTop = base + current->depth; \
+	REBASE(); \
+} while (false)
+
+#ifdef PROFILE_OPCODES
+#define PROFILE_INSTRUCTION() instructionCount++
+#else
+#define PROFILE_INSTRUCTION() do { } while (false)
+#endif
+
+#ifdef COMPUTED_GOTO
+	// indexed by RegOp, so this has to stay in the same order as the enum.
+	static void* dispatchTable[] =
+	{
+		&&reg_Move,
+		&&reg_Unary,
+		&&reg_Binary,
+		&&reg_BinaryJumpIfFalse,
+		&&reg_ForLoop,
+		&&reg_Check,
+		&&reg_Print,
+		&&reg_PrintLn,
+		&&reg_Trace,
+		&&reg_ShowTraceLog,
+		&&reg_ClearTraceLog,
+		&&reg_CreateGlobal,
+		&&reg_DelGlobal,
+		&&reg_Sync,
+		&&reg_Jump,
+		&&reg_JumpIfFalse,
+		&&reg_PushJumpAddress,
+		&&reg_JumpToCallStackAddress,
+		&&reg_Native,
+		&&reg_Return,
+		&&reg_End
+	};
+
+#define REG_CASE(op) case RegOp::op: reg_##op
+#define REG_NEXT() \
+do \
+{ \
+	current = instruction++; \
+	PROFILE_INSTRUCTION(); \
+	goto *dispatchTable[static_cast<uint8_t>(current->op)]; \
+} while (false)
+#else
+#define REG_CASE(op) case RegOp::op
+#define REG_NEXT() break
+#endif
 
-		case OpCode::SetMousePosition:
+	const RegInstruction* current;
+	for (;;)
+	{
+		current = instruction++;
+		PROFILE_INSTRUCTION();
+		switch (current->op)
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 2)
-			{
-				error = "Not enough values on stack to set mouse position"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>())
-			{
-				error = "Invalid arguments for set mouse position"s;
-				return InterpretResult::RuntimeError;
-			}
-			long x = *Pop().Get<long>();
-			long y = *Pop().Get<long>();
-			SetMousePosition(x, y);
-			break;
+		REG_CASE(Move):
+		{
+			READ_OPERAND(a, current->a);
+			CHECK_UNDERFLOW();
+#ifdef PROFILE_OPCODES
+			moveCount++;
+#endif
+			// a register stored into a global is dead afterwards, so its value can be moved out.
+			Value value = (current->source == OpCode::StoreGlobal && current->a.kind == Operand::Kind::Register) ? std::move(base[current->a.index]) : *a;
+			if (!WriteOperand(*current, base, std::move(value))) { return InterpretResult::RuntimeError; }
+			REG_NEXT();
 		}
 
-		case OpCode::SetMouseOffset:
+		REG_CASE(Unary):
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 2)
-			{
-				error = "Not enough values on stack to set mouse offset"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>())
-			{
-				error = "Invalid arguments for set mouse offset"s;
-				return InterpretResult::RuntimeError;
-			}
-			long x = *Pop().Get<long>();
-			long y = *Pop().Get<long>();
-			SetMouseOffset(x, y);
-			break;
+			READ_OPERAND(a, current->a);
+			CHECK_UNDERFLOW();
+			Value result = UnaryOperation(current->source, *a);
+			if (!result.Valid()) { FAIL(current->ip, InvalidError(*current)); }
+			if (!WriteOperand(*current, base, std::move(result))) { return InterpretResult::RuntimeError; }
+			REG_NEXT();
 		}
 
-		case OpCode::SetMouseScale:
+		REG_CASE(Binary):
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 2)
-			{
-				error = "Not enough values on stack to set mouse scale"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<double>() || !stackTop[-2].Get<double>())
-			{
-				error = "Invalid arguments for set mouse scale"s;
-				return InterpretResult::RuntimeError;
-			}
-			double x = *Pop().Get<double>();
-			double y = *Pop().Get<double>();
-			SetMouseScale(x, y);
-			break;
+			READ_OPERAND(a, current->a);
+			READ_OPERAND(b, current->b);
+			CHECK_UNDERFLOW();
+			Value result = BinaryOperation(current->source, *a, *b);
+			if (!result.Valid()) { FAIL(current->ip, InvalidError(*current)); }
+			if (!WriteOperand(*current, base, std::move(result))) { return InterpretResult::RuntimeError; }
+			REG_NEXT();
 		}
 
-		case OpCode::GetMouseWheelMove:
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			Push(static_cast<long>(GetMouseWheelMove()));
-			break;
-
-		case OpCode::DrawPixel:
+		REG_CASE(BinaryJumpIfFalse):
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!isDrawing)
-			{
-				error = "Not drawing"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 6)
-			{
-				error = "Not enough values on stack to draw pixel"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>() || !stackTop[-3].Get<long>() || !stackTop[-4].Get<long>() || !stackTop[-5].Get<long>() || !stackTop[-6].Get<long>())
-			{
-				error = "Invalid arguments for draw pixel"s;
-				return InterpretResult::RuntimeError;
-			}
-			long a = *Pop().Get<long>();
-			long b = *Pop().Get<long>();
-			long g = *Pop().Get<long>();
-			long r = *Pop().Get<long>();
-			long y = *Pop().Get<long>();
-			long x = *Pop().Get<long>();
-			DrawPixel(x, y, Color{ static_cast<unsigned char>(r), static_cast<unsigned char>(g), static_cast<unsigned char>(b), static_cast<unsigned char>(a) });
-			break;
+			READ_OPERAND(a, current->a);
+			READ_OPERAND(b, current->b);
+			std::optional<bool> condition = BinaryOperation(current->source, *a, *b).Get<bool>();
+			if (!condition) { FAIL(current->ip, InvalidError(*current)); }
+			SYNC();
+			if (!*condition) { instruction = code + current->target; }
+			REG_NEXT();
 		}
 
-		case OpCode::DrawLine:
+		REG_CASE(ForLoop):
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!isDrawing)
-			{
-				error = "Not drawing"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 9)
-			{
-				error = "Not enough values on stack to draw line"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>() || !stackTop[-3].Get<long>() || !stackTop[-4].Get<long>() || !stackTop[-5].Get<double>() || !stackTop[-6].Get<long>() || !stackTop[-7].Get<long>() || !stackTop[-8].Get<long>() || !stackTop[-9].Get<long>())
+			bool repeat;
+			ip = current->ip;
+			if (!LoopStep(static_cast<uint16_t>(current->a.index), static_cast<uint16_t>(current->b.index), repeat))
 			{
-				error = "Invalid arguments for draw line"s;
 				return InterpretResult::RuntimeError;
 			}
-			long a = *Pop().Get<long>();
-			long b = *Pop().Get<long>();
-			long g = *Pop().Get<long>();
-			long r = *Pop().Get<long>();
-			double thick = *Pop().Get<double>();
-			long y2 = *Pop().Get<long>();
-			long x2 = *Pop().Get<long>();
-			long y1 = *Pop().Get<long>();
-			long x1 = *Pop().Get<long>();
-			DrawLineEx(Vector2{ static_cast<float>(x1), static_cast<float>(y1) }, Vector2{ static_cast<float>(x2), static_cast<float>(y2) }, thick, Color{ static_cast<unsigned char>(r), static_cast<unsigned char>(g), static_cast<unsigned char>(b), static_cast<unsigned char>(a) });
-			break;
+			SYNC();
+			if (repeat) { instruction = code + current->target; }
+			REG_NEXT();
 		}
 
-		case OpCode::DrawCircle:
+		REG_CASE(Check):
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!isDrawing)
-			{
-				error = "Not drawing"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 7)
-			{
-				error = "Not enough values on stack to draw circle"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>() || !stackTop[-3].Get<long>() || !stackTop[-4].Get<long>() || !stackTop[-5].Get<double>() || !stackTop[-6].Get<long>() || !stackTop[-7].Get<long>())
-			{
-				error = "Invalid arguments for draw circle"s;
-				return InterpretResult::RuntimeError;
-			}
-			long a = *Pop().Get<long>();
-			long b = *Pop().Get<long>();
-			long g = *Pop().Get<long>();
-			long r = *Pop().Get<long>();
-			double rad = *Pop().Get<double>();
-			long y = *Pop().Get<long>();
-			long x = *Pop().Get<long>();
-			DrawCircle(x, y, rad, Color{ static_cast<unsigned char>(r), static_cast<unsigned char>(g), static_cast<unsigned char>(b), static_cast<unsigned char>(a) });
-			break;
+			READ_OPERAND(a, current->a);
+			CHECK_UNDERFLOW();
+			REG_NEXT();
 		}
 
-		case OpCode::DrawCircleLines:
+		REG_CASE(Print):
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!isDrawing)
-			{
-				error = "Not drawing"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 7)
-			{
-				error = "Not enough values on stack to draw circle lines"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>() || !stackTop[-3].Get<long>() || !stackTop[-4].Get<long>() || !stackTop[-5].Get<double>() || !stackTop[-6].Get<long>() || !stackTop[-7].Get<long>())
-			{
-				error = "Invalid arguments for draw circle lines"s;
-				return InterpretResult::RuntimeError;
-			}
-			long a = *Pop().Get<long>();
-			long b = *Pop().Get<long>();
-			long g = *Pop().Get<long>();
-			long r = *Pop().Get<long>();
-			double rad = *Pop().Get<double>();
-			long y = *Pop().Get<long>();
-			long x = *Pop().Get<long>();
-			DrawCircleLines(x, y, rad, Color{ static_cast<unsigned char>(r), static_cast<unsigned char>(g), static_cast<unsigned char>(b), static_cast<unsigned char>(a) });
-			break;
+			READ_OPERAND(a, current->a);
+			CHECK_UNDERFLOW();
+			std::cout << *a;
+			REG_NEXT();
 		}
 
-		case OpCode::DrawEllipse:
+		REG_CASE(PrintLn):
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!isDrawing)
-			{
-				error = "Not drawing"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 8)
-			{
-				error = "Not enough values on stack to draw ellipse"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>() || !stackTop[-3].Get<long>() || !stackTop[-4].Get<long>() || !stackTop[-5].Get<double>() || !stackTop[-6].Get<double>() || !stackTop[-7].Get<long>() || !stackTop[-8].Get<long>())
-			{
-				error = "Invalid arguments for draw ellipse"s;
-				return InterpretResult::RuntimeError;
-			}
-			long a = *Pop().Get<long>();
-			long b = *Pop().Get<long>();
-			long g = *Pop().Get<long>();
-			long r = *Pop().Get<long>();
-			double radY = *Pop().Get<double>();
-			double radX = *Pop().Get<double>();
-			long y = *Pop().Get<long>();
-			long x = *Pop().Get<long>();
-			DrawEllipse(x, y, radY, radX, Color{ static_cast<unsigned char>(r), static_cast<unsigned char>(g), static_cast<unsigned char>(b), static_cast<unsigned char>(a) });
-			break;
+			READ_OPERAND(a, current->a);
+			CHECK_UNDERFLOW();
+			std::cout << *a << '\n';
+			REG_NEXT();
 		}
 
-		case OpCode::DrawEllipseLines:
+		REG_CASE(Trace):
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!isDrawing)
-			{
-				error = "Not drawing"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 8)
-			{
-				error = "Not enough values on stack to draw ellipse lines"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>() || !stackTop[-3].Get<long>() || !stackTop[-4].Get<long>() || !stackTop[-5].Get<double>() || !stackTop[-6].Get<double>() || !stackTop[-7].Get<long>() || !stackTop[-8].Get<long>())
-			{
-				error = "Invalid arguments for draw ellipse lines"s;
-				return InterpretResult::RuntimeError;
-			}
-			long a = *Pop().Get<long>();
-			long b = *Pop().Get<long>();
-			long g = *Pop().Get<long>();
-			long r = *Pop().Get<long>();
-			double radY = *Pop().Get<double>();
-			double radX = *Pop().Get<double>();
-			long y = *Pop().Get<long>();
-			long x = *Pop().Get<long>();
-			DrawEllipseLines(x, y, radY, radX, Color{ static_cast<unsigned char>(r), static_cast<unsigned char>(g), static_cast<unsigned char>(b), static_cast<unsigned char>(a) });
-			break;
+			READ_OPERAND(a, current->a);
+			CHECK_UNDERFLOW();
+			traceLog = traceLog + *a + "\n"s;
+			REG_NEXT();
 		}
 
-		case OpCode::DrawRectangle:
+		REG_CASE(ShowTraceLog):
+			std::cout << traceLog;
+			REG_NEXT();
+
+		REG_CASE(ClearTraceLog):
+			traceLog = ""s;
+			REG_NEXT();
+
+		REG_CASE(CreateGlobal):
+			declared[current->a.index] = true;
+			REG_NEXT();
+
+		REG_CASE(DelGlobal):
+			declared[current->a.index] = false;
+			globals[current->a.index] = Value();
+			REG_NEXT();
+
+		REG_CASE(Sync):
+			SYNC();
+			REG_NEXT();
+
+		REG_CASE(Jump):
+			SYNC();
+			instruction = code + current->target;
+			REG_NEXT();
+
+		REG_CASE(JumpIfFalse):
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!isDrawing)
-			{
-				error = "Not drawing"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 8)
-			{
-				error = "Not enough values on stack to draw rectangle"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>() || !stackTop[-3].Get<long>() || !stackTop[-4].Get<long>() || !stackTop[-5].Get<long>() || !stackTop[-6].Get<long>() || !stackTop[-7].Get<long>() || !stackTop[-8].Get<long>())
-			{
-				error = "Invalid arguments for draw rectangle"s;
-				return InterpretResult::RuntimeError;
-			}
-			long a = *Pop().Get<long>();
-			long b = *Pop().Get<long>();
-			long g = *Pop().Get<long>();
-			long r = *Pop().Get<long>();
-			long h = *Pop().Get<long>();
-			long w = *Pop().Get<long>();
-			long y = *Pop().Get<long>();
-			long x = *Pop().Get<long>();
-			DrawRectangle(x, y, w, h, Color{ static_cast<unsigned char>(r), static_cast<unsigned char>(g), static_cast<unsigned char>(b), static_cast<unsigned char>(a) });
-			break;
+			READ_OPERAND(a, current->a);
+			CHECK_UNDERFLOW();
+			std::optional<bool> condition = a->Get<bool>();
+			if (!condition) { FAIL(current->ip, "Invalid arguments for conditional"s); }
+			SYNC();
+			if (!*condition) { instruction = code + current->target; }
+			REG_NEXT();
 		}
 
-		case OpCode::DrawRectangleLines:
-		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!isDrawing)
-			{
-				error = "Not drawing"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 8)
-			{
-				error = "Not enough values on stack to draw rectangle lines"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>() || !stackTop[-3].Get<long>() || !stackTop[-4].Get<long>() || !stackTop[-5].Get<long>() || !stackTop[-6].Get<long>() || !stackTop[-7].Get<long>() || !stackTop[-8].Get<long>())
+		REG_CASE(PushJumpAddress):
+			if (callDepth == callCapacity && !GrowCallStack()) { FAIL(current->ip, "Call stack overflow"s); }
+			callStack[callDepth++] = current->target;
+			REG_NEXT();
+
+		REG_CASE(JumpToCallStackAddress):
+			SYNC();
+			if (callDepth == 0) { FAIL(current->ip, "Call stack is empty, cannot jump"s); }
+			ip = callStack[--callDepth];
+			instruction = registers.Entry(ip);
+			if (!instruction) { FAIL(ip, "Unknown instruction"s); }
+			REG_NEXT();
+
+		REG_CASE(Native):
+			SYNC();
+			ip = current->ip;
+			if (current->source != OpCode::CallNative) { FAIL(current->ip, "Unknown instruction"s); }
+			if (!CallNative(static_cast<uint16_t>(current->target))) { return InterpretResult::RuntimeError; }
+			REBASE();
+			REG_NEXT();
+
+		REG_CASE(Return):
+#ifndef EXCLUDE_RAYLIB
+			if (windowActive)
 			{
-				error = "Invalid arguments for draw rectangle lines"s;
-				return InterpretResult::RuntimeError;
+				CloseWindow();
 			}
-			long a = *Pop().Get<long>();
-			long b = *Pop().Get<long>();
-			long g = *Pop().Get<long>();
-			long r = *Pop().Get<long>();
-			long h = *Pop().Get<long>();
-			long w = *Pop().Get<long>();
-			long y = *Pop().Get<long>();
-			long x = *Pop().Get<long>();
-			DrawRectangleLines(x, y, w, h, Color{ static_cast<unsigned char>(r), static_cast<unsigned char>(g), static_cast<unsigned char>(b), static_cast<unsigned char>(a) });
-			break;
+#endif
+			return InterpretResult::Ok;
+
+		REG_CASE(End):
+			ip = current->ip;
+			return InterpretResult::RuntimeError;
 		}
+	}
+
+#undef REG_NEXT
+#undef REG_CASE
+#undef PROFILE_INSTRUCTION
+#undef SYNC
+#undef REBASE
+#undef READ_OPERAND
+#undef CHECK_UNDERFLOW
+#undef FAIL
+}
 
-		case OpCode::DrawTriangle:
+// the same messages the stack vm reports for the instruction a register instruction was translated from.
+std::string VM::UnderflowError(const RegInstruction& instruction) const
+{
+	using namespace std::string_literals;
+
+	switch (instruction.source)
+	{
+	case OpCode::AsDouble: return "No value on stack to convert to double"s;
+	case OpCode::AsLong: return "No value on stack to convert to long"s;
+	case OpCode::AsString: return "No value on stack to convert to double"s;
+	case OpCode::Negate: return "No value on stack to numerically negate"s;
+	case OpCode::LogicalNot: return "No value on stack to logically negate"s;
+	case OpCode::Duplicate: return "No value on stack to duplicate"s;
+	case OpCode::Pop: return "No value on stack to pop"s;
+	case OpCode::Print: return "No value on the stack to print"s;
+	case OpCode::PrintLn: return "No value on the stack to println"s;
+	case OpCode::Trace: return "No value on the stack to trace"s;
+	case OpCode::JumpIfFalse: return "No value on the stack for a conditional statement"s;
+	case OpCode::StoreGlobal: return "Not enough values on stack to store into variable '" + globalSlots.Name(instruction.dst.index) + '\'';
+	default: return "Not enough values on stack to perform operation '"s + OperationName(instruction.source) + "'"s;
+	}
+}
+
+std::string VM::InvalidError(const RegInstruction& instruction) const
+{
+	using namespace std::string_literals;
+
+	switch (instruction.source)
+	{
+	case OpCode::AsDouble: return "Invalid conversion to double"s;
+	case OpCode::AsLong: return "Invalid conversion to long"s;
+	case OpCode::Negate: return "Invalid argument for numerical negation"s;
+	case OpCode::LogicalNot: return "Invalid argument for logical negation"s;
+	default: return "Invalid arguments for operation '"s + OperationName(instruction.source) + "'"s;
+	}
+}
+
+bool VM::Bind(const std::string& name, Native native)
+{
+	return natives.Bind(name, std::move(native));
+}
+
+// natives are rare next to everything else, so they share this one handler outside the dispatch loops.
+// the arguments are checked and room is made for the results before the native runs, so a failure leaves the stack alone.
+bool VM::CallNative(uint16_t index)
+{
+	using namespace std::string_literals;
+
+	const Native& native = natives.Get(index);
+	size_t count = native.arguments.size();
+	if (static_cast<size_t>(stackTop - stack) < count)
+	{
+		error = "Not enough values on stack to call '"s + natives.Name(index) + "'"s;
+		return false;
+	}
+	if (native.results > count && !Reserve(native.results - count))
+	{
+		error = "Stack overflow"s;
+		return false;
+	}
+	const Value* arguments = stackTop - count;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!NativeRegistry::Accepts(native.arguments[i], arguments[i]))
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!isDrawing)
-			{
-				error = "Not drawing"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 10)
-			{
-				error = "Not enough values on stack to draw triangle"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>() || !stackTop[-3].Get<long>() || !stackTop[-4].Get<long>() || !stackTop[-5].Get<long>() || !stackTop[-6].Get<long>() || !stackTop[-7].Get<long>() || !stackTop[-8].Get<long>() || !stackTop[-9].Get<long>() || !stackTop[-10].Get<long>())
-			{
-				error = "Invalid arguments for draw triangle"s;
-				return InterpretResult::RuntimeError;
-			}
-			long a = *Pop().Get<long>();
-			long b = *Pop().Get<long>();
-			long g = *Pop().Get<long>();
-			long r = *Pop().Get<long>();
-			float y3 = static_cast<float>(*Pop().Get<long>());
-			float x3 = static_cast<float>(*Pop().Get<long>());
-			float y2 = static_cast<float>(*Pop().Get<long>());
-			float x2 = static_cast<float>(*Pop().Get<long>());
-			float y1 = static_cast<float>(*Pop().Get<long>());
-			float x1 = static_cast<float>(*Pop().Get<long>());
-			DrawTriangle(Vector2{ x1, y1 }, Vector2{ x2, y2 }, Vector2{ x3, y3 }, Color{ static_cast<unsigned char>(r), static_cast<unsigned char>(g), static_cast<unsigned char>(b), static_cast<unsigned char>(a) });
-			break;
+			error = "Invalid arguments for '"s + natives.Name(index) + "'"s;
+			return false;
 		}
+	}
+
+	Value results[NativeRegistry::RESULTS_MAX];
+	std::string message;
+	if (!native.function(arguments, results, message))
+	{
+		error = message;
+		return false;
+	}
+	Drop(count);
+	for (uint8_t i = 0; i < native.results; i++)
+	{
+		Push(std::move(results[i]));
+	}
+	return true;
+}
+
+#ifndef EXCLUDE_RAYLIB
+// the raylib functions scripts can call. they check the window and drawing state the vm keeps for them.
+void VM::BindRaylib()
+{
+	using namespace std::string_literals;
+
+	constexpr NativeType LONG = NativeType::Long;
+	constexpr NativeType DOUBLE = NativeType::Double;
+
+	auto bind = [this](const std::string& name, std::vector<NativeType> arguments, uint8_t results, NativeFunction function)
+	{
+		natives.Bind(name, Native{ std::move(arguments), results, std::move(function) });
+	};
+	auto window = [this](std::string& error)
+	{
+		if (!windowActive) { error = "Window not active"s; }
+		return windowActive;
+	};
+	auto drawing = [this, window](std::string& error)
+	{
+		if (!window(error)) { return false; }
+		if (!isDrawing) { error = "Not drawing"s; }
+		return isDrawing;
+	};
+	// four longs pushed as r, g, b, a
+	auto color = [](const Value* rgba)
+	{
+		return Color{ static_cast<unsigned char>(*rgba[0].Get<long>()), static_cast<unsigned char>(*rgba[1].Get<long>()), static_cast<unsigned char>(*rgba[2].Get<long>()), static_cast<unsigned char>(*rgba[3].Get<long>()) };
+	};
 
-		case OpCode::DrawTriangleLines:
+#pragma region CORE MODULE
+	bind("initwindow", { LONG, LONG, NativeType::String }, 0, [this](const Value* arguments, Value*, std::string&)
+	{
+		InitWindow(*arguments[0].Get<long>(), *arguments[1].Get<long>(), arguments[2].Get<std::string>()->c_str());
+		windowActive = true;
+		return true;
+	});
+	bind("windowshouldclose", {}, 1, [window](const Value*, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(WindowShouldClose());
+		return true;
+	});
+	bind("closewindow", {}, 0, [this, window](const Value*, Value*, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		CloseWindow();
+		windowActive = false;
+		return true;
+	});
+	bind("showcursor", {}, 0, [window](const Value*, Value*, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		ShowCursor();
+		return true;
+	});
+	bind("hidecursor", {}, 0, [window](const Value*, Value*, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		HideCursor();
+		return true;
+	});
+	bind("clearbackground", { LONG, LONG, LONG, LONG }, 0, [drawing, color](const Value* arguments, Value*, std::string& error)
+	{
+		if (!drawing(error)) { return false; }
+		ClearBackground(color(arguments));
+		return true;
+	});
+	bind("begindrawing", {}, 0, [this, window](const Value*, Value*, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		if (isDrawing)
 		{
-			if (!windowActive)
-			{
-				error = "Window not active"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!isDrawing)
-			{
-				error = "Not drawing"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (stackTop - stack < 10)
-			{
-				error = "Not enough values on stack to draw triangle lines"s;
-				return InterpretResult::RuntimeError;
-			}
-			if (!stackTop[-1].Get<long>() || !stackTop[-2].Get<long>() || !stackTop[-3].Get<long>() || !stackTop[-4].Get<long>() || !stackTop[-5].Get<long>() || !stackTop[-6].Get<long>() || !stackTop[-7].Get<long>() || !stackTop[-8].Get<long>() || !stackTop[-9].Get<long>() || !stackTop[-10].Get<long>())
-			{
-				error = "Invalid arguments for draw triangle lines"s;
-				return InterpretResult::RuntimeError;
-			}
-			long a = *Pop().Get<long>();
-			long b = *Pop().Get<long>();
-			long g = *Pop().Get<long>();
-			long r = *Pop().Get<long>();
-			float y3 = static_cast<float>(*Pop().Get<long>());
-			float x3 = static_cast<float>(*Pop().Get<long>());
-			float y2 = static_cast<float>(*Pop().Get<long>());
-			float x2 = static_cast<float>(*Pop().Get<long>());
-			float y1 = static_cast<float>(*Pop().Get<long>());
-			float x1 = static_cast<float>(*Pop().Get<long>());
-			DrawTriangleLines(Vector2{ x1, y1 }, Vector2{ x2, y2 }, Vector2{ x3, y3 }, Color{ static_cast<unsigned char>(r), static_cast<unsigned char>(g), static_cast<unsigned char>(b), static_cast<unsigned char>(a) });
-			break;
-		}
-#endif
+			error = "Already drawing"s;
+			return false;
 		}
-	}
+		BeginDrawing();
+		isDrawing = true;
+		return true;
+	});
+	bind("enddrawing", {}, 0, [this, drawing](const Value*, Value*, std::string& error)
+	{
+		if (!drawing(error)) { return false; }
+		EndDrawing();
+		isDrawing = false;
+		return true;
+	});
+	bind("settargetfps", { LONG }, 0, [window](const Value* arguments, Value*, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		SetTargetFPS(*arguments[0].Get<long>());
+		return true;
+	});
+	bind("gettime", {}, 1, [window](const Value*, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(GetTime());
+		return true;
+	});
+	bind("getrandomvalue", { LONG, LONG }, 1, [window](const Value* arguments, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(static_cast<long>(GetRandomValue(*arguments[0].Get<long>(), *arguments[1].Get<long>())));
+		return true;
+	});
+	// TODO: save in loaded file's directory when implemented. save next to exe when in REPL.
+	// loadstoragevalue, savestoragevalue
+	bind("iskeypressed", { LONG }, 1, [window](const Value* arguments, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(IsKeyPressed(*arguments[0].Get<long>()));
+		return true;
+	});
+	bind("iskeydown", { LONG }, 1, [window](const Value* arguments, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(IsKeyDown(*arguments[0].Get<long>()));
+		return true;
+	});
+	bind("iskeyreleased", { LONG }, 1, [window](const Value* arguments, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(IsKeyReleased(*arguments[0].Get<long>()));
+		return true;
+	});
+	bind("iskeyup", { LONG }, 1, [window](const Value* arguments, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(IsKeyUp(*arguments[0].Get<long>()));
+		return true;
+	});
+	bind("getkeypressed", {}, 1, [window](const Value*, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(static_cast<long>(GetKeyPressed()));
+		return true;
+	});
+	bind("setexitkey", { LONG }, 0, [window](const Value* arguments, Value*, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		SetExitKey(*arguments[0].Get<long>());
+		return true;
+	});
+	bind("ismousebuttonpressed", { LONG }, 1, [window](const Value* arguments, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(IsMouseButtonPressed(*arguments[0].Get<long>()));
+		return true;
+	});
+	bind("ismousebuttondown", { LONG }, 1, [window](const Value* arguments, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(IsMouseButtonDown(*arguments[0].Get<long>()));
+		return true;
+	});
+	bind("ismousebuttonreleased", { LONG }, 1, [window](const Value* arguments, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(IsMouseButtonReleased(*arguments[0].Get<long>()));
+		return true;
+	});
+	bind("ismousebuttonup", { LONG }, 1, [window](const Value* arguments, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(IsMouseButtonUp(*arguments[0].Get<long>()));
+		return true;
+	});
+	bind("getmousex", {}, 1, [window](const Value*, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(static_cast<long>(GetMouseX()));
+		return true;
+	});
+	bind("getmousey", {}, 1, [window](const Value*, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(static_cast<long>(GetMouseY()));
+		return true;
+	});
+	bind("getmousepos", {}, 2, [window](const Value*, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(static_cast<long>(GetMouseX()));
+		results[1] = Value(static_cast<long>(GetMouseY()));
+		return true;
+	});
+	// these take y before x
+	bind("setmousepos", { LONG, LONG }, 0, [window](const Value* arguments, Value*, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		SetMousePosition(*arguments[1].Get<long>(), *arguments[0].Get<long>());
+		return true;
+	});
+	bind("setmouseoffset", { LONG, LONG }, 0, [window](const Value* arguments, Value*, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		SetMouseOffset(*arguments[1].Get<long>(), *arguments[0].Get<long>());
+		return true;
+	});
+	bind("setmousescale", { DOUBLE, DOUBLE }, 0, [window](const Value* arguments, Value*, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		SetMouseScale(*arguments[1].Get<double>(), *arguments[0].Get<double>());
+		return true;
+	});
+	bind("getmousewheel", {}, 1, [window](const Value*, Value* results, std::string& error)
+	{
+		if (!window(error)) { return false; }
+		results[0] = Value(static_cast<long>(GetMouseWheelMove()));
+		return true;
+	});
+#pragma endregion
+
+#pragma region SHAPES MODULE
+	bind("drawpixel", { LONG, LONG, LONG, LONG, LONG, LONG }, 0, [drawing, color](const Value* arguments, Value*, std::string& error)
+	{
+		if (!drawing(error)) { return false; }
+		DrawPixel(*arguments[0].Get<long>(), *arguments[1].Get<long>(), color(arguments + 2));
+		return true;
+	});
+	bind("drawline", { LONG, LONG, LONG, LONG, DOUBLE, LONG, LONG, LONG, LONG }, 0, [drawing, color](const Value* arguments, Value*, std::string& error)
+	{
+		if (!drawing(error)) { return false; }
+		Vector2 start{ static_cast<float>(*arguments[0].Get<long>()), static_cast<float>(*arguments[1].Get<long>()) };
+		Vector2 end{ static_cast<float>(*arguments[2].Get<long>()), static_cast<float>(*arguments[3].Get<long>()) };
+		DrawLineEx(start, end, *arguments[4].Get<double>(), color(arguments + 5));
+		return true;
+	});
+	bind("drawcircle", { LONG, LONG, DOUBLE, LONG, LONG, LONG, LONG }, 0, [drawing, color](const Value* arguments, Value*, std::string& error)
+	{
+		if (!drawing(error)) { return false; }
+		DrawCircle(*arguments[0].Get<long>(), *arguments[1].Get<long>(), *arguments[2].Get<double>(), color(arguments + 3));
+		return true;
+	});
+	bind("drawcirclelines", { LONG, LONG, DOUBLE, LONG, LONG, LONG, LONG }, 0, [drawing, color](const Value* arguments, Value*, std::string& error)
+	{
+		if (!drawing(error)) { return false; }
+		DrawCircleLines(*arguments[0].Get<long>(), *arguments[1].Get<long>(), *arguments[2].Get<double>(), color(arguments + 3));
+		return true;
+	});
+	// the second radius pushed is passed first
+	bind("drawellipse", { LONG, LONG, DOUBLE, DOUBLE, LONG, LONG, LONG, LONG }, 0, [drawing, color](const Value* arguments, Value*, std::string& error)
+	{
+		if (!drawing(error)) { return false; }
+		DrawEllipse(*arguments[0].Get<long>(), *arguments[1].Get<long>(), *arguments[3].Get<double>(), *arguments[2].Get<double>(), color(arguments + 4));
+		return true;
+	});
+	bind("drawellipselines", { LONG, LONG, DOUBLE, DOUBLE, LONG, LONG, LONG, LONG }, 0, [drawing, color](const Value* arguments, Value*, std::string& error)
+	{
+		if (!drawing(error)) { return false; }
+		DrawEllipseLines(*arguments[0].Get<long>(), *arguments[1].Get<long>(), *arguments[3].Get<double>(), *arguments[2].Get<double>(), color(arguments + 4));
+		return true;
+	});
+	bind("drawrectangle", std::vector<NativeType>(8, LONG), 0, [drawing, color](const Value* arguments, Value*, std::string& error)
+	{
+		if (!drawing(error)) { return false; }
+		DrawRectangle(*arguments[0].Get<long>(), *arguments[1].Get<long>(), *arguments[2].Get<long>(), *arguments[3].Get<long>(), color(arguments + 4));
+		return true;
+	});
+	bind("drawrectanglelines", std::vector<NativeType>(8, LONG), 0, [drawing, color](const Value* arguments, Value*, std::string& error)
+	{
+		if (!drawing(error)) { return false; }
+		DrawRectangleLines(*arguments[0].Get<long>(), *arguments[1].Get<long>(), *arguments[2].Get<long>(), *arguments[3].Get<long>(), color(arguments + 4));
+		return true;
+	});
+	// three corners as x, y pairs
+	auto corner = [](const Value* xy)
+	{
+		return Vector2{ static_cast<float>(*xy[0].Get<long>()), static_cast<float>(*xy[1].Get<long>()) };
+	};
+	bind("drawtriangle", std::vector<NativeType>(10, LONG), 0, [drawing, color, corner](const Value* arguments, Value*, std::string& error)
+	{
+		if (!drawing(error)) { return false; }
+		DrawTriangle(corner(arguments), corner(arguments + 2), corner(arguments + 4), color(arguments + 6));
+		return true;
+	});
+	bind("drawtrianglelines", std::vector<NativeType>(10, LONG), 0, [drawing, color, corner](const Value* arguments, Value*, std::string& error)
+	{
+		if (!drawing(error)) { return false; }
+		DrawTriangleLines(corner(arguments), corner(arguments + 2), corner(arguments + 4), color(arguments + 6));
+		return true;
+	});
+#pragma endregion
 }
+#endif
 
 std::string VM::ErrorMessage() const
 {
 	using namespace std::string_literals;
 	std::string msg = ""s;
-	for (size_t i = 0; i < callStack.size(); i++)
+	// ip and return addresses point just past the instruction they stand for, which can be on an earlier line,
+	// or in the function an inlined body was taken from
+	// code inlined from a call is shown under that call, the way it would be if the call had pushed a frame
+	auto inlined = [&](size_t offset)
 	{
-		msg += "[Line "s + std::to_string(chunk.ReadLine(callStack[i])) + "]"s;
-		if (chunk.GetMeta(callStack[i] - 2) && chunk.GetMeta(callStack[i] - 2)->Get<std::string>())
+		for (const InlinedCall& call : chunk.ReadInlined(offset))
 		{
-			msg += " @"s + *chunk.GetMeta(callStack[i] - 2)->Get<std::string>();
+			msg += "[Line "s + std::to_string(call.line) + "] @"s + chunk.Symbol(call.symbol) + "\n"s;
+		}
+	};
+	for (size_t i = 0; i < callDepth; i++)
+	{
+		inlined(callStack[i] - 1);
+		msg += "[Line "s + std::to_string(chunk.ReadLine(callStack[i] - 1)) + "]"s;
+		if (chunk.SymbolAt(callStack[i] - 2))
+		{
+			msg += " @"s + *chunk.SymbolAt(callStack[i] - 2);
 		}
 		msg += "\n"s;
 	}
-	return msg + "[Line "s + std::to_string(chunk.ReadLine(ip)) + "] "s + *error.Get<std::string>();
+	inlined(ip > 0 ? ip - 1 : ip);
+	return msg + "[Line "s + std::to_string(chunk.ReadLine(ip > 0 ? ip - 1 : ip)) + "] "s + *error.Get<std::string>();
 }
 
 void VM::Cleanup(bool clearGlobals)
 {
-	while (stackTop > stack) { (--stackTop)->~Value(); }
-	if (clearGlobals) { globals.clear(); }
+	while (stackTop > stack) { *--stackTop = Value(); }
+	if (clearGlobals)
+	{
+		globals.clear();
+		declared.clear();
+		globalSlots.Clear();
+	}
 #ifndef EXCLUDE_RAYLIB
 	if (windowActive)
 	{
@@ -1328,6 +2088,52 @@ void VM::Cleanup(bool clearGlobals)
 #endif
 }
 
+bool VM::Reserve(size_t count)
+{
+	return static_cast<size_t>(stackEnd - stackTop) >= count || GrowStack(count);
+}
+
+// the stack stays one contiguous block, since every backend addresses values relative to the stack top.
+// growing moves it, so anything holding a pointer into the stack has to take it again from stackTop afterwards.
+bool VM::GrowStack(size_t count)
+{
+#ifdef FIXED_STACK
+	return false;
+#else
+	size_t depth = stackTop - stack;
+	size_t capacity = stackEnd - stack;
+	if (depth + count > STACK_MAX) { return false; }
+	while (capacity < depth + count) { capacity *= 2; }
+	if (capacity > STACK_MAX) { capacity = STACK_MAX; }
+
+	Value* grown = new Value[capacity];
+	for (size_t i = 0; i < depth; i++) { grown[i] = std::move(stack[i]); }
+	delete[] stack;
+	stack = grown;
+	stackTop = stack + depth;
+	stackEnd = stack + capacity;
+	return true;
+#endif
+}
+
+// only the vm reads return addresses back, so nothing has to be taken again after the call stack moves
+bool VM::GrowCallStack()
+{
+#ifdef FIXED_STACK
+	return false;
+#else
+	if (callCapacity >= CALL_STACK_MAX) { return false; }
+	size_t capacity = std::min(callCapacity * 2, CALL_STACK_MAX);
+
+	size_t* grown = new size_t[capacity];
+	std::copy(callStack, callStack + callDepth, grown);
+	delete[] callStack;
+	callStack = grown;
+	callCapacity = capacity;
+	return true;
+#endif
+}
+
 bool VM::Push(const Value& value)
 {
 	*stackTop = value;
@@ -1335,10 +2141,80 @@ bool VM::Push(const Value& value)
 	return value.Valid();
 }
 
+bool VM::Push(Value&& value)
+{
+	*stackTop = std::move(value);
+	return (stackTop++)->Valid();
+}
+
 Value VM::Pop()
 {
-	Value val = stackTop[-1];
-	stackTop[-1].~Value();
-	stackTop--;
-	return val;
-}
\ No newline at end of file
+	return std::move(*--stackTop);
+}
+
+void VM::Drop(size_t count)
+{
+	while (count-- > 0) { *--stackTop = Value(); }
+}
+
+#ifdef PROFILE_OPCODES
+void VM::Profile(size_t offset)
+{
+	instructionCount++;
+
+	// only instructions that follow each other in the code count as a sequence, since those are the ones that can be fused.
+	if (profileLength > 0 && profileWindow[profileLength - 1] + chunk.InstructionSize(profileWindow[profileLength - 1]) != offset)
+	{
+		profileLength = 0;
+	}
+	if (profileLength == PROFILE_MAX_LENGTH)
+	{
+		std::copy(profileWindow + 1, profileWindow + PROFILE_MAX_LENGTH, profileWindow);
+		profileLength--;
+	}
+	profileWindow[profileLength++] = offset;
+
+	std::string sequence;
+	for (size_t i = profileLength; i-- > 0;)
+	{
+		sequence.insert(sequence.begin(), static_cast<char>(chunk.Read(profileWindow[i])));
+		if (sequence.length() >= 2)
+		{
+			auto& [count, sample] = opcodeSequences[sequence];
+			if (count++ == 0) { sample = profileWindow[i]; }
+		}
+	}
+}
+
+void VM::ReportProfile()
+{
+	std::cerr << "\n== opcode profile ==\n";
+	if (backend == Backend::Register)
+	{
+		std::cerr << instructionCount << " register instructions executed, " << moveCount << " of them moves\n";
+		return;
+	}
+	std::cerr << instructionCount << " instructions executed\n";
+	for (size_t length = 2; length <= PROFILE_MAX_LENGTH; length++)
+	{
+		std::vector<std::pair<size_t, size_t>> hottest;
+		for (auto& [sequence, entry] : opcodeSequences)
+		{
+			if (sequence.length() == length) { hottest.push_back(entry); }
+		}
+		std::sort(hottest.begin(), hottest.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+		if (hottest.size() > PROFILE_REPORT_COUNT) { hottest.resize(PROFILE_REPORT_COUNT); }
+
+		std::cerr << "-- " << length << "-instruction sequences --\n";
+		for (auto& [count, sample] : hottest)
+		{
+			std::cerr << count << "x\n";
+			for (size_t i = 0, offset = sample; i < length; i++)
+			{
+				offset = chunk.DisassembleInstruction(offset, 0);
+			}
+		}
+	}
+	opcodeSequences.clear();
+}
+#endif
\ No newline at end of file
@@ -3,6 +3,12 @@
 #include <map>
 
 #include "chunk.h"
+#include "image.h"
+#include "linker.h"
+#include "native.h"
+#include "regcode.h"
+#include "jit.h"
+#include "trace.h"
 
 enum class InterpretResult
 {
@@ -12,33 +18,133 @@ enum class InterpretResult
 	RuntimeError
 };
 
+// which interpreter runs the linked chunk.
+// the register backend translates the chunk into three-address code first, see RegisterCode.
+// the jit backend compiles it to native code, see Jit. without a jit for this platform it interprets the chunk.
+// the tracing backend interprets the chunk and compiles hot loops, see Tracer.
+enum class Backend
+{
+	Stack,
+	Register,
+	Jit,
+	Tracing
+};
+
 class VM
 {
 public:
-	VM();
+	VM(Backend backend = Backend::Stack);
 	~VM();
 
-	InterpretResult Interpret(const std::string& source);
-	InterpretResult Interpret(const std::map<std::string, std::string>& sources);
+	InterpretResult Interpret(const std::string& source, OptimizationLevel level = OptimizationLevel::Full);
+	InterpretResult Interpret(const std::map<std::string, std::string>& sources, OptimizationLevel level = OptimizationLevel::Full);
+	// links the sources and saves them as an image at path instead of running them. without meta the image leaves out
+	// the names disassembly and call traces use.
+	InterpretResult Compile(const std::map<std::string, std::string>& sources, const std::string& path, OptimizationLevel level = OptimizationLevel::Full, bool meta = true);
+	// runs an image saved by Compile, straight from the mapped file
+	InterpretResult InterpretImage(const std::string& path);
 	std::string ErrorMessage() const;
+	// makes a host function callable from scripts by name, see NativeRegistry. false if it cannot be bound.
+	bool Bind(const std::string& name, Native native);
 	void Cleanup(bool clearGlobals);
 
-	static constexpr size_t STACK_MAX = 512;
+	// building with FIXED_STACK=n gives a stack of exactly n values inside the vm that never allocates.
+	// otherwise the stack starts at STACK_INITIAL values and doubles as needed, up to STACK_MAX.
+	// the call stack grows the same way from CALL_STACK_INITIAL, so calls nest at most CALL_STACK_MAX deep.
+	// above OptimizationLevel::None tail calls reuse the caller's frame, so they do not count.
+#ifdef FIXED_STACK
+	static constexpr size_t STACK_INITIAL = FIXED_STACK;
+	static constexpr size_t STACK_MAX = FIXED_STACK;
+	static constexpr size_t CALL_STACK_INITIAL = FIXED_STACK;
+	static constexpr size_t CALL_STACK_MAX = FIXED_STACK;
+#else
+	static constexpr size_t STACK_INITIAL = 64;
+	static constexpr size_t STACK_MAX = 1 << 20;
+	static constexpr size_t CALL_STACK_INITIAL = 64;
+	static constexpr size_t CALL_STACK_MAX = 1 << 20;
+#endif
 
 private:
+	Backend backend;
+	// the chunk runs from the image's mapping after InterpretImage, so the image is kept loaded until the next one
+	Image image;
 	Chunk chunk;
+	RegisterCode registers;
+	Jit jit;
+	Tracer tracer;
+	// set when the verifier proved the chunk stays inside the stack and the code
+	bool verified;
 	size_t ip;
-	Value stack[STACK_MAX];
+#ifdef FIXED_STACK
+	Value fixedStack[STACK_MAX];
+#endif
+	Value* stack;
 	Value* stackTop;
+	// one past the last slot, pushes have to check against this unless the room was reserved beforehand
+	Value* stackEnd;
 	Value traceLog;
 	Value error;
-	std::vector<size_t> callStack;
-	std::map<std::string, Value> globals;
+	// return addresses of the calls in progress
+#ifdef FIXED_STACK
+	size_t fixedCallStack[CALL_STACK_MAX];
+#endif
+	size_t* callStack;
+	size_t callDepth;
+	size_t callCapacity;
+	GlobalSlots globalSlots;
+	NativeRegistry natives;
+	std::vector<Value> globals;
+	std::vector<bool> declared;
 #ifndef EXCLUDE_RAYLIB
 	bool windowActive;
 	bool isDrawing;
 #endif
 
+#ifdef PROFILE_OPCODES
+	static constexpr size_t PROFILE_MAX_LENGTH = 4;
+	static constexpr size_t PROFILE_REPORT_COUNT = 10;
+
+	// opcode sequence -> (times executed, offset of one occurrence)
+	std::map<std::string, std::pair<size_t, size_t>> opcodeSequences;
+	size_t profileWindow[PROFILE_MAX_LENGTH];
+	size_t profileLength;
+
+	size_t instructionCount;
+	size_t moveCount;
+
+	void Profile(size_t offset);
+	void ReportProfile();
+#endif
+
+	void Prepare();
+	InterpretResult Start();
+	InterpretResult RunBackend();
+	template <bool singleStep, bool unchecked = false>
+	InterpretResult Run();
+	InterpretResult Step();
+	InterpretResult RunRegisters();
+	InterpretResult RunJit();
+	const Value* ReadOperand(const Operand& operand, Value* base);
+	bool WriteOperand(const RegInstruction& instruction, Value* base, Value&& value);
+	std::string UnderflowError(const RegInstruction& instruction) const;
+	std::string InvalidError(const RegInstruction& instruction) const;
+	// counts a do loop's variable up and tests it against the limit. false with the error set if either cannot be used.
+	bool LoopStep(uint16_t counter, uint16_t limit, bool& repeat);
+	bool CallNative(uint16_t index);
+#ifndef EXCLUDE_RAYLIB
+	void BindRaylib();
+#endif
+	// makes room for count more values, moving the stack if it has to grow. false if it cannot hold them.
+	bool Reserve(size_t count);
+	bool GrowStack(size_t count);
+	// makes room for one more call, moving the call stack if it has to grow. false if it cannot.
+	bool GrowCallStack();
+	// values move onto and off the stack, and operations overwrite their operands in place.
 	bool Push(const Value& value);
+	bool Push(Value&& value);
 	Value Pop();
+	void Drop(size_t count);
+
+	friend class Jit;
+	friend class Tracer;
 };
\ No newline at end of file